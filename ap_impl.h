@@ -2,6 +2,8 @@
 #define HOPE_BIGNUM_AP_IMPL_H
 
 #include "apn.h"
+#include <assert.h>
+#include <stdatomic.h>
 
 #define Macro_min(Marg_exp1, Marg_exp2) \
     ((Marg_exp1) < (Marg_exp2) ? (Marg_exp1) : (Marg_exp2))
@@ -16,15 +18,145 @@
         (Marg_v2) = (Mtmp_swap); \
     } while(0)
 
+// current value of a threshold, Macro_threshold(MUL_KARATSUBA)
+extern size_t apn_thresholds[APN_THRESHOLD_COUNT];
+#define Macro_threshold(Marg_name) (apn_thresholds[APN_THRESHOLD_##Marg_name])
+
+// Counting hooks of apn_stats.h, they compile to nothing without APN_STATS.
+// A scope opened by Macro_stats_begin is closed by Macro_stats_end in the
+// same block, on every path that leaves it.
+#if defined(APN_STATS)
+#include "apn_stats.h"
+struct apn_stats_scope {
+    enum apn_stats_op op;
+    size_t            size;
+    uint64_t          start; // ns
+};
+struct apn_stats_scope apn_stats_enter(enum apn_stats_op op, size_t size);
+void apn_stats_leave(const struct apn_stats_scope* scope);
+void apn_stats_count_tier(enum apn_stats_tier tier);
+void apn_stats_count_alloc(size_t bytes, bool resized);
+#define Macro_stats_begin(Marg_op, Marg_size) \
+    struct apn_stats_scope Mtmp_stats = apn_stats_enter((Marg_op), (Marg_size))
+#define Macro_stats_end() apn_stats_leave(&Mtmp_stats)
+#define Macro_stats_tier(Marg_tier) apn_stats_count_tier(Marg_tier)
+#define Macro_stats_alloc(Marg_bytes) apn_stats_count_alloc((Marg_bytes), false)
+#define Macro_stats_realloc(Marg_bytes) apn_stats_count_alloc((Marg_bytes), true)
+#else
+#define Macro_stats_begin(Marg_op, Marg_size) ((void)0)
+#define Macro_stats_end() ((void)0)
+#define Macro_stats_tier(Marg_tier) ((void)0)
+#define Macro_stats_alloc(Marg_bytes) ((void)0)
+#define Macro_stats_realloc(Marg_bytes) ((void)0)
+#endif
+
+// Digit primitives. The fast paths are chosen at compile time: the double
+// digit product uses unsigned __int128 (mulx with BMI2), carry chains use
+// _addcarry_u64 / _subborrow_u64 on x86-64, bit scans __builtin_clzll /
+// __builtin_ctzll and with popcnt __builtin_popcountll, byte swaps
+// __builtin_bswap64. Define AP_PORTABLE to build the plain C fallback only.
+#if !defined(AP_PORTABLE) && defined(__SIZEOF_INT128__)
+#define AP_HAVE_INT128 1
+__extension__ typedef unsigned __int128 ap_ddig_t;
+#endif
+#if !defined(AP_PORTABLE) && (defined(__GNUC__) || defined(__clang__))
+#define AP_HAVE_BUILTIN_CLZ 1
+#define AP_HAVE_BUILTIN_BSWAP 1
+#endif
+#if !defined(AP_PORTABLE) && defined(__x86_64__) && (defined(__GNUC__) || defined(__clang__))
+#define AP_HAVE_ADDCARRY 1
+#include <x86intrin.h>
+#endif
+
 static inline bool ap_dig_overflow(ap_dig_t r, ap_dig_t a, ap_dig_t b) {
     return r < Macro_min(a, b);
 }
 
+// *r = a + b + c, c is 0 or 1, returns the carry
+static inline unsigned char ap_dig_addc(unsigned char c, ap_dig_t a, ap_dig_t b, ap_dig_t* r) {
+#if defined(AP_HAVE_ADDCARRY)
+    unsigned long long t;
+    c = _addcarry_u64(c, a, b, &t);
+    *r = t;
+    return c;
+#elif defined(AP_HAVE_INT128)
+    ap_ddig_t t = (ap_ddig_t)a + b + c;
+    *r = (ap_dig_t)t;
+    return (unsigned char)(t >> AP_DIG_BIT);
+#else
+    ap_dig_t t = a + b;
+    *r = t + c;
+    return ap_dig_overflow(t, a, b) | (*r < t);
+#endif
+}
+
+// *r = a - b - c, c is 0 or 1, returns the borrow
+static inline unsigned char ap_dig_subb(unsigned char c, ap_dig_t a, ap_dig_t b, ap_dig_t* r) {
+#if defined(AP_HAVE_ADDCARRY)
+    unsigned long long t;
+    c = _subborrow_u64(c, a, b, &t);
+    *r = t;
+    return c;
+#else
+    ap_dig_t t = a - b;
+    *r = t - c;
+    return (t > a) | (*r > t);
+#endif
+}
+
+// number of leading zero bits, n != 0
+static inline unsigned ap_dig_clz(ap_dig_t n) {
+#if defined(AP_HAVE_BUILTIN_CLZ)
+    return (unsigned)__builtin_clzll(n);
+#else
+    unsigned r = 0;
+    for(ap_dig_t m = (ap_dig_t)1 << (AP_DIG_BIT - 1); !(n & m); m >>= 1)
+        ++r;
+    return r;
+#endif
+}
+
+// number of trailing zero bits, n != 0
+static inline unsigned ap_dig_ctz(ap_dig_t n) {
+#if defined(AP_HAVE_BUILTIN_CLZ)
+    return (unsigned)__builtin_ctzll(n);
+#else
+    unsigned r = 0;
+    while(!(n & 1))
+        n >>= 1, ++r;
+    return r;
+#endif
+}
+
+// number of set bits. Without the popcnt instruction the builtin is a
+// library call, the plain version vectorizes in a loop.
+static inline unsigned ap_dig_popcount(ap_dig_t n) {
+#if defined(AP_HAVE_BUILTIN_CLZ) && defined(__POPCNT__)
+    return (unsigned)__builtin_popcountll(n);
+#else
+    n -= (n >> 1) & 0x5555555555555555u;
+    n = (n & 0x3333333333333333u) + ((n >> 2) & 0x3333333333333333u);
+    n = (n + (n >> 4)) & 0x0F0F0F0F0F0F0F0Fu;
+    return (unsigned)((n * 0x0101010101010101u) >> 56);
+#endif
+}
+
 // position of most significant bit
 static inline size_t ap_dig_msb(ap_dig_t n) {
-    size_t r = 0;
-    while(n >>= 1)
-        ++r;
+    return n ? AP_DIG_BIT - 1 - ap_dig_clz(n) : 0;
+}
+
+// position of least significant bit, n != 0
+static inline size_t ap_dig_lsb(ap_dig_t n) {
+    return ap_dig_ctz(n);
+}
+
+// inverse of odd n modulo 2^AP_DIG_BIT
+static inline ap_dig_t ap_dig_binvert(ap_dig_t n) {
+    // n * n = 1 (mod 8), every Newton step doubles the number of correct bits
+    ap_dig_t r = n;
+    for(int i = 0; i != 5; ++i)
+        r *= 2 - n * r;
     return r;
 }
 
@@ -34,6 +166,11 @@ struct ap_dig_pair {
 };
 
 static inline struct ap_dig_pair ap_dig_mul(ap_dig_t op1, ap_dig_t op2) {
+#if defined(AP_HAVE_INT128)
+    ap_ddig_t t = (ap_ddig_t)op1 * op2;
+    struct ap_dig_pair res = { .lo = (ap_dig_t)t, .hi = (ap_dig_t)(t >> AP_DIG_BIT) };
+    return res;
+#else
     enum { half = AP_DIG_BIT >> 1 };
     // lo and hi parts of operands
     ap_dig_t al = op1 & ((1ULL << half) - 1), ah = op1 >> half,
@@ -51,10 +188,14 @@ static inline struct ap_dig_pair ap_dig_mul(ap_dig_t op1, ap_dig_t op2) {
 
     res.hi = (ah * bh) + (t >> half) + ((ap_dig_t)tcarry << half) + locarry;
     return res;
+#endif
 }
 
 // 2 / 1 -> 1 division, only quotient is needed
 static inline ap_dig_t ap_dig_div_2d1t1(struct ap_dig_pair a, ap_dig_t b) {
+#if defined(AP_HAVE_INT128)
+    return (ap_dig_t)((((ap_ddig_t)a.hi << AP_DIG_BIT) | a.lo) / b);
+#else
     // let B = 1 << AP_DIG_BIT, compute (a.hi * B + a.lo) / b,
     // divide each number x as q = x / b, r = x % b, x = q * b + r.
     // substitute back to the original formula expands to
@@ -86,6 +227,189 @@ static inline ap_dig_t ap_dig_div_2d1t1(struct ap_dig_pair a, ap_dig_t b) {
     res += a.lo / b;
 
     return res;
+#endif
+}
+
+// reciprocal floor((B^2 - 1) / d) - B of a normalized d (msb set),
+// B = 2^AP_DIG_BIT
+static inline ap_dig_t ap_dig_reciprocal(ap_dig_t d) {
+    struct ap_dig_pair a = { .lo = AP_DIG_MAX, .hi = ~d };
+    return ap_dig_div_2d1t1(a, d);
+}
+
+// 2 / 1 -> 1 division by a normalized d with its reciprocal v, a.hi < d,
+// the remainder goes to *rem. Two multiplications instead of a hardware
+// division, see Niels Möller and Torbjörn Granlund, "Improved division by
+// invariant integers", 2011
+static inline ap_dig_t ap_dig_divrem_2d1t1(struct ap_dig_pair a, ap_dig_t d, ap_dig_t v,
+                                           ap_dig_t* rem) {
+    struct ap_dig_pair q = ap_dig_mul(v, a.hi);
+    ap_dig_addc(ap_dig_addc(0, q.lo, a.lo, &q.lo), q.hi, a.hi, &q.hi);
+    ap_dig_t q1 = q.hi + 1, r = a.lo - q1 * d;
+    if(r > q.lo) // unlikely
+        --q1, r += d;
+    if(r >= d) // unlikely
+        ++q1, r -= d;
+    *rem = r;
+    return q1;
+}
+
+// reciprocal floor((B^3 - 1) / (d1 B + d0)) - B of a normalized two digit
+// divisor, from the reciprocal of d1 adjusted for d0
+static inline ap_dig_t ap_dig_reciprocal_3d2(ap_dig_t d1, ap_dig_t d0) {
+    ap_dig_t v = ap_dig_reciprocal(d1), p = d1 * v + d0;
+    if(p < d0) {
+        --v;
+        if(p >= d1)
+            --v, p -= d1;
+        p -= d1;
+    }
+    struct ap_dig_pair t = ap_dig_mul(v, d0);
+    p += t.hi;
+    if(p < t.hi) {
+        --v;
+        if(p > d1 || (p == d1 && t.lo >= d0))
+            --v;
+    }
+    return v;
+}
+
+// 3 / 2 -> 1 division of u2 u1 u0 by a normalized d1 d0 with its reciprocal
+// v, u2 u1 < d1 d0, the two digit remainder goes to *rem
+static inline ap_dig_t ap_dig_divrem_3d2t1(ap_dig_t u2, ap_dig_t u1, ap_dig_t u0,
+                                           ap_dig_t d1, ap_dig_t d0, ap_dig_t v,
+                                           struct ap_dig_pair* rem) {
+    struct ap_dig_pair q = ap_dig_mul(v, u2);
+    ap_dig_addc(ap_dig_addc(0, q.lo, u1, &q.lo), q.hi, u2, &q.hi);
+    // r = u1 u0 - q.hi d1 d0 - d1 d0 (mod B^2)
+    struct ap_dig_pair t = ap_dig_mul(d0, q.hi), r = { .hi = u1 - q.hi * d1 };
+    ap_dig_subb(ap_dig_subb(0, u0, t.lo, &r.lo), r.hi, t.hi, &r.hi);
+    ap_dig_subb(ap_dig_subb(0, r.lo, d0, &r.lo), r.hi, d1, &r.hi);
+    ap_dig_t q1 = q.hi + 1;
+    if(r.hi >= q.lo) {
+        --q1;
+        ap_dig_addc(ap_dig_addc(0, r.lo, d0, &r.lo), r.hi, d1, &r.hi);
+    }
+    if(r.hi > d1 || (r.hi == d1 && r.lo >= d0)) { // unlikely
+        ++q1;
+        ap_dig_subb(ap_dig_subb(0, r.lo, d0, &r.lo), r.hi, d1, &r.hi);
+    }
+    *rem = r;
+    return q1;
+}
+
+// workspace stack, memory must have been reserved before
+static inline ap_dig_t* apn_ws_push(apn_ws_s* ws, size_t n) {
+    assert(ws->_top + n <= ws->_capacity);
+    ap_dig_t* p = ws->_data + ws->_top;
+    ws->_top += n;
+    return p;
+}
+
+static inline void apn_ws_pop(apn_ws_s* ws, size_t n) {
+    assert(n <= ws->_top);
+    ws->_top -= n;
+}
+
+// copy n digits to o, leading zeros are dropped
+void apn_assign_data(apn_s* o, const ap_dig_t* p, size_t n);
+// n with leading zero digits dropped, at least 1
+static inline size_t apn_data_norm(const ap_dig_t* p, size_t n) {
+    while(n > 1 && !p[n - 1])
+        --n;
+    return n;
+}
+
+// rp[0, an) = ap[0, an) +- bp[0, bn), an >= bn, returns carry / borrow
+static inline ap_dig_t apn_data_add_nm(ap_dig_t* rp, const ap_dig_t* ap, size_t an,
+                                       const ap_dig_t* bp, size_t bn) {
+    ap_dig_t carry = apn_data_add_n(rp, ap, bp, bn);
+    return apn_data_add_1(rp + bn, ap + bn, an - bn, carry);
+}
+
+static inline ap_dig_t apn_data_sub_nm(ap_dig_t* rp, const ap_dig_t* ap, size_t an,
+                                       const ap_dig_t* bp, size_t bn) {
+    ap_dig_t borrow = apn_data_sub_n(rp, ap, bp, bn);
+    return apn_data_sub_1(rp + bn, ap + bn, an - bn, borrow);
+}
+
+// rp[0, an) = |ap - bp|, an >= bn, returns whether ap < bp
+bool apn_data_absdiff(ap_dig_t* rp, const ap_dig_t* ap, size_t an,
+                      const ap_dig_t* bp, size_t bn);
+
+// Digit array algorithms, results never overlap the operands.
+// rp[0, an + bn) = ap * bp, an >= bn >= 1, squares if ap == bp and an == bn
+void apn_data_mul(ap_dig_t* rp, const ap_dig_t* ap, size_t an,
+                  const ap_dig_t* bp, size_t bn, apn_ws_s* ws);
+void apn_data_mul_basecase(ap_dig_t* rp, const ap_dig_t* ap, size_t an,
+                           const ap_dig_t* bp, size_t bn);
+void apn_data_mul_karatsuba(ap_dig_t* rp, const ap_dig_t* ap, size_t an,
+                            const ap_dig_t* bp, size_t bn, apn_ws_s* ws);
+// the Toom algorithms and FFT square if ap == bp and an == bn
+void apn_data_mul_toom33(ap_dig_t* rp, const ap_dig_t* ap, size_t an,
+                         const ap_dig_t* bp, size_t bn, apn_ws_s* ws);
+void apn_data_mul_toom44(ap_dig_t* rp, const ap_dig_t* ap, size_t an,
+                         const ap_dig_t* bp, size_t bn, apn_ws_s* ws);
+void apn_data_mul_fft(ap_dig_t* rp, const ap_dig_t* ap, size_t an,
+                      const ap_dig_t* bp, size_t bn, apn_ws_s* ws);
+size_t apn_data_mul_fft_itch(size_t an, size_t bn);
+// workspace needed by any of the multiplications above
+size_t apn_data_mul_itch(size_t an, size_t bn);
+// Fork-join on the thread pool, see apn_thread.c. A spawned task runs
+// fn(arg, ws) on some thread with a workspace of that thread, ws has
+// nothing in use and the task reserves what it needs.
+struct apn_task {
+    void        (*fn)(void* arg, apn_ws_s* ws);
+    void*       arg;
+    atomic_bool done;
+};
+typedef struct apn_task apn_task_s;
+// whether sub-products of n digits should be spawned
+bool apn_task_parallel(size_t n);
+void apn_task_spawn(apn_task_s* t);
+// returns when t is done, runs queued tasks meanwhile
+void apn_task_wait(apn_task_s* t);
+
+// rp[0, 2n) = ap^2
+void apn_data_sqr(ap_dig_t* rp, const ap_dig_t* ap, size_t n, apn_ws_s* ws);
+void apn_data_sqr_basecase(ap_dig_t* rp, const ap_dig_t* ap, size_t n);
+void apn_data_sqr_karatsuba(ap_dig_t* rp, const ap_dig_t* ap, size_t n, apn_ws_s* ws);
+size_t apn_data_sqr_itch(size_t n);
+// np[0, nn) / dp[0, dn), dp normalized (msb set), nn >= dn. Quotient digits
+// go to qp[0, nn - dn), the high digit (0 or 1) is returned, remainder replaces
+// np[0, dn), the digits above it are left undefined.
+ap_dig_t apn_data_div_basecase(ap_dig_t* qp, ap_dig_t* np, size_t nn,
+                               const ap_dig_t* dp, size_t dn);
+
+// Product of two residues of n digits, reduced by the modulus in ctx, for
+// the windowed exponentiation. rp may alias the operands, ap == bp squares.
+typedef void (*apn_data_modmul_fn)(ap_dig_t* rp, const ap_dig_t* ap, const ap_dig_t* bp,
+                                   const void* ctx, apn_ws_s* ws);
+// rp[0, n) = gp^exp by sliding windows, exp != 0, `itch` is the workspace of
+// one product
+void apn_data_powm(ap_dig_t* rp, const ap_dig_t* gp, size_t n, const apn_s* exp,
+                   apn_data_modmul_fn mul, const void* ctx, apn_ws_s* ws);
+size_t apn_data_powm_itch(size_t n, const apn_s* exp, size_t itch);
+
+// bits [lo, lo + cnt) of e, 0 < cnt < AP_DIG_BIT, the exponent windows
+static inline ap_dig_t apn_exp_bits(const apn_s* e, size_t lo, unsigned cnt) {
+    size_t i = lo / AP_DIG_BIT;
+    unsigned sh = lo % AP_DIG_BIT;
+    ap_dig_t r = e->_data[i] >> sh;
+    if(sh + cnt > AP_DIG_BIT && i + 1 < e->_size)
+        r |= e->_data[i + 1] << (AP_DIG_BIT - sh);
+    return r & (((ap_dig_t)1 << cnt) - 1);
+}
+
+// window size of the sliding window exponentiation for a bits-bit exponent,
+// 2^(k-1) odd powers are precomputed and about bits / (k + 1) multiplications
+// are left
+static inline unsigned apn_exp_window(size_t bits) {
+    static const size_t limits[] = { 7, 25, 81, 241, 673, 1793 };
+    unsigned k = 1;
+    while(k <= 6 && bits > limits[k - 1])
+        ++k;
+    return k;
 }
 
 #endif // HOPE_BIGNUM_AP_IMPL_H
@@ -6,15 +6,55 @@
 #include <string.h>
 #include <assert.h>
 
+// whether the digits live in the struct itself
+static inline bool apn_is_inline(const apn_s* o) {
+    return o->_data == o->_inline;
+}
+
 void apn_realloc(apn_s* o, size_t new_capacity) {
-    if(o->_size <= new_capacity)
+    Macro_stats_begin(APN_STATS_REALLOC, new_capacity);
+    bool keep = o->_size <= new_capacity; // otherwise the value becomes 0
+    if(new_capacity <= APN_INLINE_DIGITS) {
+        if(!apn_is_inline(o)) {
+            if(keep && o->_size)
+                memcpy(o->_inline, o->_data, o->_size * sizeof(ap_dig_t));
+            free(o->_data);
+            o->_data = o->_inline;
+        }
+        new_capacity = APN_INLINE_DIGITS;
+    } else if(apn_is_inline(o)) {
+        ap_dig_t* p = malloc(new_capacity * sizeof(ap_dig_t));
+        Macro_stats_alloc(new_capacity * sizeof(ap_dig_t));
+        if(keep)
+            memcpy(p, o->_inline, o->_size * sizeof(ap_dig_t));
+        o->_data = p;
+    } else if(keep) {
         o->_data = realloc(o->_data, new_capacity * sizeof(ap_dig_t));
-    else {
+        Macro_stats_realloc(new_capacity * sizeof(ap_dig_t));
+    } else {
         free(o->_data);
-        o->_data = calloc(new_capacity, sizeof(ap_dig_t));
+        o->_data = malloc(new_capacity * sizeof(ap_dig_t));
+        Macro_stats_alloc(new_capacity * sizeof(ap_dig_t));
+    }
+    if(!keep) {
+        memset(o->_data, 0, new_capacity * sizeof(ap_dig_t));
         o->_size = 1;
     }
     o->_capacity = new_capacity;
+    Macro_stats_end();
+}
+
+void apn_reserve(apn_s* o, size_t capacity) {
+    if(o->_capacity >= capacity)
+        return;
+    // grow by half at least, so that growing one digit at a time moves the
+    // digits O(log n) times
+    apn_realloc(o, Macro_max(capacity, o->_capacity + o->_capacity / 2));
+}
+
+void apn_shrink_to_fit(apn_s* o) {
+    if(o->_capacity > Macro_max(o->_size, (size_t)APN_INLINE_DIGITS))
+        apn_realloc(o, o->_size);
 }
 
 void apn_data_fill_zero(apn_s* o) {
@@ -22,8 +62,9 @@ void apn_data_fill_zero(apn_s* o) {
 }
 
 void apn_init(apn_s* o) {
-    o->_capacity = 1;
-    o->_data = calloc(o->_capacity, sizeof(ap_dig_t));
+    memset(o->_inline, 0, sizeof(o->_inline));
+    o->_data = o->_inline;
+    o->_capacity = APN_INLINE_DIGITS;
     o->_size = 1;
 }
 
@@ -38,7 +79,8 @@ void apn_init_list(apn_s* o, ...) {
 }
 
 void apn_clear(apn_s* o) {
-    free(o->_data);
+    if(!apn_is_inline(o))
+        free(o->_data);
     o->_data = NULL;
     o->_capacity = 0;
     o->_size = 0;
@@ -54,10 +96,42 @@ void apn_clear_list(apn_s* o, ...) {
     va_end(args);
 }
 
+void apn_ws_init(apn_ws_s* ws) {
+    ws->_data = NULL;
+    ws->_capacity = 0;
+    ws->_top = 0;
+}
+
+void apn_ws_clear(apn_ws_s* ws) {
+    assert(!ws->_top);
+    free(ws->_data);
+    apn_ws_init(ws);
+}
+
+void apn_ws_reserve(apn_ws_s* ws, size_t size) {
+    if(ws->_capacity - ws->_top >= size)
+        return;
+    assert(!ws->_top); // would move digits in use
+    if(ws->_data)
+        Macro_stats_realloc(size * sizeof(ap_dig_t));
+    else
+        Macro_stats_alloc(size * sizeof(ap_dig_t));
+    ws->_data = realloc(ws->_data, size * sizeof(ap_dig_t));
+    ws->_capacity = size;
+}
+
+// *dst = *src, the digits stored inline move along
+static void apn_move(apn_s* dst, const apn_s* src) {
+    *dst = *src;
+    if(apn_is_inline(src))
+        dst->_data = dst->_inline;
+}
+
 void apn_swap(apn_s* a, apn_s* b) {
-    Macro_swap_val(ap_dig_t*, a->_data, b->_data);
-    Macro_swap_val(size_t, a->_size, b->_size);
-    Macro_swap_val(size_t, a->_capacity, b->_capacity);
+    apn_s t;
+    apn_move(&t, a);
+    apn_move(a, b);
+    apn_move(b, &t);
 }
 
 void apn_assign_part(apn_s* res, const apn_s* op, size_t start, size_t size) {
@@ -67,8 +141,7 @@ void apn_assign_part(apn_s* res, const apn_s* op, size_t start, size_t size) {
         return;
     }
 
-    if(res->_capacity < size)
-        apn_realloc(res, size);
+    apn_reserve(res, size);
     res->_size = size;
     memmove(res->_data, op->_data + start, size * sizeof(ap_dig_t));
 }
@@ -85,8 +158,20 @@ void apn_assign_part_zero(apn_s* res, const apn_s* op, size_t start, size_t size
     apn_assign_part(res, op, start, size);
 }
 
+void apn_assign_data(apn_s* o, const ap_dig_t* p, size_t n) {
+    if(!n) {
+        apn_assign_dig(o, 0);
+        return;
+    }
+    n = apn_data_norm(p, n);
+    apn_reserve(o, n);
+    o->_size = n;
+    memmove(o->_data, p, n * sizeof(ap_dig_t));
+}
+
 void apn_assign(apn_s* res, const apn_s* op) {
-    apn_assign_part(res, op, 0, op->_size);
+    if(res != op)
+        apn_assign_part(res, op, 0, op->_size);
 }
 
 void apn_assign_dig(apn_s* o, ap_dig_t dig) {
@@ -9,16 +9,109 @@ typedef uint64_t ap_dig_t;
 #define AP_DIG_MAX UINT64_MAX
 #define AP_DIG_BIT 64 // 2^n
 
+// digits kept in the struct before going to the heap
+#define APN_INLINE_DIGITS 4
+
 struct arbitrary_precision_natural {
-    ap_dig_t* _data; // little-endian
+    ap_dig_t* _data; // little-endian, _inline or on the heap
     size_t    _capacity; // allocated size
     size_t    _size; // valid digits
+    ap_dig_t  _inline[APN_INLINE_DIGITS];
 };
 typedef struct arbitrary_precision_natural apn_s;
 
+// Scratch memory for the recursive algorithms, temporaries are taken from it
+// as a stack. Reserve it once and pass it to the *_ws functions to avoid
+// allocation on every call.
+struct arbitrary_precision_workspace {
+    ap_dig_t* _data;
+    size_t    _capacity; // allocated size
+    size_t    _top; // digits in use
+};
+typedef struct arbitrary_precision_workspace apn_ws_s;
+
+// Montgomery form modulo an odd m of n digits, x is represented by
+// x R (mod m) with R = base^n. Set up once and reuse it for all
+// multiplications by the same modulus.
+struct arbitrary_precision_montgomery {
+    apn_s     _mod;
+    apn_s     _r2; // R^2 (mod m)
+    ap_dig_t  _minv; // -m^-1 (mod base)
+};
+typedef struct arbitrary_precision_montgomery apn_mont_s;
+
+// Barrett reduction modulo any m of k digits, for reducing many values by
+// the same modulus.
+struct arbitrary_precision_barrett {
+    apn_s     _mod;
+    apn_s     _mu; // [base^2k / m]
+};
+typedef struct arbitrary_precision_barrett apn_barrett_s;
+
+// A one digit divisor with its normalized reciprocal, dividing by it takes
+// multiplications only. Set up once for many divisions by the same digit.
+struct arbitrary_precision_dig_inverse {
+    ap_dig_t  _d; // the divisor shifted up to its msb
+    ap_dig_t  _v; // [(base^2 - 1) / _d] - base
+    unsigned  _shift;
+};
+typedef struct arbitrary_precision_dig_inverse apn_dig_inv_s;
+
+// Default algorithm thresholds in digits, a header written by the tune
+// program on the target machine replaces them when APN_TUNED is defined.
+// They can be changed at run time by apn_threshold_set.
+#if defined(APN_TUNED)
+#include "apn_tuned.h"
+#endif
+#ifndef APN_MUL_KARATSUBA_THRESHOLD
 #define APN_MUL_KARATSUBA_THRESHOLD 16
-#define APN_DIV_BZ_THRESHOLD        32
+#endif
+#ifndef APN_MUL_TOOM33_THRESHOLD
+#define APN_MUL_TOOM33_THRESHOLD    100
+#endif
+#ifndef APN_MUL_TOOM44_THRESHOLD
+#define APN_MUL_TOOM44_THRESHOLD    250
+#endif
+#ifndef APN_MUL_FFT_THRESHOLD
+#define APN_MUL_FFT_THRESHOLD       4000
+#endif
+#ifndef APN_SQR_KARATSUBA_THRESHOLD
+#define APN_SQR_KARATSUBA_THRESHOLD 32
+#endif
+#ifndef APN_SQR_TOOM33_THRESHOLD
+#define APN_SQR_TOOM33_THRESHOLD    140
+#endif
+#ifndef APN_SQR_TOOM44_THRESHOLD
+#define APN_SQR_TOOM44_THRESHOLD    350
+#endif
+#ifndef APN_SQR_FFT_THRESHOLD
+#define APN_SQR_FFT_THRESHOLD       4000
+#endif
+#ifndef APN_DIV_BZ_THRESHOLD
+#define APN_DIV_BZ_THRESHOLD        100
+#endif
+#ifndef APN_DIV_BZ_BLOCKSIZE
 #define APN_DIV_BZ_BLOCKSIZE        32
+#endif
+#ifndef APN_DIV_NEWTON_THRESHOLD
+#define APN_DIV_NEWTON_THRESHOLD    100000
+#endif
+#ifndef APN_DIVEXACT_NEWTON_THRESHOLD
+#define APN_DIVEXACT_NEWTON_THRESHOLD 6000
+#endif
+#ifndef APN_TO_STR_DC_THRESHOLD
+#define APN_TO_STR_DC_THRESHOLD     30
+#endif
+#ifndef APN_ASSIGN_STR_DC_THRESHOLD
+#define APN_ASSIGN_STR_DC_THRESHOLD 10
+#endif
+#ifndef APN_HGCD_THRESHOLD
+#define APN_HGCD_THRESHOLD          400
+#endif
+#ifndef APN_GCD_DC_THRESHOLD
+#define APN_GCD_DC_THRESHOLD        2000
+#endif
+#define APN_THREAD_GRAIN            500
 
 void apn_init(apn_s* o);
 void apn_clear(apn_s* o);
@@ -26,8 +119,61 @@ void apn_clear(apn_s* o);
 void apn_init_list(apn_s* o, ...);
 void apn_clear_list(apn_s* o, ...);
 
+void apn_ws_init(apn_ws_s* ws);
+void apn_ws_clear(apn_ws_s* ws);
+// make room for `size` digits, must not be called while digits are in use
+void apn_ws_reserve(apn_ws_s* ws, size_t size);
+// workspace digits needed by apn_mul_ws / apn_sqr_ws / apn_div_ws for operands of given sizes
+size_t apn_mul_ws_size(size_t n1, size_t n2);
+size_t apn_sqr_ws_size(size_t n);
+size_t apn_div_ws_size(size_t n1, size_t n2);
+
+// Multiplication runs independent sub-products on a work-stealing pool of n
+// threads, the calling thread included, down to sub-products with operands
+// of `grain` digits. The results are the same as with n = 1, the default,
+// which is serial. Not to be called while other threads use the library.
+void apn_threads_set(unsigned n);
+unsigned apn_threads_get(void);
+void apn_threads_set_grain(size_t grain);
+size_t apn_threads_get_grain(void);
+
+// The thresholds above in effect for this process. Values below the
+// smallest one an algorithm works with are raised to it, the value set is
+// returned. Not to be called while other threads use the library.
+enum apn_threshold {
+    APN_THRESHOLD_MUL_KARATSUBA,
+    APN_THRESHOLD_MUL_TOOM33,
+    APN_THRESHOLD_MUL_TOOM44,
+    APN_THRESHOLD_MUL_FFT,
+    APN_THRESHOLD_SQR_KARATSUBA,
+    APN_THRESHOLD_SQR_TOOM33,
+    APN_THRESHOLD_SQR_TOOM44,
+    APN_THRESHOLD_SQR_FFT,
+    APN_THRESHOLD_DIV_BZ,
+    APN_THRESHOLD_DIV_BZ_BLOCKSIZE,
+    APN_THRESHOLD_TO_STR_DC,
+    APN_THRESHOLD_ASSIGN_STR_DC,
+    APN_THRESHOLD_HGCD,
+    APN_THRESHOLD_GCD_DC,
+    APN_THRESHOLD_DIV_NEWTON,
+    APN_THRESHOLD_DIVEXACT_NEWTON,
+    APN_THRESHOLD_COUNT
+};
+size_t apn_threshold_get(enum apn_threshold t);
+size_t apn_threshold_set(enum apn_threshold t, size_t value);
+// back to the compiled defaults
+void apn_threshold_reset(void);
+// macro name of the default, e.g. "APN_MUL_KARATSUBA_THRESHOLD"
+const char* apn_threshold_name(enum apn_threshold t);
+
 void apn_swap(apn_s* a, apn_s* b);
+// exactly new_capacity digits, or the APN_INLINE_DIGITS inline ones for up
+// to that many. The value becomes 0 if it does not fit.
 void apn_realloc(apn_s* o, size_t new_capacity);
+// room for at least `capacity` digits keeping the value, grows geometrically
+void apn_reserve(apn_s* o, size_t capacity);
+// release the digits above the size
+void apn_shrink_to_fit(apn_s* o);
 void apn_assign(apn_s* res, const apn_s* op);
 // asserts valid range
 void apn_assign_part(apn_s* res, const apn_s* op, size_t start, size_t size);
@@ -39,6 +185,34 @@ void apn_assign_dig(apn_s* o, ap_dig_t dig);
 void apn_assign_str(apn_s* o, const char* str, int base);
 void apn_to_str(const apn_s* o, char* str, int base);
 void apn_to_str_bexp2(const apn_s* o, char* str, int blog2);
+// free the powers of the bases cached by the conversions, which are shared
+// by all threads, not while other threads convert
+void apn_str_cache_clear(void);
+
+// count words of size bytes at data, the most significant word first if
+// order is 1 or last if -1, with the bytes in each word big-endian if
+// endian is 1, little-endian if -1 or in the host order if 0. Words of
+// AP_DIG_BIT bits with order and endian -1 are the layout of _data.
+void apn_import(apn_s* res, size_t count, int order, size_t size, int endian,
+                const void* data);
+// writes apn_export_count(op, size) words, none for zero, returns the count
+size_t apn_export(void* data, int order, size_t size, int endian, const apn_s* op);
+size_t apn_export_count(const apn_s* op, size_t size);
+// A length-prefixed binary form of apn_serialized_size(op) bytes, the digit
+// count and the sign of an apz_s in 8 bytes followed by the digits. Returns
+// the bytes written, or read from the len at buf, 0 if they are not a whole
+// number or a negative one is read into an apn_s.
+size_t apn_serialized_size(const apn_s* op);
+size_t apn_serialize(void* buf, const apn_s* op);
+size_t apn_deserialize(apn_s* res, const void* buf, size_t len);
+// A read-only operand viewing the n digits at p without copying, p aligned
+// for ap_dig_t. Up to APN_INLINE_DIGITS they are copied to the inline digits
+// and the view is a number of its own, longer ones stay at p: p must
+// outlive the view, which is never a result or cleared. Returns view.
+const apn_s* apn_wrap(apn_s* view, const ap_dig_t* p, size_t n);
+// apn_deserialize by apn_wrap, 0 also if the digits are not aligned or the
+// host is big-endian
+size_t apn_deserialize_wrap(apn_s* view, const void* buf, size_t len);
 
 bool apn_is_zero(const apn_s* o);
 bool apn_is_odd(const apn_s* o);
@@ -46,34 +220,114 @@ bool apn_is_odd(const apn_s* o);
 // shift digits
 void apn_shl(apn_s* res, const apn_s* o, size_t n);
 void apn_shr(apn_s* res, const apn_s* o, size_t n);
-// bitwise shift, n < AP_DIG_BIT
+// bitwise shift by any n
 void apn_bit_shl(apn_s* res, const apn_s* o, size_t n);
 void apn_bit_shr(apn_s* res, const apn_s* o, size_t n);
+// single bits, bit 0 is the least significant
+bool apn_tstbit(const apn_s* op, size_t bit);
+void apn_setbit(apn_s* op, size_t bit);
+void apn_clrbit(apn_s* op, size_t bit);
+// number of significant bits, 0 for zero
+size_t apn_bitlen(const apn_s* op);
+size_t apn_popcount(const apn_s* op);
+// the first set bit from start up, SIZE_MAX if there is none. apn_scan1(op,
+// 0) is the number of trailing zeros of op != 0
+size_t apn_scan1(const apn_s* op, size_t start);
+// res = op1 & op2, op1 | op2, op1 ^ op2, op1 & ~op2
+void apn_and(apn_s* res, const apn_s* op1, const apn_s* op2);
+void apn_or(apn_s* res, const apn_s* op1, const apn_s* op2);
+void apn_xor(apn_s* res, const apn_s* op1, const apn_s* op2);
+void apn_andnot(apn_s* res, const apn_s* op1, const apn_s* op2);
 
 int apn_cmp(const apn_s* op1, const apn_s* op2); // stdlib-style compare function
 int apn_cmp_dig(const apn_s* op, ap_dig_t dig);
 
 void apn_add(apn_s* res, const apn_s* op1, const apn_s* op2);
 void apn_add_dig(apn_s* res, const apn_s* op, ap_dig_t dig);
+// res += op, the digits of res above op are only touched by the carry
+void apn_add_inplace(apn_s* res, const apn_s* op);
+// res += op * dig
+void apn_addmul_dig(apn_s* res, const apn_s* op, ap_dig_t dig);
 // op2 < op1
 void apn_sub(apn_s* res, const apn_s* op1, const apn_s* op2);
 void apn_sub_dig(apn_s* res, const apn_s* op, ap_dig_t dig);
+// res -= op * dig, op * dig <= res
+void apn_submul_dig(apn_s* res, const apn_s* op, ap_dig_t dig);
 
 void apn_mul(apn_s* res, const apn_s* op1, const apn_s* op2);
 void apn_mul_basecase(apn_s* res, const apn_s* op1, const apn_s* op2);
 void apn_mul_karatsuba(apn_s* res, const apn_s* op1, const apn_s* op2);
+void apn_mul_toom33(apn_s* res, const apn_s* op1, const apn_s* op2);
+void apn_mul_toom44(apn_s* res, const apn_s* op1, const apn_s* op2);
+void apn_mul_fft(apn_s* res, const apn_s* op1, const apn_s* op2);
+void apn_mul_ws(apn_s* res, const apn_s* op1, const apn_s* op2, apn_ws_s* ws);
+void apn_mul_dig(apn_s* res, const apn_s* op, ap_dig_t dig);
+void apn_sqr(apn_s* res, const apn_s* op);
+void apn_sqr_basecase(apn_s* res, const apn_s* op);
+void apn_sqr_karatsuba(apn_s* res, const apn_s* op);
+void apn_sqr_toom33(apn_s* res, const apn_s* op);
+void apn_sqr_toom44(apn_s* res, const apn_s* op);
+void apn_sqr_fft(apn_s* res, const apn_s* op);
+void apn_sqr_ws(apn_s* res, const apn_s* op, apn_ws_s* ws);
 // quot and rem can be NULL.
 void apn_div(apn_s* quot, apn_s* rem, const apn_s* op1, const apn_s* op2);
 void apn_div_basecase(apn_s* quot, apn_s* rem, const apn_s* op1, const apn_s* op2);
 void apn_div_bz(apn_s* quot, apn_s* rem, const apn_s* op1, const apn_s* op2);
+void apn_div_newton(apn_s* quot, apn_s* rem, const apn_s* op1, const apn_s* op2);
+void apn_div_ws(apn_s* quot, apn_s* rem, const apn_s* op1, const apn_s* op2, apn_ws_s* ws);
 // [op1 / op2]
-void apn_idiv(apn_s* quot, const apn_s* op1, const apn_s* op2); // TODO
+void apn_idiv(apn_s* quot, const apn_s* op1, const apn_s* op2);
+// op1 / op2 for op2 dividing op1, from the low digits up
+void apn_divexact(apn_s* quot, const apn_s* op1, const apn_s* op2);
+// quot = [op / dig], returns op mod dig, quot can be NULL. dig != 0
+ap_dig_t apn_divrem_dig(apn_s* quot, const apn_s* op, ap_dig_t dig);
+ap_dig_t apn_mod_dig(const apn_s* op, ap_dig_t dig);
+// the same by a divisor set up by apn_dig_inv_init
+void apn_dig_inv_init(apn_dig_inv_s* inv, ap_dig_t dig);
+ap_dig_t apn_divrem_dig_inv(apn_s* quot, const apn_s* op, const apn_dig_inv_s* inv);
+ap_dig_t apn_mod_dig_inv(const apn_s* op, const apn_dig_inv_s* inv);
 
-void apn_sqr(apn_s* res, const apn_s* op);
 void apn_exp(apn_s* res, const apn_s* base, const apn_s* exp);
 void apn_exp_dig(apn_s* res, const apn_s* base, ap_dig_t exp);
 void apn_exp_bysqr(apn_s* res, const apn_s* base, const apn_s* exp); // exp != 0
 void apn_modexp(apn_s* res, const apn_s* base, const apn_s* exp, const apn_s* mod);
+// res[i] = base[i]^exp[i] (mod mod[i]) for i < count, jobs with equal moduli
+// share one context, the jobs run on the threads of apn_threads_set
+void apn_modexp_batch(apn_s* res, const apn_s* base, const apn_s* exp, const apn_s* mod,
+                      size_t count);
+
+// Lehmer's algorithm with double digit steps, the half-gcd above
+// APN_GCD_DC_THRESHOLD
+void apn_gcd(apn_s* res, const apn_s* op1, const apn_s* op2);
+// op^-1 (mod mod), false and res unchanged if gcd(op, mod) != 1, mod != 0
+bool apn_invert(apn_s* res, const apn_s* op, const apn_s* mod);
+
+// res = [sqrt(op)], rem = op - res^2, rem can be NULL
+void apn_sqrtrem(apn_s* res, apn_s* rem, const apn_s* op);
+// res = [op^(1/k)], rem = op - res^k, k >= 1, rem can be NULL
+void apn_rootrem(apn_s* res, apn_s* rem, const apn_s* op, ap_dig_t k);
+// whether op = x^2, and whether op = x^k for some k >= 2, true for 0 and 1
+bool apn_perfect_square(const apn_s* op);
+bool apn_perfect_power(const apn_s* op);
+
+// mod is odd
+void apn_mont_init(apn_mont_s* ctx, const apn_s* mod);
+void apn_mont_clear(apn_mont_s* ctx);
+// to and from Montgomery form
+void apn_mont_to(apn_s* res, const apn_s* op, const apn_mont_s* ctx);
+void apn_mont_from(apn_s* res, const apn_s* op, const apn_mont_s* ctx);
+// op1 op2 R^-1 (mod m), operands in Montgomery form, less than m
+void apn_mont_mul(apn_s* res, const apn_s* op1, const apn_s* op2, const apn_mont_s* ctx);
+// base^exp (mod m), base and result in normal form
+void apn_mont_modexp(apn_s* res, const apn_s* base, const apn_s* exp, const apn_mont_s* ctx);
+
+void apn_barrett_init(apn_barrett_s* ctx, const apn_s* mod);
+void apn_barrett_clear(apn_barrett_s* ctx);
+// op (mod m)
+void apn_barrett_reduce(apn_s* res, const apn_s* op, const apn_barrett_s* ctx);
+// op1 op2 (mod m), operands less than m
+void apn_barrett_mulmod(apn_s* res, const apn_s* op1, const apn_s* op2, const apn_barrett_s* ctx);
+void apn_barrett_modexp(apn_s* res, const apn_s* base, const apn_s* exp, const apn_barrett_s* ctx);
 
 // low level
 void apn_data_fill_zero(apn_s* o);
@@ -81,5 +335,23 @@ size_t apn_data_add(ap_dig_t* rp, const ap_dig_t* ap, size_t an,
                     const ap_dig_t* bp, size_t bn);
 size_t apn_data_sub(ap_dig_t* rp, const ap_dig_t* ap, size_t an,
                     const ap_dig_t* bp, size_t bn);
+// fixed size operations on digit arrays, return the carry / borrow out
+ap_dig_t apn_data_add_n(ap_dig_t* rp, const ap_dig_t* ap, const ap_dig_t* bp, size_t n);
+ap_dig_t apn_data_sub_n(ap_dig_t* rp, const ap_dig_t* ap, const ap_dig_t* bp, size_t n);
+ap_dig_t apn_data_add_1(ap_dig_t* rp, const ap_dig_t* ap, size_t n, ap_dig_t dig);
+ap_dig_t apn_data_sub_1(ap_dig_t* rp, const ap_dig_t* ap, size_t n, ap_dig_t dig);
+// rp = ap * dig, rp += ap * dig, rp -= ap * dig
+ap_dig_t apn_data_mul_1(ap_dig_t* rp, const ap_dig_t* ap, size_t n, ap_dig_t dig);
+ap_dig_t apn_data_addmul_1(ap_dig_t* rp, const ap_dig_t* ap, size_t n, ap_dig_t dig);
+ap_dig_t apn_data_submul_1(ap_dig_t* rp, const ap_dig_t* ap, size_t n, ap_dig_t dig);
+// bitwise shift, 0 <= cnt < AP_DIG_BIT, returns the bits shifted out
+ap_dig_t apn_data_lshift(ap_dig_t* rp, const ap_dig_t* ap, size_t n, unsigned cnt);
+ap_dig_t apn_data_rshift(ap_dig_t* rp, const ap_dig_t* ap, size_t n, unsigned cnt);
+int apn_data_cmp(const ap_dig_t* ap, const ap_dig_t* bp, size_t n);
+// rp = ap / dig, where dig is known to divide ap
+void apn_data_divexact_1(ap_dig_t* rp, const ap_dig_t* ap, size_t n, ap_dig_t dig);
+// qp = ap / inv, returns the remainder, qp may be ap or NULL
+ap_dig_t apn_data_divrem_1(ap_dig_t* qp, const ap_dig_t* ap, size_t n,
+                           const apn_dig_inv_s* inv);
 
 #endif // HOPE_BIGNUM_APN_H
@@ -5,21 +5,13 @@ size_t apn_data_add(ap_dig_t* rp, const ap_dig_t* ap, size_t an,
                     const ap_dig_t* bp, size_t bn) {
     size_t max_size = Macro_max(an, bn) + 1;
 
-    bool carry = false;
+    unsigned char carry = 0;
     size_t i = 0;
-    for(; i != Macro_min(an, bn); ++i) {
-        ap_dig_t t = ap[i] + bp[i];
-        bool tcarry = ap_dig_overflow(t, ap[i], bp[i]);
-
-        rp[i] = t + carry;
-        carry = tcarry || ap_dig_overflow(rp[i], t, carry); // carry will not overflow if t did
-    }
+    for(; i != Macro_min(an, bn); ++i)
+        carry = ap_dig_addc(carry, ap[i], bp[i], &rp[i]);
     const ap_dig_t* p = (i < an) ? ap : bp;
-    for(; i != max_size - 1; ++i) {
-        ap_dig_t t = p[i] + carry;
-        carry = ap_dig_overflow(t, p[i], carry);
-        rp[i] = t;
-    }
+    for(; i != max_size - 1; ++i)
+        carry = ap_dig_addc(carry, p[i], 0, &rp[i]);
     if(carry)
         rp[max_size - 1] = 1;
 
@@ -28,53 +20,69 @@ size_t apn_data_add(ap_dig_t* rp, const ap_dig_t* ap, size_t an,
 
 void apn_add(apn_s* res, const apn_s* op1, const apn_s* op2) {
     size_t max_size = Macro_max(op1->_size, op2->_size) + 1;
-    if(res->_capacity < max_size)
-        apn_realloc(res, max_size);
+    Macro_stats_begin(APN_STATS_ADD, max_size - 1);
+    apn_reserve(res, max_size);
 
     res->_size = apn_data_add(res->_data, op1->_data, op1->_size,
                               op2->_data, op2->_size);
+    Macro_stats_end();
 }
 
+// in place only the carry chain is touched
 void apn_add_dig(apn_s* res, const apn_s* op, ap_dig_t dig) {
-    apn_assign(res, op);
-    ap_dig_t *p = res->_data;
-
-    ap_dig_t t = *p;
-    *p += dig;
-    if(ap_dig_overflow(*p, t, dig)) {
-        ++p;
-        while(p != res->_data + res->_size && *p == AP_DIG_MAX)
-            *p++ = 0;
-
-        if(p == res->_data + res->_size) {
-            if(res->_capacity == res->_size)
-                apn_realloc(res, res->_size + 1);
-            res->_data[res->_size++] = 1;
-        } else
-            *p += 1;
+    size_t n = op->_size;
+    apn_reserve(res, n + 1);
+
+    ap_dig_t carry = apn_data_add_1(res->_data, op->_data, n, dig);
+    res->_size = n;
+    if(carry)
+        res->_data[res->_size++] = carry;
+}
+
+void apn_add_inplace(apn_s* res, const apn_s* op) {
+    size_t rn = res->_size, on = op->_size, n = Macro_max(rn, on);
+    apn_reserve(res, n + 1);
+
+    ap_dig_t* rp = res->_data;
+    ap_dig_t carry;
+    if(rn >= on) { // the digits of res above op only see the carry
+        carry = apn_data_add_n(rp, rp, op->_data, on);
+        carry = apn_data_add_1(rp + on, rp + on, rn - on, carry);
+    } else {
+        carry = apn_data_add_n(rp, rp, op->_data, rn);
+        carry = apn_data_add_1(rp + rn, op->_data + rn, on - rn, carry);
     }
+    res->_size = n;
+    if(carry)
+        rp[res->_size++] = carry;
+}
+
+void apn_addmul_dig(apn_s* res, const apn_s* op, ap_dig_t dig) {
+    size_t rn = res->_size, on = op->_size, n = Macro_max(rn, on);
+    apn_reserve(res, n + 1);
+
+    ap_dig_t* rp = res->_data;
+    for(size_t i = rn; i < on; ++i)
+        rp[i] = 0;
+    ap_dig_t carry = apn_data_addmul_1(rp, op->_data, on, dig);
+    carry = apn_data_add_1(rp + on, rp + on, n - on, carry);
+    res->_size = n;
+    if(carry)
+        rp[res->_size++] = carry;
+    res->_size = apn_data_norm(rp, res->_size); // dig may be 0
 }
 
 size_t apn_data_sub(ap_dig_t* rp, const ap_dig_t* ap, size_t an,
                     const ap_dig_t* bp, size_t bn) {
     size_t max_size = Macro_max(an, bn);
 
-    bool borrow = false;
+    unsigned char borrow = 0;
     size_t i = 0;
-    for(; i != Macro_min(an, bn); ++i) {
-        ap_dig_t t = ap[i] - bp[i];
-        bool tborrow = t > ap[i]; // underflow
-
-        rp[i] = t - borrow;
-        borrow = tborrow || rp[i] > t;
-    }
+    for(; i != Macro_min(an, bn); ++i)
+        borrow = ap_dig_subb(borrow, ap[i], bp[i], &rp[i]);
     const ap_dig_t* p = (i < an) ? ap : bp;
-    for(; i != max_size; ++i) {
-        ap_dig_t t = p[i] - borrow;
-        borrow = t > p[i];
-
-        rp[i] = t;
-    }
+    for(; i != max_size; ++i)
+        borrow = ap_dig_subb(borrow, p[i], 0, &rp[i]);
     while(--i && !rp[i]);
 
     return borrow ? 0 : i + 1;
@@ -82,26 +90,84 @@ size_t apn_data_sub(ap_dig_t* rp, const ap_dig_t* ap, size_t an,
 
 void apn_sub(apn_s* res, const apn_s* op1, const apn_s* op2) {
     size_t max_size = Macro_max(op1->_size, op2->_size);
-    if(res->_capacity < max_size)
-        apn_realloc(res, max_size);
+    Macro_stats_begin(APN_STATS_SUB, max_size);
+    apn_reserve(res, max_size);
 
     res->_size = apn_data_sub(res->_data, op1->_data, op1->_size, op2->_data, op2->_size);
     if(!res->_size) // underflow
         apn_assign_dig(res, 0);
+    Macro_stats_end();
 }
 
 void apn_sub_dig(apn_s* res, const apn_s* op, ap_dig_t dig) {
-    apn_assign(res, op);
-    ap_dig_t *p = res->_data;
-
-    ap_dig_t t = *p;
-    *p -= dig;
-    if(*p > t) {
-        ++p;
-        while(p != res->_data + res->_size && *p == 0)
-            *p++ = AP_DIG_MAX;
-        // if(p == res->_data + res->_size) underflow;
-        *p -= 1;
+    size_t n = op->_size;
+    apn_reserve(res, n);
+
+    apn_data_sub_1(res->_data, op->_data, n, dig); // dig <= op
+    res->_size = apn_data_norm(res->_data, n);
+}
+
+void apn_submul_dig(apn_s* res, const apn_s* op, ap_dig_t dig) {
+    size_t rn = res->_size, on = op->_size;
+    if(!dig || apn_is_zero(op))
+        return;
+    if(on > rn) { // underflow
+        apn_assign_dig(res, 0);
+        return;
     }
+
+    ap_dig_t* rp = res->_data;
+    ap_dig_t borrow = apn_data_submul_1(rp, op->_data, on, dig);
+    borrow = apn_data_sub_1(rp + on, rp + on, rn - on, borrow);
+    if(borrow) // underflow
+        apn_assign_dig(res, 0);
+    else
+        res->_size = apn_data_norm(rp, rn);
+}
+
+ap_dig_t apn_data_add_n(ap_dig_t* rp, const ap_dig_t* ap, const ap_dig_t* bp, size_t n) {
+    unsigned char carry = 0;
+    for(size_t i = 0; i != n; ++i)
+        carry = ap_dig_addc(carry, ap[i], bp[i], &rp[i]);
+    return carry;
+}
+
+ap_dig_t apn_data_sub_n(ap_dig_t* rp, const ap_dig_t* ap, const ap_dig_t* bp, size_t n) {
+    unsigned char borrow = 0;
+    for(size_t i = 0; i != n; ++i)
+        borrow = ap_dig_subb(borrow, ap[i], bp[i], &rp[i]);
+    return borrow;
 }
 
+ap_dig_t apn_data_add_1(ap_dig_t* rp, const ap_dig_t* ap, size_t n, ap_dig_t dig) {
+    size_t i = 0;
+    for(; i != n && dig; ++i)
+        dig = ap_dig_addc(0, ap[i], dig, &rp[i]);
+    if(rp != ap)
+        for(; i != n; ++i)
+            rp[i] = ap[i];
+    return dig;
+}
+
+ap_dig_t apn_data_sub_1(ap_dig_t* rp, const ap_dig_t* ap, size_t n, ap_dig_t dig) {
+    size_t i = 0;
+    for(; i != n && dig; ++i)
+        dig = ap_dig_subb(0, ap[i], dig, &rp[i]);
+    if(rp != ap)
+        for(; i != n; ++i)
+            rp[i] = ap[i];
+    return dig;
+}
+
+bool apn_data_absdiff(ap_dig_t* rp, const ap_dig_t* ap, size_t an,
+                      const ap_dig_t* bp, size_t bn) {
+    size_t i = an;
+    while(i != bn && !ap[i - 1])
+        rp[--i] = 0;
+    if(i == bn && apn_data_cmp(ap, bp, bn) < 0) {
+        apn_data_sub_n(rp, bp, ap, bn);
+        return true;
+    }
+    apn_data_sub_nm(rp, ap, i, bp, bn);
+    return false;
+}
@@ -0,0 +1,174 @@
+#include "apn.h"
+#include "apz.h"
+#include "ap_impl.h"
+#include <string.h>
+
+// Barrett reduction, see Paul Barrett, "Implementing the Rivest Shamir and
+// Adleman Public Key Encryption Algorithm on a Standard Digital Signal
+// Processor", 1986, and Handbook of Applied Cryptography, Algorithm 14.42.
+// With mu = [B^2k / m] for a k-digit m, x < B^2k has the quotient estimate
+// q = [[x / B^(k-1)] mu / B^(k+1)], which is at most 2 too small, and one
+// more when the low product terms are dropped.
+
+static size_t apn_barrett_itch(size_t k, size_t un) {
+    // q1 mu, q m and the k + 1 digit remainder
+    return (k + 1 + un) + (un + k) + (k + 1) + apn_data_mul_itch(un, k + 1);
+}
+
+// q[k + 1, k + 1 + un) = [q1 mu / B^(k+1)] or one less, from the product
+// terms at or above digit k - 1 only, q1 = xp[k - 1, 2k)
+static void apn_data_barrett_mulhi(ap_dig_t* q, const ap_dig_t* xp, const ap_dig_t* up,
+                                   size_t k, size_t un) {
+    // the dropped terms add up to less than k B^k
+    memset(q, 0, (k + 1 + un) * sizeof(ap_dig_t));
+    for(size_t j = 0; j != un; ++j) {
+        size_t i = j < k - 1 ? k - 1 - j : 0;
+        q[k + 1 + j] = apn_data_addmul_1(q + i + j, xp + k - 1 + i, k + 1 - i, up[j]);
+    }
+}
+
+// p[0, k + 1) = q mp (mod B^(k+1)), q of un digits
+static void apn_data_barrett_mullo(ap_dig_t* p, const ap_dig_t* q, size_t un,
+                                   const ap_dig_t* mp, size_t k) {
+    p[k] = apn_data_mul_1(p, mp, k, q[0]);
+    for(size_t i = 1; i != Macro_min(un, k + 1); ++i)
+        apn_data_addmul_1(p + i, mp, k + 1 - i, q[i]);
+}
+
+// rp[0, k) = xp[0, 2k) (mod m)
+static void apn_data_barrett_reduce(ap_dig_t* rp, const ap_dig_t* xp, const apn_barrett_s* ctx,
+                                    apn_ws_s* ws) {
+    const ap_dig_t *mp = ctx->_mod._data, *up = ctx->_mu._data;
+    size_t k = ctx->_mod._size, un = ctx->_mu._size; // un >= k + 1
+    ap_dig_t* q = apn_ws_push(ws, (k + 1 + un) + (un + k) + (k + 1));
+    ap_dig_t* p = q + k + 1 + un;
+    ap_dig_t* r = p + un + k;
+    // r = x - q m (mod B^(k+1)), q is the digits above k + 1 of q1 mu. Only
+    // half of each product is needed, which saves work while they are
+    // quadratic.
+    if(k < Macro_threshold(MUL_TOOM33)) {
+        apn_data_barrett_mulhi(q, xp, up, k, un);
+        apn_data_barrett_mullo(p, q + k + 1, un, mp, k);
+    } else {
+        apn_data_mul(q, up, un, xp + k - 1, k + 1, ws);
+        apn_data_mul(p, q + k + 1, un, mp, k, ws);
+    }
+    apn_data_sub_n(r, xp, p, k + 1);
+    while(r[k] || apn_data_cmp(r, mp, k) >= 0)
+        r[k] -= apn_data_sub_n(r, r, mp, k);
+    memcpy(rp, r, k * sizeof(ap_dig_t));
+    apn_ws_pop(ws, (k + 1 + un) + (un + k) + (k + 1));
+}
+
+void apn_barrett_init(apn_barrett_s* ctx, const apn_s* mod) {
+    size_t k = mod->_size;
+    apn_init_list(&ctx->_mod, &ctx->_mu, NULL);
+    apn_assign(&ctx->_mod, mod);
+    // mu = B^2k / m
+    apn_s t;
+    apn_init(&t);
+    apn_realloc(&t, 2 * k + 1);
+    apn_data_fill_zero(&t);
+    t._data[2 * k] = 1;
+    t._size = 2 * k + 1;
+    apn_div(&ctx->_mu, NULL, &t, mod);
+    apn_clear(&t);
+}
+
+void apn_barrett_clear(apn_barrett_s* ctx) {
+    apn_clear_list(&ctx->_mod, &ctx->_mu, NULL);
+}
+
+void apn_barrett_reduce(apn_s* res, const apn_s* op, const apn_barrett_s* ctx) {
+    size_t k = ctx->_mod._size, n = op->_size;
+    if(apn_cmp(op, &ctx->_mod) < 0) {
+        apn_assign(res, op);
+        return;
+    }
+    apn_ws_s ws;
+    apn_ws_init(&ws);
+    apn_ws_reserve(&ws, 2 * k + apn_barrett_itch(k, ctx->_mu._size));
+    ap_dig_t* x = apn_ws_push(&ws, 2 * k);
+    // the top 2k digits first, then each time the remainder with the next
+    // k digits below it
+    size_t i = n > 2 * k ? n - 2 * k : 0;
+    memset(x, 0, 2 * k * sizeof(ap_dig_t));
+    memcpy(x, op->_data + i, (n - i) * sizeof(ap_dig_t));
+    apn_data_barrett_reduce(x, x, ctx, &ws);
+    while(i) {
+        size_t s = Macro_min(i, k);
+        i -= s;
+        memmove(x + s, x, k * sizeof(ap_dig_t));
+        memcpy(x, op->_data + i, s * sizeof(ap_dig_t));
+        memset(x + s + k, 0, (k - s) * sizeof(ap_dig_t));
+        apn_data_barrett_reduce(x, x, ctx, &ws);
+    }
+    apn_assign_data(res, x, k);
+    apn_ws_pop(&ws, 2 * k);
+    apn_ws_clear(&ws);
+}
+
+// apn_data_modmul_fn of Barrett reduced products
+static void apn_barrett_modmul(ap_dig_t* rp, const ap_dig_t* ap, const ap_dig_t* bp,
+                               const void* ctx, apn_ws_s* ws) {
+    const apn_barrett_s* barrett = ctx;
+    size_t k = barrett->_mod._size;
+    ap_dig_t* t = apn_ws_push(ws, 2 * k);
+    apn_data_mul(t, ap, k, bp, k, ws); // squares if ap == bp
+    apn_data_barrett_reduce(rp, t, barrett, ws);
+    apn_ws_pop(ws, 2 * k);
+}
+
+static size_t apn_barrett_modmul_itch(const apn_barrett_s* ctx) {
+    size_t k = ctx->_mod._size;
+    return 2 * k + Macro_max(apn_data_mul_itch(k, k), apn_barrett_itch(k, ctx->_mu._size));
+}
+
+void apn_barrett_mulmod(apn_s* res, const apn_s* op1, const apn_s* op2, const apn_barrett_s* ctx) {
+    size_t k = ctx->_mod._size;
+    apn_ws_s ws;
+    apn_ws_init(&ws);
+    apn_ws_reserve(&ws, 3 * k + apn_barrett_modmul_itch(ctx));
+    ap_dig_t* a = apn_ws_push(&ws, 3 * k);
+    ap_dig_t* b = a + k;
+    ap_dig_t* r = b + k;
+    memset(a, 0, 2 * k * sizeof(ap_dig_t));
+    memcpy(a, op1->_data, op1->_size * sizeof(ap_dig_t));
+    memcpy(b, op2->_data, op2->_size * sizeof(ap_dig_t));
+    apn_barrett_modmul(r, a, op1 == op2 ? a : b, ctx, &ws);
+    apn_assign_data(res, r, k);
+    apn_ws_pop(&ws, 3 * k);
+    apn_ws_clear(&ws);
+}
+
+void apn_barrett_modexp(apn_s* res, const apn_s* base, const apn_s* exp, const apn_barrett_s* ctx) {
+    size_t k = ctx->_mod._size;
+    if(apn_is_zero(exp)) { // 1 (mod m)
+        apn_assign_dig(res, apn_cmp_dig(&ctx->_mod, 1) != 0);
+        return;
+    }
+    Macro_stats_begin(APN_STATS_MODEXP, k);
+    Macro_stats_tier(APN_STATS_MODEXP_BARRETT);
+    apn_s b;
+    apn_init(&b);
+    apn_barrett_reduce(&b, base, ctx);
+    apn_ws_s ws;
+    apn_ws_init(&ws);
+    apn_ws_reserve(&ws, 2 * k + apn_data_powm_itch(k, exp, apn_barrett_modmul_itch(ctx)));
+    ap_dig_t* g = apn_ws_push(&ws, k);
+    ap_dig_t* r = apn_ws_push(&ws, k);
+    memset(g, 0, k * sizeof(ap_dig_t));
+    memcpy(g, b._data, b._size * sizeof(ap_dig_t));
+    apn_data_powm(r, g, k, exp, apn_barrett_modmul, ctx, &ws);
+    apn_assign_data(res, r, k);
+    apn_ws_pop(&ws, 2 * k);
+    apn_ws_clear(&ws);
+    apn_clear(&b);
+    Macro_stats_end();
+}
+
+void apz_mod_barrett(apn_s* mod, const apz_s* op, const apn_barrett_s* ctx) {
+    apn_barrett_reduce(mod, &op->magnitude, ctx);
+    if(op->sign && !apn_is_zero(mod))
+        apn_sub(mod, &ctx->_mod, mod);
+}
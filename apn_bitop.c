@@ -1,12 +1,12 @@
 #include "apn.h"
+#include "ap_impl.h"
 #include <string.h>
 
 void apn_shl(apn_s* res, const apn_s* o, size_t n) {
-    if(!n)
+    if(!n || apn_is_zero(o))
         apn_assign(res, o);
-    else if(!apn_is_zero(o)) {
-        if(res->_capacity < o->_size + n)
-            apn_realloc(res, o->_size + n);
+    else {
+        apn_reserve(res, o->_size + n);
 
         memmove(res->_data + n, o->_data, o->_size * sizeof(ap_dig_t));
         memset(res->_data, 0, n * sizeof(ap_dig_t));
@@ -15,56 +15,181 @@ void apn_shl(apn_s* res, const apn_s* o, size_t n) {
 }
 
 void apn_shr(apn_s* res, const apn_s* o, size_t n) {
-    if(!n)
+    if(!n) {
+        apn_assign(res, o);
         return;
+    }
 
     if(o->_size <= n)
         apn_assign_dig(res, 0);
     else {
         size_t new_size = o->_size - n;
-        if(res->_capacity < new_size)
-            apn_realloc(res, new_size);
+        apn_reserve(res, new_size);
 
         memmove(res->_data, o->_data + n, new_size * sizeof(ap_dig_t));
         res->_size = new_size;
     }
 }
 
+// one pass over the digits, the whole digits of the shift only move the
+// destination
 void apn_bit_shl(apn_s* res, const apn_s* o, size_t n) {
-    if(!n)
+    if(!n || apn_is_zero(o)) {
+        apn_assign(res, o);
         return;
+    }
 
-    if(res->_capacity < o->_size + 1)
-        apn_realloc(res, o->_size + 1);
+    size_t q = n / AP_DIG_BIT, on = o->_size;
+    apn_reserve(res, on + q + 1);
+    // from the top, o may be res
+    ap_dig_t out = apn_data_lshift(res->_data + q, o->_data, on, n % AP_DIG_BIT);
+    memset(res->_data, 0, q * sizeof(ap_dig_t));
+    res->_data[on + q] = out;
+    res->_size = on + q + (out != 0);
+}
+
+void apn_bit_shr(apn_s* res, const apn_s* o, size_t n) {
+    if(!n) {
+        apn_assign(res, o);
+        return;
+    }
 
-    ap_dig_t carry = 0;
-    for(size_t i = 0; i != o->_size; ++i) {
-        ap_dig_t x = o->_data[i];
-        res->_data[i] = (x << n) + carry;
-        carry = x >> (AP_DIG_BIT - n);
+    size_t q = n / AP_DIG_BIT;
+    if(o->_size <= q) {
+        apn_assign_dig(res, 0);
+        return;
     }
+    size_t rn = o->_size - q;
+    apn_reserve(res, rn);
+    // from the bottom, o may be res
+    apn_data_rshift(res->_data, o->_data + q, rn, n % AP_DIG_BIT);
+    res->_size = apn_data_norm(res->_data, rn);
+}
 
-    res->_size = o->_size;
-    if(carry)
-        res->_data[res->_size++] = carry;
+bool apn_tstbit(const apn_s* op, size_t bit) {
+    size_t i = bit / AP_DIG_BIT;
+    return i < op->_size && (op->_data[i] >> (bit % AP_DIG_BIT) & 1);
 }
 
-void apn_bit_shr(apn_s* res, const apn_s* o, size_t n) {
-    if(!n)
+void apn_setbit(apn_s* op, size_t bit) {
+    size_t i = bit / AP_DIG_BIT;
+    if(i >= op->_size) {
+        apn_reserve(op, i + 1);
+        memset(op->_data + op->_size, 0, (i + 1 - op->_size) * sizeof(ap_dig_t));
+        op->_size = i + 1;
+    }
+    op->_data[i] |= (ap_dig_t)1 << (bit % AP_DIG_BIT);
+}
+
+void apn_clrbit(apn_s* op, size_t bit) {
+    size_t i = bit / AP_DIG_BIT;
+    if(i >= op->_size)
         return;
+    op->_data[i] &= ~((ap_dig_t)1 << (bit % AP_DIG_BIT));
+    op->_size = apn_data_norm(op->_data, op->_size);
+}
 
-    if(res->_capacity < o->_size)
-        apn_realloc(res, o->_size);
+size_t apn_bitlen(const apn_s* op) {
+    ap_dig_t top = op->_data[op->_size - 1];
+    return top ? (op->_size - 1) * AP_DIG_BIT + ap_dig_msb(top) + 1 : 0;
+}
 
-    ap_dig_t carry = 0;
-    size_t i = o->_size - 1;
-    do {
-        ap_dig_t x = o->_data[i];
-        res->_data[i] = (x >> n) + carry;
-        carry = x << (AP_DIG_BIT - n);
-    } while(i--);
+size_t apn_popcount(const apn_s* op) {
+    size_t r = 0;
+    for(size_t i = 0; i != op->_size; ++i)
+        r += ap_dig_popcount(op->_data[i]);
+    return r;
+}
+
+size_t apn_scan1(const apn_s* op, size_t start) {
+    size_t i = start / AP_DIG_BIT;
+    if(i >= op->_size)
+        return SIZE_MAX;
+    ap_dig_t x = op->_data[i] & (AP_DIG_MAX << (start % AP_DIG_BIT));
+    while(!x) {
+        if(++i == op->_size)
+            return SIZE_MAX;
+        x = op->_data[i];
+    }
+    return i * AP_DIG_BIT + ap_dig_ctz(x);
+}
+
+// The logical operations run digit by digit over the common length, res
+// may be either operand. The longer operand's digits above it are copied
+// for or, xor and andnot, and dropped for and.
 
-    res->_size = o->_size;
-    if(!res->_data[res->_size - 1] && res->_size != 1) // msb shifted out and result is not zero
-        --res->_size;
+void apn_and(apn_s* res, const apn_s* op1, const apn_s* op2) {
+    size_t n = Macro_min(op1->_size, op2->_size);
+    apn_reserve(res, n);
+    ap_dig_t* rp = res->_data;
+    const ap_dig_t *ap = op1->_data, *bp = op2->_data;
+    for(size_t i = 0; i != n; ++i)
+        rp[i] = ap[i] & bp[i];
+    res->_size = apn_data_norm(rp, n);
+}
+
+// op1 is the longer one
+static void apn_bit_or_xor(apn_s* res, const apn_s* op1, const apn_s* op2, bool x) {
+    size_t an = op1->_size, bn = op2->_size;
+    apn_reserve(res, an);
+    ap_dig_t* rp = res->_data;
+    const ap_dig_t *ap = op1->_data, *bp = op2->_data;
+    if(x)
+        for(size_t i = 0; i != bn; ++i)
+            rp[i] = ap[i] ^ bp[i];
+    else
+        for(size_t i = 0; i != bn; ++i)
+            rp[i] = ap[i] | bp[i];
+    if(rp != ap)
+        memcpy(rp + bn, ap + bn, (an - bn) * sizeof(ap_dig_t));
+    res->_size = apn_data_norm(rp, an);
+}
+
+void apn_or(apn_s* res, const apn_s* op1, const apn_s* op2) {
+    if(op1->_size < op2->_size)
+        Macro_swap_val(const apn_s*, op1, op2);
+    apn_bit_or_xor(res, op1, op2, false);
+}
+
+void apn_xor(apn_s* res, const apn_s* op1, const apn_s* op2) {
+    if(op1->_size < op2->_size)
+        Macro_swap_val(const apn_s*, op1, op2);
+    apn_bit_or_xor(res, op1, op2, true);
+}
+
+void apn_andnot(apn_s* res, const apn_s* op1, const apn_s* op2) {
+    size_t an = op1->_size, n = Macro_min(an, op2->_size);
+    apn_reserve(res, an);
+    ap_dig_t* rp = res->_data;
+    const ap_dig_t *ap = op1->_data, *bp = op2->_data;
+    for(size_t i = 0; i != n; ++i)
+        rp[i] = ap[i] & ~bp[i];
+    if(rp != ap)
+        memcpy(rp + n, ap + n, (an - n) * sizeof(ap_dig_t));
+    res->_size = apn_data_norm(rp, an);
+}
+
+ap_dig_t apn_data_lshift(ap_dig_t* rp, const ap_dig_t* ap, size_t n, unsigned cnt) {
+    if(!cnt) {
+        memmove(rp, ap, n * sizeof(ap_dig_t));
+        return 0;
+    }
+    // from the top so that rp may overlap ap at a higher position
+    ap_dig_t out = ap[n - 1] >> (AP_DIG_BIT - cnt);
+    for(size_t i = n - 1; i; --i)
+        rp[i] = (ap[i] << cnt) | (ap[i - 1] >> (AP_DIG_BIT - cnt));
+    rp[0] = ap[0] << cnt;
+    return out;
+}
+
+ap_dig_t apn_data_rshift(ap_dig_t* rp, const ap_dig_t* ap, size_t n, unsigned cnt) {
+    if(!cnt) {
+        memmove(rp, ap, n * sizeof(ap_dig_t));
+        return 0;
+    }
+    ap_dig_t out = ap[0] << (AP_DIG_BIT - cnt);
+    for(size_t i = 0; i != n - 1; ++i)
+        rp[i] = (ap[i] >> cnt) | (ap[i + 1] << (AP_DIG_BIT - cnt));
+    rp[n - 1] = ap[n - 1] >> cnt;
+    return out;
 }
@@ -28,3 +28,10 @@ int apn_cmp_dig(const apn_s* op, ap_dig_t dig) {
         return 0;
     return op->_data[0] < dig ? -1 : 1;
 }
+
+int apn_data_cmp(const ap_dig_t* ap, const ap_dig_t* bp, size_t n) {
+    while(n--)
+        if(ap[n] != bp[n])
+            return ap[n] < bp[n] ? -1 : 1;
+    return 0;
+}
@@ -1,237 +1,635 @@
 #include "apn.h"
 #include "ap_impl.h"
 #include <assert.h>
+#include <string.h>
 
-// [op1 / op2], where the quotient is a single digit
-static inline ap_dig_t apn_div_aux(apn_s* rem, const apn_s* op1, const apn_s* op2) {
-    // Let A denote the one or two last digit of op1 depending on size of op2,
-    // B denote op2[-1] + 1, first guess a approximate quotient by taking [A / B],
-    // this result must be <= the real quotient. The error of this guess is
-    // op1 / op2 - [A / B] = (op1 - [A / B] * op2) / op2, which is another such
-    // division that can we can apply the same method again. To obtain the result,
-    // the quotient is the sum of [A / B] in each iteration, and remainder is the
-    // difference op1 - [A / B] * op2 at the last iteration.
-    apn_s t, r;
-    apn_init_list(&t, &r, NULL);
-    apn_assign(&r, op1);
-    ap_dig_t q = 0;
-    while(true) { // break later
-        bool f = (r._size > op2->_size);
-        struct ap_dig_pair a = { .lo = r._data[r._size - f - 1],
-                                 .hi = f ? r._data[r._size - 1] : 0 };
-        ap_dig_t b = op2->_data[op2->_size - 1] + 1;
-
-        if(r._size < op2->_size || (!a.hi && a.lo < b))
-            break;
-
-        ap_dig_t v = ap_dig_div_2d1t1(a, b);
-        q += v;
-        apn_assign_dig(&t, v);
-        apn_mul(&t, &t, op2);
-        apn_sub(&r, &r, &t);
-    }
-    if(apn_cmp(&r, op2) >= 0) {
-        apn_sub(&r, &r, op2);
-        ++q;
-    }
-
-    apn_swap(&r, rem);
-    apn_clear_list(&r, &t, NULL);
-    return q;
-}
+static void apn_div_basecase_impl(apn_s* quot, apn_s* rem, const apn_s* op1,
+                                  const apn_s* op2, apn_ws_s* ws);
+static size_t apn_div_basecase_itch(size_t an, size_t bn);
+static void apn_div_bz_impl(apn_s* quot, apn_s* rem, const apn_s* op1, const apn_s* op2,
+                            apn_ws_s* ws);
+static size_t apn_div_bz_itch(size_t an, size_t bn);
+static void apn_div_newton_impl(apn_s* quot, apn_s* rem, const apn_s* op1,
+                                const apn_s* op2, apn_ws_s* ws);
+static size_t apn_div_newton_itch(size_t an, size_t bn);
 
-void apn_div(apn_s* quot, apn_s* rem, const apn_s* op1, const apn_s* op2) {
+void apn_div_ws(apn_s* quot, apn_s* rem, const apn_s* op1, const apn_s* op2, apn_ws_s* ws) {
     if(apn_is_zero(op2)) { // division by zero
         volatile int x = 0, y = 1;
         (void)(y / x); // so do it
         return;
     }
+    Macro_stats_begin(APN_STATS_DIV, op1->_size);
     if(apn_cmp(op1, op2) < 0) {
         if(rem != NULL)
             apn_assign(rem, op1);
         if(quot != NULL)
             apn_assign_dig(quot, 0); 
-        return;
-    }
-    if(op2->_size < APN_DIV_BZ_THRESHOLD)
-        apn_div_basecase(quot, rem, op1, op2);
+    } else if(op2->_size < Macro_threshold(DIV_BZ))
+        apn_div_basecase_impl(quot, rem, op1, op2, ws);
+    else if(op2->_size < Macro_threshold(DIV_NEWTON))
+        apn_div_bz_impl(quot, rem, op1, op2, ws);
     else
-        apn_div_bz(quot, rem, op1, op2);
+        apn_div_newton_impl(quot, rem, op1, op2, ws);
+    Macro_stats_end();
 }
 
-// long division
-void apn_div_basecase(apn_s* dest_quot, apn_s* dest_rem, const apn_s* op1, const apn_s* op2) {
-    apn_s quot, rem;
-    apn_init_list(&quot, &rem, NULL);
+void apn_div(apn_s* quot, apn_s* rem, const apn_s* op1, const apn_s* op2) {
+    apn_ws_s ws;
+    apn_ws_init(&ws);
+    apn_div_ws(quot, rem, op1, op2, &ws);
+    apn_ws_clear(&ws);
+}
+
+void apn_idiv(apn_s* quot, const apn_s* op1, const apn_s* op2) {
+    apn_div(quot, NULL, op1, op2);
+}
+
+size_t apn_div_ws_size(size_t n1, size_t n2) {
+    if(n1 < n2)
+        return 0;
+    if(n2 < Macro_threshold(DIV_BZ))
+        return apn_div_basecase_itch(n1, n2);
+    if(n2 < Macro_threshold(DIV_NEWTON))
+        return apn_div_bz_itch(n1, n2);
+    return apn_div_newton_itch(n1, n2);
+}
+
+static size_t apn_div_basecase_itch(size_t an, size_t bn) {
+    // normalized divisor, dividend with one more digit, quotient
+    return bn + an + 1 + an - bn + 1;
+}
+
+// long division, op1 >= op2
+static void apn_div_basecase_impl(apn_s* quot, apn_s* rem, const apn_s* op1,
+                                  const apn_s* op2, apn_ws_s* ws) {
+    size_t r = op1->_size, s = op2->_size;
+    apn_ws_reserve(ws, apn_div_basecase_itch(r, s));
+    // shift both operands so that the top bit of the divisor is set
+    unsigned shift = ap_dig_clz(op2->_data[s - 1]);
+    ap_dig_t* D = apn_ws_push(ws, s);
+    ap_dig_t* N = apn_ws_push(ws, r + 1);
+    ap_dig_t* Q = apn_ws_push(ws, r - s + 1);
+    apn_data_lshift(D, op2->_data, s, shift);
+    N[r] = apn_data_lshift(N, op1->_data, r, shift);
+    // N[r] < D[s - 1], so there is no high quotient digit
+    apn_data_div_basecase(Q, N, r + 1, D, s);
+    if(rem != NULL) {
+        apn_data_rshift(N, N, s, shift);
+        apn_assign_data(rem, N, s);
+    }
+    if(quot != NULL)
+        apn_assign_data(quot, Q, r - s + 1);
+    apn_ws_pop(ws, apn_div_basecase_itch(r, s));
+}
 
-    // msb to lsb
-    size_t i = op1->_size - op2->_size; // start from position op2.size - 1
-    if(op1->_size < op2->_size) {
-        apn_assign(dest_rem, op1);
-        apn_assign_dig(dest_quot, 0); 
+void apn_div_basecase(apn_s* quot, apn_s* rem, const apn_s* op1, const apn_s* op2) {
+    if(apn_cmp(op1, op2) < 0) {
+        if(rem != NULL)
+            apn_assign(rem, op1);
+        if(quot != NULL)
+            apn_assign_dig(quot, 0);
         return;
     }
-    apn_assign_part(&rem, op1, i + 1, op1->_size - i - 1);
-    do {
-        apn_shl(&rem, &rem, 1);
-        rem._data[0] = op1->_data[i];
-        ap_dig_t tq = 0; // current digit of quotient
-        
-        if(apn_cmp(&rem, op2) >= 0)
-            tq = apn_div_aux(&rem, &rem, op2);
-        // add to current quotient
-        apn_shl(&quot, &quot, 1);
-        quot._data[0] = tq;
-    } while(i--);
-
-    if(dest_quot != NULL)
-        apn_swap(&quot, dest_quot);
-    if(dest_rem != NULL)
-        apn_swap(&rem, dest_rem);
-    apn_clear_list(&quot, &rem, NULL);
+    apn_ws_s ws;
+    apn_ws_init(&ws);
+    apn_div_basecase_impl(quot, rem, op1, op2, &ws);
+    apn_ws_clear(&ws);
+}
+
+// Knuth's Algorithm D, see The Art of Computer Programming, Vol. 2, 4.3.1.
+// Each quotient digit is estimated from the top three digits of the partial
+// remainder and the top two of the divisor, which is exact or one too large,
+// then a single multiply and subtract pass fixes the partial remainder. The
+// estimates divide by a precomputed reciprocal, see Niels Möller and Torbjörn
+// Granlund, "Improved division by invariant integers", 2011
+ap_dig_t apn_data_div_basecase(ap_dig_t* qp, ap_dig_t* np, size_t nn,
+                               const ap_dig_t* dp, size_t dn) {
+    Macro_stats_tier(APN_STATS_DIV_BASECASE);
+    ap_dig_t qh = apn_data_cmp(np + nn - dn, dp, dn) >= 0;
+    if(qh)
+        apn_data_sub_n(np + nn - dn, np + nn - dn, dp, dn);
+
+    if(dn == 1) {
+        ap_dig_t d = dp[0], v = ap_dig_reciprocal(d), r = np[nn - 1];
+        for(size_t j = nn - 1; j--;) {
+            struct ap_dig_pair a = { .lo = np[j], .hi = r };
+            qp[j] = ap_dig_divrem_2d1t1(a, d, v, &r);
+        }
+        np[0] = r;
+        return qh;
+    }
+
+    ap_dig_t d1 = dp[dn - 1], d0 = dp[dn - 2], v = ap_dig_reciprocal_3d2(d1, d0);
+    ap_dig_t n1 = np[nn - 1]; // top digit of the partial remainder
+    for(size_t j = nn - dn; j--;) { // partial remainder n1, np[j, j + dn)
+        ap_dig_t n0 = np[j + dn - 1], q;
+        if(n1 == d1 && n0 == d0) { // the estimate would overflow, it is B - 1
+            q = AP_DIG_MAX;
+            apn_data_submul_1(np + j, dp, dn, q); // the borrow cancels n1
+            n1 = np[j + dn - 1];
+        } else {
+            struct ap_dig_pair r;
+            q = ap_dig_divrem_3d2t1(n1, n0, np[j + dn - 2], d1, d0, v, &r);
+            ap_dig_t borrow = apn_data_submul_1(np + j, dp, dn - 2, q);
+            unsigned char b = ap_dig_subb(0, r.lo, borrow, &r.lo);
+            b = ap_dig_subb(b, r.hi, 0, &r.hi);
+            np[j + dn - 2] = r.lo;
+            if(b) { // one too large, add back
+                r.hi += d1 + apn_data_add_n(np + j, np + j, dp, dn - 1);
+                --q;
+            }
+            n1 = r.hi;
+        }
+        qp[j] = q;
+    }
+    np[dn - 1] = n1;
+    return qh;
 }
 
 // Burnikel-Ziegler divison, see
 // Christoph Burnikel and Joachim Ziegler, "Fast Recursive Division", October 1998
+// The recursion works in place on the digits of the partial remainder, its
+// temporaries are taken from the workspace.
 
-void apn_div_bz_d2n1n(apn_s* quot, apn_s* rem, const apn_s* op1, const apn_s* op2);
-void apn_div_bz_d3n2n(apn_s* quot, apn_s* rem, const apn_s* op1, const apn_s* op2);
+static void apn_data_div_bz_d2n1n(ap_dig_t* qp, ap_dig_t* np, const ap_dig_t* dp,
+                                  size_t n, apn_ws_s* ws);
+static void apn_data_div_bz_d3n2n(ap_dig_t* qp, ap_dig_t* np, const ap_dig_t* dp,
+                                  size_t n, apn_ws_s* ws);
 
-void apn_div_bz(apn_s* quot, apn_s* rem, const apn_s* op1, const apn_s* op2) {
+static size_t apn_data_div_bz_d2n1n_itch(size_t n) {
+    if(n & 1 || n <= Macro_threshold(DIV_BZ))
+        return 0;
+    // D3n/2n on k = n / 2, which holds a 2k-digit product and multiplies
+    size_t k = n / 2;
+    return Macro_max(apn_data_div_bz_d2n1n_itch(k),
+                     2 * k + apn_data_mul_itch(k, k));
+}
+
+// block size n and number of blocks t of the dividend for a s-digit divisor
+static size_t apn_div_bz_block(size_t s) {
+    // m = min{2^k | 2^k * BLOCKSIZE > s}, number of blocks to be divided
+    size_t m = 1;
+    while(m * Macro_threshold(DIV_BZ_BLOCKSIZE) <= s)
+        m <<= 1;
+    // n = ceil(s/m) * m, minimize block size to waste less 0. n >= s.
+    return (s / m + (bool)(s % m)) * m;
+}
+
+static size_t apn_data_div_bz_itch(size_t an, size_t bn) {
+    size_t n = apn_div_bz_block(bn);
+    size_t t = Macro_max(2, (an + n - bn + 1 + n - 1) / n);
+    return n + t * n + (t - 1) * n + apn_data_div_bz_d2n1n_itch(n);
+}
+
+static size_t apn_div_bz_itch(size_t an, size_t bn) {
+    // the quotient and remainder
+    return an + 1 + apn_data_div_bz_itch(an, bn);
+}
+
+// qp[0, an - bn + 1) = ap / bp and rp[0, bn) = ap mod bp, either can be
+// NULL, bp[bn - 1] != 0. The workspace must hold apn_data_div_bz_itch(an, bn)
+// more digits.
+static void apn_data_div_bz(ap_dig_t* qp, ap_dig_t* rp, const ap_dig_t* ap, size_t an,
+                            const ap_dig_t* bp, size_t bn, apn_ws_s* ws) {
     // r-digit divide by s-digit number
-    apn_s A, B, Z, Q, R; // A, B: copy of operands, Q, R: results, Z: temp
-    apn_init_list(&A, &B, &Z, &Q, &R, NULL);
-    apn_assign(&A, op1);
-    apn_assign(&B, op2);
-    // min{2^k | 2^k * BLOCKSIZE > s}, number of blocks to be divided
-    size_t m = (B._size / APN_DIV_BZ_BLOCKSIZE);
-    size_t t = m && !(m & (m - 1)); // is power of 2?
-    while(m >>= 1)
-        ++t;
-    m = 1 << t;
-    // n = ceil(s/m) * m, minimize block size to waste less 0. n > s.
-    size_t n = (B._size / m + (bool)(B._size % m)) * m;
+    size_t r = an, s = bn, n = apn_div_bz_block(s);
     // extend and normalize B, shift the same amount for A
-    size_t sigmaQ = n - B._size, // shift amount for B, divided by base
-           sigmaR = AP_DIG_BIT - ap_dig_msb(B._data[B._size - 1]) - 1; // leftover
-    apn_shl(&B, &B, sigmaQ);
-    apn_shl(&A, &A, sigmaQ);
-    apn_bit_shl(&B, &B, sigmaR);
-    apn_bit_shl(&A, &A, sigmaR);
-    // find t = min {l >= 2 | A < base^(l*n) / 2},
-    // Z store current beta^(l*n) / 2 for comparison.
-    // (split A into t blocks of n digits, such that the most significant bit
-    // of A[t-1] is zero. So the precondition for D2n/1n is satisfied.)
-    apn_assign_dig(&Z, 1);
-    apn_bit_shl(&Z, &Z, AP_DIG_BIT - 1); // base / 2
-    apn_shl(&Z, &Z, 2 * n - 1);
-    t = 2;
-    while(apn_cmp(&A, &Z) >= 0) {
-        apn_shl(&Z, &Z, n);
-        ++t;
+    size_t sigmaQ = n - s; // shift amount for B, divided by base
+    unsigned sigmaR = AP_DIG_BIT - ap_dig_msb(bp[s - 1]) - 1; // leftover
+    // find t = min {l >= 2 | A < base^(l*n) / 2}, split A into t blocks of n
+    // digits, such that the most significant bit of A[t-1] is zero. So the
+    // precondition for D2n/1n is satisfied.
+    ap_dig_t top = ap[r - 1], out = 0;
+    if(sigmaR) {
+        out = top >> (AP_DIG_BIT - sigmaR);
+        top = (top << sigmaR) | (r > 1 ? ap[r - 2] >> (AP_DIG_BIT - sigmaR) : 0);
     }
+    size_t l = r + sigmaQ + (bool)out, t = l / n + (bool)(l % n);
+    if(!out && t * n == l && top >> (AP_DIG_BIT - 1))
+        ++t;
+    t = Macro_max(t, 2);
+
+    ap_dig_t* B = apn_ws_push(ws, n);
+    ap_dig_t* A = apn_ws_push(ws, t * n);
+    ap_dig_t* Q = apn_ws_push(ws, (t - 1) * n);
+    memset(B, 0, sigmaQ * sizeof(ap_dig_t));
+    apn_data_lshift(B + sigmaQ, bp, s, sigmaR);
+    memset(A, 0, t * n * sizeof(ap_dig_t));
+    out = apn_data_lshift(A + sigmaQ, ap, r, sigmaR);
+    if(out)
+        A[sigmaQ + r] = out;
     // main loop, like school division of division by 1 digit(block) using D2n/1n,
-    // Z holds current partial remainder at start of loop.
-    apn_assign_part_zero(&Z, &A, (t - 2) * n, 2 * n); // Initial Z = (A[t-1], A[t-2])
-    size_t i = t - 2;
-    do { // `d2n1n` precondition holds through
-        apn_div_bz_d2n1n(&Z, &R, &Z, &B); // Z now hold the temp quotient,
-        apn_shl(&Q, &Q, n); // by our choice of t, Q < base^n
-        apn_add(&Q, &Q, &Z);
-        if(i != 0) { // set Z = (R, A[i - 1]),
-                     // D2n/1n precondition is still satisfied since R < B.
-            apn_assign(&Z, &R);
-            apn_shl(&Z, &Z, n);
-            apn_assign_part_zero(&R, &A, (i - 1) * n, n); // R: temp, A[i - 1]
-            apn_add(&Z, &Z, &R);
-        }
-    } while(i--);
+    // A[i + 1, i] holds current partial remainder at start of loop.
+    for(size_t i = t - 1; i--;) // `d2n1n` precondition holds through
+        apn_data_div_bz_d2n1n(Q + i * n, A + i * n, B, n, ws);
     // shift remainder back / denormalize it
-    apn_shr(&R, &R, sigmaQ);
-    apn_bit_shr(&R, &R, sigmaR);
+    if(rp != NULL)
+        apn_data_rshift(rp, A + sigmaQ, s, sigmaR);
+    if(qp != NULL) { // (t - 1) n digits may be one short of r - s + 1
+        size_t qn = Macro_min((t - 1) * n, r - s + 1);
+        memcpy(qp, Q, qn * sizeof(ap_dig_t));
+        memset(qp + qn, 0, (r - s + 1 - qn) * sizeof(ap_dig_t));
+    }
+    apn_ws_pop(ws, n + t * n + (t - 1) * n);
+}
 
-    if(quot != NULL)
-        apn_swap(quot, &Q);
+static void apn_div_bz_impl(apn_s* quot, apn_s* rem, const apn_s* op1, const apn_s* op2,
+                            apn_ws_s* ws) {
+    size_t r = op1->_size, s = op2->_size;
+    apn_ws_reserve(ws, apn_div_bz_itch(r, s));
+    ap_dig_t* Q = apn_ws_push(ws, r - s + 1);
+    ap_dig_t* R = apn_ws_push(ws, s);
+    apn_data_div_bz(Q, R, op1->_data, r, op2->_data, s, ws);
     if(rem != NULL)
-        apn_swap(rem, &R);
-    apn_clear_list(&A, &B, &Z, &Q, &R, NULL);
+        apn_assign_data(rem, R, s);
+    if(quot != NULL)
+        apn_assign_data(quot, Q, r - s + 1);
+    apn_ws_pop(ws, r + 1);
+}
+
+void apn_div_bz(apn_s* quot, apn_s* rem, const apn_s* op1, const apn_s* op2) {
+    apn_ws_s ws;
+    apn_ws_init(&ws);
+    apn_div_bz_impl(quot, rem, op1, op2, &ws);
+    apn_ws_clear(&ws);
 }
 
 // Divide a 2n-digit number by a n-digit number, normalized so that
-// base^n/2 <= B < base^n & A < base^n * B.
-void apn_div_bz_d2n1n(apn_s* quot, apn_s* rem, const apn_s* op1, const apn_s* op2) {
-    if(op2->_size & 1 || op2->_size <= APN_DIV_BZ_THRESHOLD) {
-        apn_div_basecase(quot, rem, op1, op2);
+// base^n/2 <= B < base^n & A < base^n * B. The remainder replaces np[0, n).
+static void apn_data_div_bz_d2n1n(ap_dig_t* qp, ap_dig_t* np, const ap_dig_t* dp,
+                                  size_t n, apn_ws_s* ws) {
+    if(n & 1 || n <= Macro_threshold(DIV_BZ)) {
+        apn_data_div_basecase(qp, np, 2 * n, dp, n);
         return;
     }
+    Macro_stats_tier(APN_STATS_DIV_BZ);
     // split A into 4 parts, B into 2 parts with Ai, Bi < base^(n/2)
-    apn_s Q, R, N; // Q, R: the results, D: dividend for D3n2n
-    apn_init_list(&Q, &R, &N, NULL);
-    size_t halfn = op2->_size / 2;
-    // then Q1 = [A1, A2, A3] / [B1, B2]
-    apn_assign_part_zero(&N, op1, halfn, halfn * 3);
-    apn_div_bz_d3n2n(&Q, &R, &N, op2); // Q = Q1
+    size_t halfn = n / 2;
+    // Q1 = [A1, A2, A3] / [B1, B2], leaves [R1, R2] in place of [A2, A3]
+    apn_data_div_bz_d3n2n(qp + halfn, np + halfn, dp, halfn, ws);
     // Q2 = [R1, R2, A4] / [B1, B2]
-    apn_assign(&N, &R);
-    apn_shl(&N, &N, halfn);
-    apn_assign_part_zero(&R, op1, 0, halfn); // R used to store A4
-    apn_add(&N, &N, &R);
-    apn_div_bz_d3n2n(&N, &R, &N, op2); // N = Q2
-    // return results, Q = [Q1, Q2]
-    apn_shl(&Q, &Q, halfn);
-    apn_add(&Q, &Q, &N);
-    
-    if(quot != NULL)
-        apn_swap(quot, &Q);
-    if(rem != NULL)
-        apn_swap(rem, &R);
-    apn_clear_list(&Q, &R, &N, NULL);
+    apn_data_div_bz_d3n2n(qp, np, dp, halfn, ws);
 }
 
 // Divide 3n-digit number by a 2n-digit number, with operands normalized so
-// base^(2n)/2 <= B < base^(2n), A < base^n * B.
-void apn_div_bz_d3n2n(apn_s* quot, apn_s* rem, const apn_s* op1, const apn_s* op2) {
+// base^(2n)/2 <= B < base^(2n), A < base^n * B. The remainder replaces np[0, 2n).
+static void apn_data_div_bz_d3n2n(ap_dig_t* qp, ap_dig_t* np, const ap_dig_t* dp,
+                                  size_t n, apn_ws_s* ws) {
     // split A into 3 parts, B into 2 parts, each part < base^n
-    apn_s Q, R, D, T;
-    apn_init_list(&Q, &R, &D, &T, NULL);
-    // if A1 < B1
-    size_t n = op2->_size / 2;
-    apn_assign_part_zero(&D, op1, 2 * n, n); // D = A1
-    apn_assign_part_zero(&T, op2, n, n); // T = B1
-    apn_assign_part_zero(&R, op1, n, 2 * n); // R = [A1, A2]
-
-    if(apn_cmp(&D, &T) < 0)
-        apn_div_bz_d2n1n(&Q, &R, &R, &T); // Q', R1 = [A1, A2] / B1, (approximate result)
+    const ap_dig_t *B1 = dp + n, *B2 = dp;
+    ap_dig_t carry = 0; // digit above [R1, A3]
+    if(apn_data_cmp(np + 2 * n, B1, n) < 0) // if A1 < B1
+        apn_data_div_bz_d2n1n(qp, np + n, B1, n, ws); // Q', R1 = [A1, A2] / B1, (approximate result)
     else {
-        // Q' = base^n - 1
-        apn_assign_dig(&Q, 1);
-        apn_shl(&Q, &Q, n);
-        apn_sub_dig(&Q, &Q, 1);
-        // R1 = [A1, A2] - Q'B1 or [A1, A2] + [0, B1] - [B1, 0]
-        apn_add(&R, &R, &T);
-        apn_shl(&T, &T, n);
-        apn_sub(&R, &R, &T);
+        // Q' = base^n - 1, A1 = B1 by the precondition,
+        // R1 = [A1, A2] - Q'B1 = [A1, A2] + [0, B1] - [B1, 0]
+        memset(qp, 0xff, n * sizeof(ap_dig_t));
+        carry = apn_data_add_n(np + n, np + n, B1, n);
     }
     // compute D = Q'B2
-    apn_assign_part_zero(&T, op2, 0, n);
-    apn_mul(&D, &Q, &T); // fast multiplication
-    // compute R' = R1 * base^n + A4
-    apn_shl(&R, &R, n);
-    apn_assign_part_zero(&T, op1, 0, n);
-    apn_add(&R, &R, &T);
-    // on the paper was - D above and loop for R' < 0 here,
-    // but this way signed integer is not needed.
-    while(apn_cmp(&R, &D) < 0) {
-        // R' += B, Q' -= 1
-        apn_add(&R, &R, op2);
-        apn_sub_dig(&Q, &Q, 1);
-    }
-    apn_sub(&R, &R, &D);
-    // return results
+    ap_dig_t* D = apn_ws_push(ws, 2 * n);
+    apn_data_mul(D, qp, n, B2, n, ws); // fast multiplication
+    // R' = R1 * base^n + A4 - D, which already is in np[0, 2n)
+    // on the paper the loop runs while R' < 0, here the signed digit above
+    // R' is tracked in `carry`.
+    if(apn_data_sub_n(np, np, D, 2 * n)) {
+        while(!carry) {
+            // R' += B, Q' -= 1
+            carry = apn_data_add_n(np, np, dp, 2 * n);
+            apn_data_sub_1(qp, qp, n, 1);
+        }
+    }
+    apn_ws_pop(ws, 2 * n);
+}
+
+// Exact division by Hensel's odd inverse, working from the least significant
+// digit, each quotient digit is (ap[i] - borrow) * dig^-1 (mod base).
+void apn_data_divexact_1(ap_dig_t* rp, const ap_dig_t* ap, size_t n, ap_dig_t dig) {
+    unsigned shift = ap_dig_lsb(dig);
+    dig >>= shift;
+    ap_dig_t inv = ap_dig_binvert(dig), borrow = 0;
+    for(size_t i = 0; i != n; ++i) {
+        ap_dig_t s = ap[i];
+        if(shift)
+            s = (s >> shift) | (i + 1 != n ? ap[i + 1] << (AP_DIG_BIT - shift) : 0);
+        ap_dig_t x = s - borrow;
+        ap_dig_t q = x * inv;
+        rp[i] = q;
+        borrow = ap_dig_mul(q, dig).hi + (x > s);
+    }
+}
+
+void apn_dig_inv_init(apn_dig_inv_s* inv, ap_dig_t dig) {
+    assert(dig);
+    inv->_shift = ap_dig_clz(dig);
+    inv->_d = dig << inv->_shift;
+    inv->_v = ap_dig_reciprocal(inv->_d);
+}
+
+// The dividend is shifted by the normalization of the divisor on the fly,
+// which leaves the quotient as it is and the remainder shifted.
+ap_dig_t apn_data_divrem_1(ap_dig_t* qp, const ap_dig_t* ap, size_t n,
+                           const apn_dig_inv_s* inv) {
+    unsigned sh = inv->_shift;
+    ap_dig_t d = inv->_d, v = inv->_v, r = 0;
+    if(!sh) {
+        for(size_t i = n; i--;) {
+            struct ap_dig_pair a = { .lo = ap[i], .hi = r };
+            ap_dig_t q = ap_dig_divrem_2d1t1(a, d, v, &r);
+            if(qp)
+                qp[i] = q;
+        }
+        return r;
+    }
+    r = ap[n - 1] >> (AP_DIG_BIT - sh);
+    for(size_t i = n; i--;) {
+        // ap[i - 1] is read before qp[i] is written, qp may be ap
+        ap_dig_t lo = ap[i] << sh;
+        if(i)
+            lo |= ap[i - 1] >> (AP_DIG_BIT - sh);
+        struct ap_dig_pair a = { .lo = lo, .hi = r };
+        ap_dig_t q = ap_dig_divrem_2d1t1(a, d, v, &r);
+        if(qp)
+            qp[i] = q;
+    }
+    return r >> sh;
+}
+
+ap_dig_t apn_divrem_dig_inv(apn_s* quot, const apn_s* op, const apn_dig_inv_s* inv) {
+    size_t n = op->_size;
+    if(quot == NULL)
+        return apn_data_divrem_1(NULL, op->_data, n, inv);
+    apn_reserve(quot, n);
+    ap_dig_t r = apn_data_divrem_1(quot->_data, op->_data, n, inv);
+    quot->_size = apn_data_norm(quot->_data, n);
+    return r;
+}
+
+ap_dig_t apn_mod_dig_inv(const apn_s* op, const apn_dig_inv_s* inv) {
+    return apn_data_divrem_1(NULL, op->_data, op->_size, inv);
+}
+
+ap_dig_t apn_divrem_dig(apn_s* quot, const apn_s* op, ap_dig_t dig) {
+    apn_dig_inv_s inv;
+    apn_dig_inv_init(&inv, dig);
+    return apn_divrem_dig_inv(quot, op, &inv);
+}
+
+ap_dig_t apn_mod_dig(const apn_s* op, ap_dig_t dig) {
+    apn_dig_inv_s inv;
+    apn_dig_inv_init(&inv, dig);
+    return apn_mod_dig_inv(op, &inv);
+}
+
+// Division by Newton's iteration for the reciprocal x ~ base^2n / d of the
+// normalized n-digit divisor. From the reciprocal xh of its upper h = n / 2
+// + 2 digits dh, x = xh base^(n-h) + xh e / base^2h for e = base^(n+h) -
+// d xh is off by a few at most, and e is only needed to about h digits. The
+// quotient takes blocks of 2n digits of the dividend, each estimated from
+// its upper n digits times x as in Barrett's reduction and fixed by the
+// remainder. All of it is a constant number of products of n digits, the
+// temporaries are taken from the workspace.
+
+static size_t apn_div_newton_inv_itch(size_t n) {
+    if(n < Macro_threshold(DIV_NEWTON)) // base^2n and the quotient
+        return 2 * n + 1 + n + 2
+               + (n < Macro_threshold(DIV_BZ) ? 0 : apn_data_div_bz_itch(2 * n + 1, n));
+    // xh, d xh and xh e
+    size_t h = n / 2 + 2;
+    return h + 1 + Macro_max(apn_div_newton_inv_itch(h),
+                             n + h + 1 + n + 4 + apn_data_mul_itch(n, h + 1));
+}
+
+static size_t apn_div_newton_itch(size_t an, size_t bn) {
+    // normalized divisor and dividend, quotient, x, the estimate and its
+    // product with the divisor
+    size_t blocks = an / bn + 1;
+    return bn + (blocks + 1) * bn + 1 + blocks * bn + bn + 1
+           + Macro_max(apn_div_newton_inv_itch(bn),
+                       2 * (2 * bn + 1) + apn_data_mul_itch(bn + 1, bn));
+}
+
+// xp[0, n + 1) ~ base^2n / dp[0, n), dp normalized
+static void apn_data_div_newton_inv(ap_dig_t* xp, const ap_dig_t* dp, size_t n,
+                                    apn_ws_s* ws) {
+    if(n < Macro_threshold(DIV_NEWTON)) {
+        ap_dig_t* A = apn_ws_push(ws, 2 * n + 1);
+        ap_dig_t* Q = apn_ws_push(ws, n + 2);
+        memset(A, 0, 2 * n * sizeof(ap_dig_t));
+        A[2 * n] = 1;
+        if(n < Macro_threshold(DIV_BZ))
+            Q[n + 1] = apn_data_div_basecase(Q, A, 2 * n + 1, dp, n);
+        else
+            apn_data_div_bz(Q, NULL, A, 2 * n + 1, dp, n, ws);
+        memcpy(xp, Q, (n + 1) * sizeof(ap_dig_t)); // Q[n + 1] is 0
+        apn_ws_pop(ws, 2 * n + 1 + n + 2);
+        return;
+    }
+    size_t h = n / 2 + 2;
+    ap_dig_t* xh = apn_ws_push(ws, h + 1);
+    apn_data_div_newton_inv(xh, dp + n - h, h, ws);
+    ap_dig_t* p = apn_ws_push(ws, n + h + 1);
+    ap_dig_t* c = apn_ws_push(ws, n + 4);
+    apn_data_mul(p, dp, n, xh, h + 1, ws);
+    // |e| < base^(n+1), so it is p[0, n + 1) if d xh >= base^(n+h) and its
+    // negation otherwise
+    bool neg = p[n + h] != 0;
+    if(!neg) {
+        for(size_t i = 0; i != n + 1; ++i)
+            p[i] = ~p[i];
+        apn_data_add_1(p, p, n + 1, 1);
+    }
+    // the lower h - 2 digits of |e| change the correction by less than one
+    apn_data_mul(c, xh, h + 1, p + h - 2, n - h + 3, ws);
+    memset(xp, 0, (n - h) * sizeof(ap_dig_t));
+    memcpy(xp + n - h, xh, (h + 1) * sizeof(ap_dig_t));
+    if(neg)
+        apn_data_sub_nm(xp, xp, n + 1, c + h + 2, n - h + 2);
+    else
+        apn_data_add_nm(xp, xp, n + 1, c + h + 2, n - h + 2);
+    apn_ws_pop(ws, h + 1 + n + h + 1 + n + 4);
+}
+
+// up[0, 2n + 1) -= qp dp for an estimate qp[0, n + 1) of [up / dp], which
+// becomes the quotient and up the remainder, tp holds 2n + 1 digits
+static void apn_data_div_newton_fix(ap_dig_t* qp, ap_dig_t* up, const ap_dig_t* dp,
+                                    size_t n, ap_dig_t* tp, apn_ws_s* ws) {
+    size_t qn = apn_data_norm(qp, n + 1);
+    if(qn > n)
+        apn_data_mul(tp, qp, qn, dp, n, ws);
+    else
+        apn_data_mul(tp, dp, n, qp, qn, ws);
+    memset(tp + qn + n, 0, (n + 1 - qn) * sizeof(ap_dig_t));
+    while(apn_data_cmp(tp, up, 2 * n + 1) > 0) {
+        apn_data_sub_nm(tp, tp, 2 * n + 1, dp, n);
+        apn_data_sub_1(qp, qp, n + 1, 1);
+    }
+    apn_data_sub_n(up, up, tp, 2 * n + 1);
+    while(apn_data_norm(up, 2 * n + 1) > n || apn_data_cmp(up, dp, n) >= 0) {
+        apn_data_sub_nm(up, up, 2 * n + 1, dp, n);
+        apn_data_add_1(qp, qp, n + 1, 1);
+    }
+}
+
+static void apn_div_newton_impl(apn_s* quot, apn_s* rem, const apn_s* op1,
+                                const apn_s* op2, apn_ws_s* ws) {
+    Macro_stats_tier(APN_STATS_DIV_NEWTON);
+    size_t r = op1->_size, n = op2->_size, blocks = r / n + 1;
+    apn_ws_reserve(ws, apn_div_newton_itch(r, n));
+    unsigned sh = ap_dig_clz(op2->_data[n - 1]);
+    ap_dig_t* D = apn_ws_push(ws, n);
+    ap_dig_t* A = apn_ws_push(ws, (blocks + 1) * n + 1);
+    ap_dig_t* Q = apn_ws_push(ws, blocks * n);
+    ap_dig_t* X = apn_ws_push(ws, n + 1);
+    apn_data_lshift(D, op2->_data, n, sh);
+    memset(A, 0, ((blocks + 1) * n + 1) * sizeof(ap_dig_t));
+    A[r] = apn_data_lshift(A, op1->_data, r, sh);
+    apn_data_div_newton_inv(X, D, n, ws);
+    ap_dig_t* P = apn_ws_push(ws, 2 * n + 1);
+    ap_dig_t* T = apn_ws_push(ws, 2 * n + 1);
+    // U = A[in, in + 2n + 1) is block i below the remainder of the blocks
+    // above, which is left in place of the block, so the digits of U above
+    // 2n are 0 and those above n less than d
+    for(size_t i = blocks; i--;) {
+        ap_dig_t* U = A + i * n;
+        if(apn_data_norm(U + n, n) == 1 && !U[n] && apn_data_cmp(U, D, n) < 0) {
+            memset(Q + i * n, 0, n * sizeof(ap_dig_t));
+            continue;
+        }
+        // [U / base^n] x / base^n is a few off the quotient at most
+        size_t un = apn_data_norm(U + n, n);
+        apn_data_mul(P, X, n + 1, U + n, un, ws);
+        memset(P + n + 1 + un, 0, (n - un) * sizeof(ap_dig_t));
+        apn_data_div_newton_fix(P + n, U, D, n, T, ws);
+        memcpy(Q + i * n, P + n, n * sizeof(ap_dig_t));
+    }
+    if(rem != NULL) {
+        apn_data_rshift(A, A, n, sh);
+        apn_assign_data(rem, A, n);
+    }
     if(quot != NULL)
-        apn_swap(quot, &Q);
-    if(rem != NULL)
-        apn_swap(rem, &R);
-    apn_clear_list(&Q, &R, &D, &T, NULL);
+        apn_assign_data(quot, Q, blocks * n);
+    apn_ws_pop(ws, n + (blocks + 1) * n + 1 + blocks * n + n + 1 + 2 * (2 * n + 1));
 }
 
+void apn_div_newton(apn_s* quot, apn_s* rem, const apn_s* op1, const apn_s* op2) {
+    if(apn_cmp(op1, op2) < 0) {
+        if(rem != NULL)
+            apn_assign(rem, op1);
+        if(quot != NULL)
+            apn_assign_dig(quot, 0);
+        return;
+    }
+    apn_ws_s ws;
+    apn_ws_init(&ws);
+    apn_div_newton_impl(quot, rem, op1, op2, &ws);
+    apn_ws_clear(&ws);
+}
+
+// Exact division from the least significant digit, see Tudor Jebelean, "An
+// algorithm for exact division", 1993. With op2 = 2^s d for an odd d, the
+// quotient is (op1 / 2^s) d^-1 mod base^k for its k digits. Hensel's
+// digit by digit division finds it in k min(k, n) steps, above the
+// threshold d^-1 mod base^k comes from Newton's iteration
+// y' = y - y (dy - 1), which doubles the digits that are right.
+
+// rp[0, k) = ap[0, k) / dp (mod base^k), dp odd, ap is overwritten
+static void apn_data_divexact_hensel(ap_dig_t* rp, ap_dig_t* ap, size_t k,
+                                     const ap_dig_t* dp, size_t dn) {
+    Macro_stats_tier(APN_STATS_DIVEXACT_BASECASE);
+    ap_dig_t inv = ap_dig_binvert(dp[0]);
+    for(size_t i = 0; i != k; ++i) {
+        ap_dig_t q = ap[i] * inv;
+        rp[i] = q;
+        size_t m = Macro_min(dn, k - i);
+        ap_dig_t borrow = apn_data_submul_1(ap + i, dp, m, q);
+        if(m != k - i)
+            apn_data_sub_1(ap + i + m, ap + i + m, k - i - m, borrow);
+    }
+}
+
+// digits [start, start + n) of o
+static void apn_div_part(apn_s* res, const apn_s* o, size_t start, size_t n) {
+    apn_assign_part_zero(res, o, start, n);
+    res->_size = apn_data_norm(res->_data, res->_size);
+}
+
+// base^n
+static void apn_div_pow(apn_s* res, size_t n) {
+    apn_assign_dig(res, 1);
+    apn_shl(res, res, n);
+}
+
+// y = d^-1 mod base^k, d odd
+static void apn_divexact_inv(apn_s* y, const apn_s* d, size_t k, apn_ws_s* ws) {
+    if(k < Macro_threshold(DIVEXACT_NEWTON)) {
+        apn_reserve(y, k);
+        apn_ws_reserve(ws, k);
+        ap_dig_t* a = apn_ws_push(ws, k);
+        memset(a, 0, k * sizeof(ap_dig_t));
+        a[0] = 1;
+        apn_data_divexact_hensel(y->_data, a, k, d->_data, Macro_min(d->_size, k));
+        y->_size = apn_data_norm(y->_data, k);
+        apn_ws_pop(ws, k);
+        return;
+    }
+    Macro_stats_tier(APN_STATS_DIVEXACT_NEWTON);
+    apn_s t, u;
+    apn_init_list(&t, &u, NULL);
+    apn_divexact_inv(y, d, (k + 1) / 2, ws);
+    // dy = 1 + base^h c, y (dy - 1) is y c base^h
+    apn_div_part(&u, d, 0, k);
+    apn_mul_ws(&t, &u, y, ws);
+    apn_div_part(&t, &t, 0, k);
+    apn_sub_dig(&t, &t, 1);
+    apn_mul_ws(&u, &t, y, ws);
+    apn_div_part(&u, &u, 0, k);
+    // y - u mod base^k
+    if(apn_cmp(y, &u) < 0) {
+        apn_div_pow(&t, k);
+        apn_add_inplace(y, &t);
+    }
+    apn_sub(y, y, &u);
+    apn_clear_list(&t, &u, NULL);
+}
+
+void apn_divexact(apn_s* quot, const apn_s* op1, const apn_s* op2) {
+    assert(!apn_is_zero(op2));
+    if(apn_is_zero(op1)) {
+        apn_assign_dig(quot, 0);
+        return;
+    }
+    Macro_stats_begin(APN_STATS_DIV, op1->_size);
+    size_t zd = 0; // trailing zero digits of op2, then bits
+    while(!op2->_data[zd])
+        ++zd;
+    unsigned zb = ap_dig_ctz(op2->_data[zd]);
+    apn_ws_s ws;
+    apn_ws_init(&ws);
+    apn_s a, d, y;
+    apn_init_list(&a, &d, &y, NULL);
+    apn_shr(&d, op2, zd);
+    apn_bit_shr(&d, &d, zb);
+    apn_shr(&a, op1, zd);
+    apn_bit_shr(&a, &a, zb);
+    size_t k = a._size - d._size + 1, dn = d._size;
+    if(dn == 1) {
+        apn_reserve(&y, a._size);
+        apn_data_divexact_1(y._data, a._data, a._size, d._data[0]);
+        y._size = apn_data_norm(y._data, a._size);
+    } else if(Macro_min(k, dn) < Macro_threshold(DIVEXACT_NEWTON)) {
+        apn_reserve(&y, k);
+        apn_data_divexact_hensel(y._data, a._data, k, d._data, dn);
+        y._size = apn_data_norm(y._data, k);
+    } else {
+        apn_divexact_inv(&y, &d, k, &ws);
+        apn_div_part(&a, &a, 0, k);
+        apn_mul_ws(&y, &y, &a, &ws);
+        apn_div_part(&y, &y, 0, k);
+    }
+    apn_swap(quot, &y);
+    apn_clear_list(&a, &d, &y, NULL);
+    apn_ws_clear(&ws);
+    Macro_stats_end();
+}
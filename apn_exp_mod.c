@@ -1,10 +1,60 @@
 #include "apn.h"
 #include "apz.h"
 #include "ap_impl.h"
+#include <stdlib.h>
+#include <string.h>
 
-// TODO
-void apn_sqr(apn_s* res, const apn_s* op) {
-    apn_mul(res, op, op);
+// Left-to-right sliding window of up to k bits, the odd powers base^(2i + 1)
+// are precomputed and each run of bits costs squarings and one
+// multiplication. k = 1 is the binary method. exp != 0
+static void apn_exp_window_impl(apn_s* res, const apn_s* base, const apn_s* exp, unsigned k) {
+    if(base->_size == 1) // multiplying by the base is a single pass anyway
+        k = 1;
+    Macro_stats_begin(APN_STATS_EXP, base->_size);
+    size_t bits = apn_bitlen(exp);
+    size_t tn = (size_t)1 << (k - 1);
+    apn_s* g = malloc(tn * sizeof(apn_s)); // g[i] = base^(2i + 1)
+    apn_s Z;
+    apn_init(&Z);
+    apn_ws_s ws;
+    apn_ws_init(&ws);
+    for(size_t i = 0; i != tn; ++i)
+        apn_init(&g[i]);
+    apn_assign(&g[0], base);
+    if(tn > 1) {
+        apn_sqr_ws(&Z, base, &ws);
+        for(size_t i = 1; i != tn; ++i)
+            apn_mul_ws(&g[i], &g[i - 1], &Z, &ws);
+    }
+
+    bool first = true;
+    for(size_t i = bits; i;) { // bits [0, i) are left
+        if(!apn_tstbit(exp, i - 1)) {
+            apn_sqr_ws(&Z, &Z, &ws);
+            --i;
+            continue;
+        }
+        // the window [l, i) ends with a set bit
+        size_t l = apn_scan1(exp, i > k ? i - k : 0);
+        ap_dig_t w = apn_exp_bits(exp, l, (unsigned)(i - l));
+        if(first)
+            apn_assign(&Z, &g[w >> 1]);
+        else {
+            for(size_t j = l; j != i; ++j)
+                apn_sqr_ws(&Z, &Z, &ws);
+            apn_mul_ws(&Z, &Z, &g[w >> 1], &ws);
+        }
+        first = false;
+        i = l;
+    }
+    apn_swap(res, &Z);
+
+    for(size_t i = 0; i != tn; ++i)
+        apn_clear(&g[i]);
+    free(g);
+    apn_clear(&Z);
+    apn_ws_clear(&ws);
+    Macro_stats_end();
 }
 
 void apn_exp(apn_s* res, const apn_s* base, const apn_s* exp) {
@@ -22,7 +72,7 @@ void apn_exp(apn_s* res, const apn_s* base, const apn_s* exp) {
             return;
         }
     }
-    apn_exp_bysqr(res, base, exp);
+    apn_exp_window_impl(res, base, exp, apn_exp_window(apn_bitlen(exp)));
 }
 
 void apn_exp_dig(apn_s* res, const apn_s* base, ap_dig_t exp) {
@@ -30,63 +80,181 @@ void apn_exp_dig(apn_s* res, const apn_s* base, ap_dig_t exp) {
         apn_assign_dig(res, 1);
         return;
     }
-    apn_s B;
-    apn_init(&B);
-    apn_assign(&B, base);
-
-    apn_assign(res, &B);
-    // by squaring..
-    size_t i = ap_dig_msb(exp);
-    for(; i--;) {
-        apn_sqr(res, res);
-        if(exp & (1 << i))
-            apn_mul(res, res, &B);
-    }
-
-    apn_clear(&B);
+    apn_s e = { ._data = &exp, ._capacity = 1, ._size = 1 };
+    apn_exp_window_impl(res, base, &e, apn_exp_window(ap_dig_msb(exp) + 1));
 }
 
 // Exponentiation by squaring
 // exp != 0
 void apn_exp_bysqr(apn_s* res, const apn_s* base, const apn_s* exp) {
-    apn_s Z;
-    apn_init(&Z);
-    // Left-to-right in exp, 0 = square, 1 = square and multiply by base
-    apn_assign(&Z, base); // ignore first 1 in exp
-    for(size_t i = exp->_size, j = ap_dig_msb(exp->_data[exp->_size - 1]); i--;) {
-        for(; j--;) {
-            apn_sqr(&Z, &Z);
-            if(exp->_data[i] & (1 << j))
-                apn_mul(&Z, &Z, base);
+    apn_exp_window_impl(res, base, exp, 1);
+}
+
+size_t apn_data_powm_itch(size_t n, const apn_s* exp, size_t itch) {
+    size_t tn = (size_t)1 << (apn_exp_window(apn_bitlen(exp)) - 1);
+    return tn * n + itch;
+}
+
+void apn_data_powm(ap_dig_t* rp, const ap_dig_t* gp, size_t n, const apn_s* exp,
+                   apn_data_modmul_fn mul, const void* ctx, apn_ws_s* ws) {
+    // Left-to-right sliding window: a run of up to k bits starting and ending
+    // with a 1 is k squarings and a single multiplication by a precomputed odd
+    // power, zero bits between the runs are single squarings.
+    size_t bits = apn_bitlen(exp);
+    unsigned k = apn_exp_window(bits);
+    size_t tn = (size_t)1 << (k - 1);
+    ap_dig_t* g = apn_ws_push(ws, tn * n); // g[i] = gp^(2i + 1)
+    memcpy(g, gp, n * sizeof(ap_dig_t));
+    if(tn > 1) {
+        mul(rp, g, g, ctx, ws);
+        for(size_t i = 1; i != tn; ++i)
+            mul(g + i * n, g + (i - 1) * n, rp, ctx, ws);
+    }
+
+    bool first = true;
+    for(size_t i = bits; i;) { // bits [0, i) are left
+        if(!apn_tstbit(exp, i - 1)) {
+            mul(rp, rp, rp, ctx, ws);
+            --i;
+            continue;
+        }
+        // the window [l, i) ends with a set bit
+        size_t l = apn_scan1(exp, i > k ? i - k : 0);
+        ap_dig_t w = apn_exp_bits(exp, l, (unsigned)(i - l));
+        if(first)
+            memcpy(rp, g + (w >> 1) * n, n * sizeof(ap_dig_t));
+        else {
+            for(size_t j = l; j != i; ++j)
+                mul(rp, rp, rp, ctx, ws);
+            mul(rp, rp, g + (w >> 1) * n, ctx, ws);
         }
-        j = AP_DIG_BIT;
+        first = false;
+        i = l;
     }
-    apn_swap(res, &Z);
-    apn_clear(&Z);
+    apn_ws_pop(ws, tn * n);
 }
 
 void apn_modexp(apn_s* res, const apn_s* base, const apn_s* exp, const apn_s* mod) {
-    // Modular exponentiation using repeated squaring.
-    // a[i] represents bit i of a.
-    // 1. e   := sum     [i = 0, bitof e] 2^i * e[i],
-    //    b^e := product [i = 0, bitof e] b^(2^i * e[i]).
-    // 2. a * b (mod m) = a * (b (mod m)) (mod m).
-    apn_s r, e, b;
-    apn_init_list(&r, &e, &b, NULL);
-    apn_assign_dig(&r, 1);
-    apn_assign(&e, exp);
-    apn_assign(&b, base);
-    // b = base^(2^i) % m
-    while(!apn_is_zero(&e)) {
-        if(apn_is_odd(&e)) { // current term is needed only if e[i] != 0
-            apn_mul(&r, &r, &b);
-            apn_div(NULL, &r, &r, mod);
-        }
-        apn_bit_shr(&e, &e, 1);
-        // maintain b
-        apn_sqr(&b, &b);
-        apn_div(NULL, &b, &b, mod);
+    if(apn_is_odd(mod)) {
+        apn_mont_s ctx;
+        apn_mont_init(&ctx, mod);
+        apn_mont_modexp(res, base, exp, &ctx);
+        apn_mont_clear(&ctx);
+        return;
+    }
+    // Montgomery needs an odd modulus, Barrett works for any
+    apn_barrett_s ctx;
+    apn_barrett_init(&ctx, mod);
+    apn_barrett_modexp(res, base, exp, &ctx);
+    apn_barrett_clear(&ctx);
+}
+
+// Batches share one context per distinct modulus, the contexts and then the
+// jobs are split into halves recursively, the upper half as a task, so idle
+// threads of the pool steal large ranges first.
+struct apn_modexp_ctx {
+    bool          odd;
+    apn_mont_s    mont;
+    apn_barrett_s barrett;
+};
+
+struct apn_modexp_batch {
+    apn_s*                 res;
+    const apn_s*           base;
+    const apn_s*           exp;
+    const apn_s*           mod;
+    size_t*                job_ctx; // context of each job
+    size_t*                ctx_job; // a job of each context
+    struct apn_modexp_ctx* ctx;
+};
+
+struct apn_modexp_range {
+    apn_task_s               task;
+    struct apn_modexp_batch* batch;
+    size_t                   lo, hi;
+    void                     (*fn)(struct apn_modexp_batch* batch, size_t i);
+};
+
+static void apn_modexp_range_run(void* arg, apn_ws_s* ws) {
+    struct apn_modexp_range* r = arg;
+    if(r->hi - r->lo == 1) {
+        r->fn(r->batch, r->lo);
+        return;
+    }
+    size_t mid = r->lo + (r->hi - r->lo) / 2;
+    struct apn_modexp_range upper = { .batch = r->batch, .lo = mid, .hi = r->hi, .fn = r->fn };
+    struct apn_modexp_range lower = { .batch = r->batch, .lo = r->lo, .hi = mid, .fn = r->fn };
+    upper.task.fn = apn_modexp_range_run;
+    upper.task.arg = &upper;
+    apn_task_spawn(&upper.task);
+    apn_modexp_range_run(&lower, ws);
+    apn_task_wait(&upper.task);
+}
+
+static void apn_modexp_batch_init(struct apn_modexp_batch* b, size_t i) {
+    struct apn_modexp_ctx* ctx = &b->ctx[i];
+    const apn_s* mod = &b->mod[b->ctx_job[i]];
+    ctx->odd = apn_is_odd(mod);
+    if(ctx->odd)
+        apn_mont_init(&ctx->mont, mod);
+    else
+        apn_barrett_init(&ctx->barrett, mod);
+}
+
+static void apn_modexp_batch_job(struct apn_modexp_batch* b, size_t i) {
+    const struct apn_modexp_ctx* ctx = &b->ctx[b->job_ctx[i]];
+    if(ctx->odd)
+        apn_mont_modexp(&b->res[i], &b->base[i], &b->exp[i], &ctx->mont);
+    else
+        apn_barrett_modexp(&b->res[i], &b->base[i], &b->exp[i], &ctx->barrett);
+}
+
+static void apn_modexp_batch_for(struct apn_modexp_batch* b, size_t n,
+                                 void (*fn)(struct apn_modexp_batch* batch, size_t i)) {
+    struct apn_modexp_range r = { .batch = b, .lo = 0, .hi = n, .fn = fn };
+    apn_modexp_range_run(&r, NULL);
+}
+
+struct apn_modexp_key {
+    const apn_s* mod;
+    size_t       job;
+};
+
+static int apn_modexp_key_cmp(const void* a, const void* b) {
+    return apn_cmp(((const struct apn_modexp_key*)a)->mod, ((const struct apn_modexp_key*)b)->mod);
+}
+
+void apn_modexp_batch(apn_s* res, const apn_s* base, const apn_s* exp, const apn_s* mod,
+                      size_t count) {
+    if(!count)
+        return;
+    // equal moduli are adjacent once sorted
+    struct apn_modexp_key* keys = malloc(count * sizeof(struct apn_modexp_key));
+    for(size_t i = 0; i != count; ++i)
+        keys[i] = (struct apn_modexp_key){ .mod = &mod[i], .job = i };
+    qsort(keys, count, sizeof(struct apn_modexp_key), apn_modexp_key_cmp);
+
+    struct apn_modexp_batch b = { .res = res, .base = base, .exp = exp, .mod = mod };
+    b.job_ctx = malloc(2 * count * sizeof(size_t));
+    b.ctx_job = b.job_ctx + count;
+    size_t n = 0;
+    for(size_t i = 0; i != count; ++i) {
+        if(!i || apn_cmp(keys[i - 1].mod, keys[i].mod))
+            b.ctx_job[n++] = keys[i].job;
+        b.job_ctx[keys[i].job] = n - 1;
+    }
+    free(keys);
+    b.ctx = malloc(n * sizeof(struct apn_modexp_ctx));
+
+    apn_modexp_batch_for(&b, n, apn_modexp_batch_init);
+    apn_modexp_batch_for(&b, count, apn_modexp_batch_job);
+
+    for(size_t i = 0; i != n; ++i) {
+        if(b.ctx[i].odd)
+            apn_mont_clear(&b.ctx[i].mont);
+        else
+            apn_barrett_clear(&b.ctx[i].barrett);
     }
-    apn_swap(&r, res);
-    apn_clear_list(&r, &e, &b, NULL);
+    free(b.ctx);
+    free(b.job_ctx);
 }
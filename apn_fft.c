@@ -0,0 +1,238 @@
+#include "apn.h"
+#include "ap_impl.h"
+#include <string.h>
+
+// Multiplication by number theoretic transforms modulo three primes
+// c * 2^k + 1 between 2^61 and 2^62. Each digit of the operands is one
+// coefficient, so a coefficient of the product convolution is below
+// n * 2^128, and with the product of the primes above 2^184 it is recovered
+// exactly by the Chinese remainder theorem for transform lengths up to 2^54.
+
+static const ap_dig_t apn_ntt_primes[3][2] = { // prime, primitive root
+    { 0x3a00000000000001ULL, 3 }, // 29 * 2^57 + 1
+    { 0x2280000000000001ULL, 5 }, // 69 * 2^55 + 1
+    { 0x2c40000000000001ULL, 7 }, // 177 * 2^54 + 1
+};
+
+struct apn_ntt_mod {
+    ap_dig_t p;
+    ap_dig_t inv; // p^-1 (mod base)
+    ap_dig_t one; // base (mod p), 1 in Montgomery form
+    ap_dig_t r2; // base^2 (mod p)
+};
+
+static inline ap_dig_t apn_ntt_add(ap_dig_t a, ap_dig_t b, const struct apn_ntt_mod* m) {
+    ap_dig_t s = a + b; // p < 2^62, never overflows
+    return s >= m->p ? s - m->p : s;
+}
+
+static inline ap_dig_t apn_ntt_sub(ap_dig_t a, ap_dig_t b, const struct apn_ntt_mod* m) {
+    return a >= b ? a - b : a - b + m->p;
+}
+
+// Montgomery multiplication a * b / base (mod p), a * b < p * base
+static inline ap_dig_t apn_ntt_mul(ap_dig_t a, ap_dig_t b, const struct apn_ntt_mod* m) {
+    // t - (t.lo * p^-1 mod base) * p is a multiple of base
+    struct ap_dig_pair t = ap_dig_mul(a, b);
+    ap_dig_t u = ap_dig_mul(t.lo * m->inv, m->p).hi;
+    return t.hi >= u ? t.hi - u : t.hi - u + m->p;
+}
+
+static ap_dig_t apn_ntt_pow(ap_dig_t a, ap_dig_t e, const struct apn_ntt_mod* m) {
+    ap_dig_t r = m->one;
+    for(; e; e >>= 1) {
+        if(e & 1)
+            r = apn_ntt_mul(r, a, m);
+        a = apn_ntt_mul(a, a, m);
+    }
+    return r;
+}
+
+static void apn_ntt_setup(struct apn_ntt_mod* m, ap_dig_t p) {
+    m->p = p;
+    m->inv = ap_dig_binvert(p);
+    m->one = (AP_DIG_MAX % p + 1) % p;
+    m->r2 = m->one;
+    for(int i = 0; i != AP_DIG_BIT; ++i)
+        m->r2 = apn_ntt_add(m->r2, m->r2, m);
+}
+
+// w[len + j] = w_2len^j for the stages len = 1, 2, .., n / 2, where w_2len is
+// a primitive 2len-th root of unity in Montgomery form
+static void apn_ntt_roots(ap_dig_t* w, size_t n, ap_dig_t root, const struct apn_ntt_mod* m) {
+    size_t half = n >> 1;
+    ap_dig_t x = m->one;
+    for(size_t j = 0; j != half; ++j) {
+        w[half + j] = x;
+        x = apn_ntt_mul(x, root, m);
+    }
+    // w_2len^j = w_4len^2j
+    for(size_t i = half; --i;)
+        w[i] = w[2 * i];
+}
+
+// decimation in frequency, natural order to bit-reversed order
+static void apn_ntt_forward(ap_dig_t* a, size_t n, const ap_dig_t* w,
+                            const struct apn_ntt_mod* m) {
+    for(size_t len = n >> 1; len; len >>= 1)
+        for(size_t i = 0; i != n; i += 2 * len)
+            for(size_t j = 0; j != len; ++j) {
+                ap_dig_t u = a[i + j], v = a[i + j + len];
+                a[i + j] = apn_ntt_add(u, v, m);
+                a[i + j + len] = apn_ntt_mul(apn_ntt_sub(u, v, m), w[len + j], m);
+            }
+}
+
+// decimation in time with inverse roots, bit-reversed order to natural order,
+// the result is scaled by n
+static void apn_ntt_inverse(ap_dig_t* a, size_t n, const ap_dig_t* w,
+                            const struct apn_ntt_mod* m) {
+    for(size_t len = 1; len != n; len <<= 1)
+        for(size_t i = 0; i != n; i += 2 * len)
+            for(size_t j = 0; j != len; ++j) {
+                ap_dig_t u = a[i + j], v = apn_ntt_mul(a[i + j + len], w[len + j], m);
+                a[i + j] = apn_ntt_add(u, v, m);
+                a[i + j + len] = apn_ntt_sub(u, v, m);
+            }
+}
+
+// digits to Montgomery form residues, zero padded to n
+static void apn_ntt_load(ap_dig_t* f, size_t n, const ap_dig_t* xp, size_t xn,
+                         const struct apn_ntt_mod* m) {
+    for(size_t i = 0; i != xn; ++i)
+        f[i] = apn_ntt_mul(xp[i], m->r2, m);
+    memset(f + xn, 0, (n - xn) * sizeof(ap_dig_t));
+}
+
+static size_t apn_ntt_length(size_t an, size_t bn) {
+    size_t n = 2;
+    while(n < an + bn - 1)
+        n <<= 1;
+    return n;
+}
+
+size_t apn_data_mul_fft_itch(size_t an, size_t bn) {
+    // residues for each prime, a second operand and the root tables
+    return 6 * apn_ntt_length(an, bn);
+}
+
+// Combine the residues of the three primes with Garner's algorithm,
+// x = c1 + p1 t2 + p1 p2 t3, and add up the overlapping coefficients.
+static void apn_ntt_crt(ap_dig_t* rp, size_t rn, const ap_dig_t* c, size_t n, size_t cn,
+                        const struct apn_ntt_mod* m) {
+    ap_dig_t p1 = m[0].p, p2 = m[1].p, p3 = m[2].p;
+    // constants in Montgomery form: p1^-1 (mod p2), p1 (mod p3), (p1 p2)^-1 (mod p3),
+    // p1 < 2 p2 and p1 < 2 p3
+    ap_dig_t p1m2 = p1 >= p2 ? p1 - p2 : p1, p1m3 = p1 >= p3 ? p1 - p3 : p1;
+    ap_dig_t i12 = apn_ntt_pow(apn_ntt_mul(p1m2, m[1].r2, &m[1]), p2 - 2, &m[1]);
+    ap_dig_t k13 = apn_ntt_mul(p1m3, m[2].r2, &m[2]);
+    ap_dig_t i123 = apn_ntt_pow(apn_ntt_mul(k13, apn_ntt_mul(p2, m[2].r2, &m[2]), &m[2]),
+                                p3 - 2, &m[2]);
+    struct ap_dig_pair p12 = ap_dig_mul(p1, p2);
+
+    ap_dig_t acc[3] = { 0, 0, 0 }; // carries into the next digits
+    for(size_t i = 0; i != rn; ++i) {
+        ap_dig_t x[3] = { 0, 0, 0 };
+        if(i < cn) {
+            ap_dig_t c1 = c[i], c2 = c[n + i], c3 = c[2 * n + i];
+            ap_dig_t t2 = apn_ntt_mul(apn_ntt_sub(c2, c1 >= p2 ? c1 - p2 : c1, &m[1]), i12, &m[1]);
+            ap_dig_t x3 = apn_ntt_add(c1 >= p3 ? c1 - p3 : c1, apn_ntt_mul(t2, k13, &m[2]), &m[2]);
+            ap_dig_t t3 = apn_ntt_mul(apn_ntt_sub(c3, x3, &m[2]), i123, &m[2]);
+            // x = c1 + p1 t2 + p1 p2 t3
+            struct ap_dig_pair u = ap_dig_mul(p1, t2);
+            x[0] = u.lo + c1;
+            x[1] = u.hi + ap_dig_overflow(x[0], u.lo, c1);
+            ap_dig_t v[3];
+            struct ap_dig_pair lo = ap_dig_mul(p12.lo, t3), hi = ap_dig_mul(p12.hi, t3);
+            v[0] = lo.lo;
+            v[1] = lo.hi + hi.lo;
+            v[2] = hi.hi + ap_dig_overflow(v[1], lo.hi, hi.lo);
+            apn_data_add_n(x, x, v, 3);
+        }
+        apn_data_add_n(acc, acc, x, 3);
+        rp[i] = acc[0];
+        acc[0] = acc[1], acc[1] = acc[2], acc[2] = 0;
+    }
+}
+
+// the convolution modulo prime k of the digits of ap and bp
+struct apn_ntt_task {
+    apn_task_s          task;
+    ap_dig_t*           x; // n residues
+    const ap_dig_t*     ap;
+    size_t              an;
+    const ap_dig_t*     bp;
+    size_t              bn;
+    size_t              n;
+    struct apn_ntt_mod* m;
+    int                 k;
+};
+
+// fw holds the second operand and both root tables, 3n digits
+static void apn_ntt_convolve(const struct apn_ntt_task* t, ap_dig_t* fw) {
+    size_t n = t->n, an = t->an, bn = t->bn;
+    bool sqr = (t->ap == t->bp && an == bn);
+    struct apn_ntt_mod* m = t->m;
+    ap_dig_t* x = t->x;
+    ap_dig_t* f = fw;
+    ap_dig_t* w = f + n;
+    ap_dig_t* wi = w + n;
+
+    apn_ntt_setup(m, apn_ntt_primes[t->k][0]);
+    ap_dig_t e = (m->p - 1) / n, g = apn_ntt_mul(apn_ntt_primes[t->k][1], m->r2, m);
+    apn_ntt_roots(w, n, apn_ntt_pow(g, e, m), m);
+    apn_ntt_roots(wi, n, apn_ntt_pow(g, m->p - 1 - e, m), m);
+
+    apn_ntt_load(x, n, t->ap, an, m);
+    apn_ntt_forward(x, n, w, m);
+    if(sqr)
+        for(size_t i = 0; i != n; ++i)
+            x[i] = apn_ntt_mul(x[i], x[i], m);
+    else {
+        apn_ntt_load(f, n, t->bp, bn, m);
+        apn_ntt_forward(f, n, w, m);
+        for(size_t i = 0; i != n; ++i)
+            x[i] = apn_ntt_mul(x[i], f[i], m);
+    }
+    apn_ntt_inverse(x, n, wi, m);
+    // out of Montgomery form and divide by n, n^-1 = p - (p - 1) / n
+    for(size_t i = 0; i != an + bn - 1; ++i)
+        x[i] = apn_ntt_mul(x[i], m->p - e, m);
+}
+
+static void apn_ntt_task_run(void* arg, apn_ws_s* ws) {
+    struct apn_ntt_task* t = arg;
+    apn_ws_reserve(ws, 3 * t->n);
+    apn_ntt_convolve(t, apn_ws_push(ws, 3 * t->n));
+    apn_ws_pop(ws, 3 * t->n);
+}
+
+// rp[0, an + bn) = ap * bp, squaring if both operands are the same digits
+void apn_data_mul_fft(ap_dig_t* rp, const ap_dig_t* ap, size_t an,
+                      const ap_dig_t* bp, size_t bn, apn_ws_s* ws) {
+    Macro_stats_tier(ap == bp && an == bn ? APN_STATS_SQR_FFT : APN_STATS_MUL_FFT);
+    size_t n = apn_ntt_length(an, bn);
+    ap_dig_t* c = apn_ws_push(ws, 6 * n);
+
+    // the primes are independent, the last two run as tasks if enabled,
+    // each with its own buffers
+    bool par = apn_task_parallel(an);
+    struct apn_ntt_mod m[3];
+    struct apn_ntt_task t[3];
+    for(int k = 0; k != 3; ++k) {
+        t[k].x = c + k * n;
+        t[k].ap = ap, t[k].an = an, t[k].bp = bp, t[k].bn = bn;
+        t[k].n = n, t[k].m = &m[k], t[k].k = k;
+        t[k].task.fn = apn_ntt_task_run;
+        t[k].task.arg = &t[k];
+    }
+    for(int k = 1; par && k != 3; ++k)
+        apn_task_spawn(&t[k].task);
+    for(int k = 0; k != (par ? 1 : 3); ++k)
+        apn_ntt_convolve(&t[k], c + 3 * n);
+    for(int k = 1; par && k != 3; ++k)
+        apn_task_wait(&t[k].task);
+    apn_ntt_crt(rp, an + bn, c, n, an + bn - 1, m);
+
+    apn_ws_pop(ws, 6 * n);
+}
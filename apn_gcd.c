@@ -0,0 +1,496 @@
+#include "apn.h"
+#include "apz.h"
+#include "ap_impl.h"
+#include <string.h>
+
+// Euclid's algorithm on the leading digits, see D. H. Lehmer, "Euclid's
+// Algorithm for Large Numbers", 1938, with double digit steps, and the
+// subquadratic half-gcd of Niels Möller, "On Schönhage's algorithm and
+// subquadratic integer gcd computation", 2008.
+//
+// Every reduction replaces (a, b) by M^-1 (a, b) for a matrix M of
+// nonnegative entries with determinant 1, so (a, b) before = M (a, b)
+// after and the gcd stays the same. The matrices found from the leading
+// digits always reduce the whole numbers by the theory, the results are
+// checked anyway and a step that would go negative is not taken.
+
+// matrix of one double digit step
+struct ap_gcd_matrix1 {
+    ap_dig_t u[2][2];
+};
+
+// product of the steps taken, rows [lo, 2) are kept, both by the half-gcd
+// and the second one for the cofactor of the extended gcd
+struct apn_gcd_matrix {
+    apn_s u[2][2];
+    int   lo;
+};
+
+// temporaries shared by all levels of the recursion
+struct apn_gcd_ctx {
+    apn_s    t[3];
+    apn_ws_s ws;
+};
+
+static void apn_gcd_matrix_init(struct apn_gcd_matrix* M, int lo) {
+    apn_init_list(&M->u[0][0], &M->u[0][1], &M->u[1][0], &M->u[1][1], NULL);
+    apn_assign_dig(&M->u[0][0], 1);
+    apn_assign_dig(&M->u[1][1], 1);
+    M->lo = lo;
+}
+
+static void apn_gcd_matrix_clear(struct apn_gcd_matrix* M) {
+    apn_clear_list(&M->u[0][0], &M->u[0][1], &M->u[1][0], &M->u[1][1], NULL);
+}
+
+// M = M (1 q; 0 1) for col 1, M (1 0; q 1) for col 0
+static void apn_gcd_matrix_mul_q(struct apn_gcd_matrix* M, const apn_s* q, int col,
+                                 struct apn_gcd_ctx* c) {
+    for(int i = M->lo; i != 2; ++i) {
+        if(q->_size == 1)
+            apn_addmul_dig(&M->u[i][col], &M->u[i][!col], q->_data[0]);
+        else {
+            apn_mul_ws(&c->t[2], q, &M->u[i][!col], &c->ws);
+            apn_add_inplace(&M->u[i][col], &c->t[2]);
+        }
+    }
+}
+
+// o with zero digits up to n
+static void apn_gcd_pad(apn_s* o, size_t n) {
+    apn_reserve(o, n);
+    memset(o->_data + o->_size, 0, (n - o->_size) * sizeof(ap_dig_t));
+}
+
+// M = M m
+static void apn_gcd_matrix_mul1(struct apn_gcd_matrix* M, const struct ap_gcd_matrix1* m,
+                                struct apn_gcd_ctx* c) {
+    for(int i = M->lo; i != 2; ++i) {
+        apn_s *x = &M->u[i][0], *y = &M->u[i][1];
+        size_t n = Macro_max(x->_size, y->_size);
+        apn_gcd_pad(x, n);
+        apn_gcd_pad(y, n);
+        for(int j = 0; j != 2; ++j) {
+            // the entries of m are below 2^(AP_DIG_BIT - 1), the carries add
+            // up to one digit
+            apn_s* t = &c->t[j];
+            apn_reserve(t, n + 1);
+            t->_data[n] = apn_data_mul_1(t->_data, x->_data, n, m->u[0][j]) +
+                          apn_data_addmul_1(t->_data, y->_data, n, m->u[1][j]);
+            t->_size = apn_data_norm(t->_data, n + 1);
+        }
+        apn_swap(x, &c->t[0]);
+        apn_swap(y, &c->t[1]);
+    }
+}
+
+// M = M M1
+static void apn_gcd_matrix_mul(struct apn_gcd_matrix* M, const struct apn_gcd_matrix* M1,
+                               struct apn_gcd_ctx* c) {
+    for(int i = M->lo; i != 2; ++i) {
+        apn_s *x = &M->u[i][0], *y = &M->u[i][1];
+        for(int j = 0; j != 2; ++j) {
+            apn_mul_ws(&c->t[j], x, &M1->u[0][j], &c->ws);
+            apn_mul_ws(&c->t[2], y, &M1->u[1][j], &c->ws);
+            apn_add_inplace(&c->t[j], &c->t[2]);
+        }
+        apn_swap(x, &c->t[0]);
+        apn_swap(y, &c->t[1]);
+    }
+}
+
+static ap_dig_t ap_dig_gcd(ap_dig_t a, ap_dig_t b) {
+    // binary, a, b != 0
+    unsigned k = ap_dig_ctz(a | b);
+    a >>= ap_dig_ctz(a);
+    do {
+        b >>= ap_dig_ctz(b);
+        if(a > b)
+            Macro_swap_val(ap_dig_t, a, b);
+        b -= a;
+    } while(b);
+    return a << k;
+}
+
+static inline bool ap_dig2_less(ap_dig_t ah, ap_dig_t al, ap_dig_t bh, ap_dig_t bl) {
+    return ah < bh || (ah == bh && al < bl);
+}
+
+// [a / b] of two digit numbers, a >= b, bh != 0, a becomes the remainder.
+// Shift and subtract, the quotients of Euclid's algorithm are mostly small.
+static ap_dig_t ap_dig2_divrem(ap_dig_t* ah, ap_dig_t* al, ap_dig_t bh, ap_dig_t bl) {
+    // q = 1 more than 40% of the time
+    ap_dig_subb(ap_dig_subb(0, *al, bl, al), *ah, bh, ah);
+    if(ap_dig2_less(*ah, *al, bh, bl))
+        return 1;
+    unsigned cnt = ap_dig_clz(bh) - ap_dig_clz(*ah);
+    ap_dig_t dh = cnt ? bh << cnt | bl >> (AP_DIG_BIT - cnt) : bh, dl = bl << cnt;
+    ap_dig_t q = 0;
+    for(unsigned i = 0; i <= cnt; ++i) {
+        q <<= 1;
+        if(!ap_dig2_less(*ah, *al, dh, dl)) {
+            ap_dig_subb(ap_dig_subb(0, *al, dl, al), *ah, dh, ah);
+            q |= 1;
+        }
+        dl = dl >> 1 | dh << (AP_DIG_BIT - 1);
+        dh >>= 1;
+    }
+    return q + 1;
+}
+
+// Euclid's steps on the two digit numbers a and b as long as both stay at
+// least 2^(AP_DIG_BIT + 1). When a and b are the leading digits of larger
+// numbers at the same shift the steps are correct for those as well, the
+// entries of m stay below 2^(AP_DIG_BIT - 1). false if not a single step
+// could be taken.
+static bool ap_hgcd2(ap_dig_t ah, ap_dig_t al, ap_dig_t bh, ap_dig_t bl,
+                     struct ap_gcd_matrix1* m) {
+    if(ah < 2 || bh < 2)
+        return false;
+    ap_dig_t u00 = 1, u01 = 0, u10 = 0, u11 = 1;
+    for(;;) {
+        if(ap_dig2_less(bh, bl, ah, al)) { // a -= q b
+            ap_dig_t q = ap_dig2_divrem(&ah, &al, bh, bl);
+            bool last = ah < 2;
+            if(last) { // one b less keeps a large enough
+                --q;
+                ap_dig_addc(ap_dig_addc(0, al, bl, &al), ah, bh, &ah);
+            }
+            u01 += q * u00;
+            u11 += q * u10;
+            if(last)
+                break;
+        } else if(ap_dig2_less(ah, al, bh, bl)) { // b -= q a
+            ap_dig_t q = ap_dig2_divrem(&bh, &bl, ah, al);
+            bool last = bh < 2;
+            if(last) {
+                --q;
+                ap_dig_addc(ap_dig_addc(0, bl, al, &bl), bh, ah, &bh);
+            }
+            u00 += q * u01;
+            u10 += q * u11;
+            if(last)
+                break;
+        } else
+            break;
+    }
+    m->u[0][0] = u00, m->u[0][1] = u01;
+    m->u[1][0] = u10, m->u[1][1] = u11;
+    return u01 || u10;
+}
+
+// digit i, 0 above the size, indices that wrapped below 0 included
+static inline ap_dig_t apn_gcd_dig(const apn_s* o, size_t i) {
+    return i < o->_size ? o->_data[i] : 0;
+}
+
+// ap_hgcd2 on the leading two digits of a and b, the larger of n digits,
+// shifted so that the top bit of one of them is set if `shift`
+static bool apn_hgcd2(const apn_s* a, const apn_s* b, size_t n, bool shift,
+                      struct ap_gcd_matrix1* m) {
+    ap_dig_t x[3], y[3];
+    for(int i = 0; i != 3; ++i) {
+        x[i] = apn_gcd_dig(a, n - 1 - i);
+        y[i] = apn_gcd_dig(b, n - 1 - i);
+    }
+    unsigned sh = shift ? ap_dig_clz(x[0] | y[0]) : 0;
+    if(sh) {
+        for(int i = 0; i != 2; ++i) {
+            x[i] = x[i] << sh | x[i + 1] >> (AP_DIG_BIT - sh);
+            y[i] = y[i] << sh | y[i + 1] >> (AP_DIG_BIT - sh);
+        }
+    }
+    return ap_hgcd2(x[0], x[1], y[0], y[1], m);
+}
+
+// (a, b) = m^-1 (a, b), unless a result would be negative or not above
+// base^s
+static bool apn_gcd_apply1(apn_s* a, apn_s* b, const struct ap_gcd_matrix1* m, size_t s,
+                           struct apn_gcd_ctx* c) {
+    size_t n = Macro_max(a->_size, b->_size);
+    apn_gcd_pad(a, n);
+    apn_gcd_pad(b, n);
+    apn_s *x = &c->t[0], *y = &c->t[1];
+    apn_reserve(x, n);
+    apn_reserve(y, n);
+    // a' = u11 a - u01 b and b' = u00 b - u10 a are not above a and b, the
+    // high digits cancel unless the result is negative
+    ap_dig_t hi = apn_data_mul_1(x->_data, a->_data, n, m->u[1][1]);
+    if(hi != apn_data_submul_1(x->_data, b->_data, n, m->u[0][1]))
+        return false;
+    hi = apn_data_mul_1(y->_data, b->_data, n, m->u[0][0]);
+    if(hi != apn_data_submul_1(y->_data, a->_data, n, m->u[1][0]))
+        return false;
+    x->_size = apn_data_norm(x->_data, n);
+    y->_size = apn_data_norm(y->_data, n);
+    if(x->_size <= s || y->_size <= s)
+        return false;
+    apn_swap(a, x);
+    apn_swap(b, y);
+    return true;
+}
+
+// One step of Euclid's algorithm on the larger of a and b by the quotient q,
+// or q - 1 if the remainder would not be above base^s for s > 0. false if
+// no step keeps both above base^s, or one is zero for s = 0.
+static bool apn_gcd_subdiv_step(apn_s* a, apn_s* b, size_t s, struct apn_gcd_matrix* M,
+                                struct apn_gcd_ctx* c) {
+    bool a_larger = apn_cmp(a, b) >= 0;
+    apn_s *x = a_larger ? a : b, *y = a_larger ? b : a;
+    apn_s *q = &c->t[0], *r = &c->t[1];
+    if(y->_size <= s || apn_is_zero(y))
+        return false;
+    apn_div_ws(q, r, x, y, &c->ws);
+    if(s && r->_size <= s) {
+        apn_sub_dig(q, q, 1);
+        if(apn_is_zero(q)) // x - y is too small already
+            return false;
+        apn_add_inplace(r, y);
+    }
+    apn_swap(x, r);
+    if(M)
+        apn_gcd_matrix_mul_q(M, q, a_larger, c);
+    return true;
+}
+
+// h = h base^p + u x - v y, false if that is negative or not above base^s
+static bool apn_gcd_adjust(apn_s* h, const apn_s* u, const apn_s* x, const apn_s* v,
+                           const apn_s* y, size_t p, size_t s, struct apn_gcd_ctx* c) {
+    apn_shl(h, h, p);
+    apn_mul_ws(&c->t[0], u, x, &c->ws);
+    apn_add_inplace(h, &c->t[0]);
+    apn_mul_ws(&c->t[0], v, y, &c->ws);
+    if(apn_cmp(h, &c->t[0]) < 0)
+        return false;
+    apn_sub(h, h, &c->t[0]);
+    return h->_size > s;
+}
+
+// the low p digits of o
+static void apn_gcd_low(apn_s* res, const apn_s* o, size_t p) {
+    apn_assign_part_zero(res, o, 0, p);
+    res->_size = apn_data_norm(res->_data, res->_size);
+}
+
+static bool apn_hgcd(apn_s* a, apn_s* b, struct apn_gcd_matrix* M, struct apn_gcd_ctx* c);
+
+// The half-gcd of the digits of a and b from p up reduces a and b as a
+// whole, the high parts are already reduced and the low ones are adjusted:
+// a' = ah' base^p + u11 al - u01 bl, b' = bh' base^p + u00 bl - u10 al.
+// false if nothing was reduced or a result is not above base^s. M can be
+// NULL.
+static bool apn_hgcd_reduce(apn_s* a, apn_s* b, size_t p, size_t s, struct apn_gcd_matrix* M,
+                            struct apn_gcd_ctx* c) {
+    struct apn_gcd_matrix M1;
+    apn_gcd_matrix_init(&M1, 0);
+    apn_s ah, bh, al, bl;
+    apn_init_list(&ah, &bh, &al, &bl, NULL);
+    apn_shr(&ah, a, p);
+    apn_shr(&bh, b, p);
+    bool ok = apn_hgcd(&ah, &bh, &M1, c);
+    if(ok) {
+        apn_gcd_low(&al, a, p);
+        apn_gcd_low(&bl, b, p);
+        ok = apn_gcd_adjust(&ah, &M1.u[1][1], &al, &M1.u[0][1], &bl, p, s, c) &&
+             apn_gcd_adjust(&bh, &M1.u[0][0], &bl, &M1.u[1][0], &al, p, s, c);
+    }
+    if(ok) {
+        apn_swap(a, &ah);
+        apn_swap(b, &bh);
+        if(M)
+            apn_gcd_matrix_mul(M, &M1, c);
+    }
+    apn_clear_list(&ah, &bh, &al, &bl, NULL);
+    apn_gcd_matrix_clear(&M1);
+    return ok;
+}
+
+// a double digit step if one fits, otherwise a division step
+static bool apn_hgcd_step(apn_s* a, apn_s* b, size_t s, struct apn_gcd_matrix* M,
+                          struct apn_gcd_ctx* c) {
+    size_t n = Macro_max(a->_size, b->_size);
+    struct ap_gcd_matrix1 m;
+    // with one digit above base^s only the exact leading digits keep the
+    // results above it
+    if(apn_hgcd2(a, b, n, n > s + 1, &m) && apn_gcd_apply1(a, b, &m, s, c)) {
+        apn_gcd_matrix_mul1(M, &m, c);
+        return true;
+    }
+    return apn_gcd_subdiv_step(a, b, s, M, c);
+}
+
+// Reduces a and b, the larger of n digits, as far as both stay above base^s
+// for s = n / 2 + 1, M = M M' for the steps M' taken. Above the threshold
+// the half-gcd of the upper half brings them to about 3n / 4 digits and
+// another one of the upper part of what is left to about s. false if
+// nothing was reduced.
+static bool apn_hgcd(apn_s* a, apn_s* b, struct apn_gcd_matrix* M, struct apn_gcd_ctx* c) {
+    size_t n = Macro_max(a->_size, b->_size), s = n / 2 + 1;
+    if(n <= s)
+        return false;
+    bool success = false;
+    if(n >= Macro_threshold(HGCD)) {
+        Macro_stats_tier(APN_STATS_GCD_HGCD);
+        size_t n2 = 3 * n / 4 + 1;
+        success = apn_hgcd_reduce(a, b, n / 2, s, M, c);
+        while(Macro_max(a->_size, b->_size) > n2) {
+            if(!apn_hgcd_step(a, b, s, M, c))
+                return success;
+            success = true;
+        }
+        n = Macro_max(a->_size, b->_size);
+        if(n > s + 2 && apn_hgcd_reduce(a, b, 2 * s - n + 1, s, M, c))
+            success = true;
+    }
+    while(apn_hgcd_step(a, b, s, M, c))
+        success = true;
+    return success;
+}
+
+// g = gcd(a, b), a and b are used up. With M the steps are multiplied to
+// it. Returns whether g was left in a, b is zero then.
+static bool apn_gcd_impl(apn_s* g, apn_s* a, apn_s* b, struct apn_gcd_matrix* M,
+                         struct apn_gcd_ctx* c) {
+    size_t n;
+    // half-gcd of the upper third
+    while((n = Macro_max(a->_size, b->_size)) >= Macro_threshold(GCD_DC)) {
+        if(!apn_hgcd_reduce(a, b, 2 * n / 3, 0, M, c) &&
+           !apn_gcd_subdiv_step(a, b, 0, M, c))
+            break;
+    }
+    Macro_stats_tier(APN_STATS_GCD_LEHMER);
+    while(!apn_is_zero(a) && !apn_is_zero(b)) {
+        n = Macro_max(a->_size, b->_size);
+        if(n == 1 && !M) {
+            apn_assign_dig(g, ap_dig_gcd(a->_data[0], b->_data[0]));
+            return true;
+        }
+        struct ap_gcd_matrix1 m;
+        if(apn_hgcd2(a, b, n, true, &m) && apn_gcd_apply1(a, b, &m, 0, c)) {
+            if(M)
+                apn_gcd_matrix_mul1(M, &m, c);
+        } else
+            apn_gcd_subdiv_step(a, b, 0, M, c);
+    }
+    bool in_a = !apn_is_zero(a);
+    apn_swap(g, in_a ? a : b);
+    return in_a;
+}
+
+static void apn_gcd_ctx_init(struct apn_gcd_ctx* c) {
+    apn_init_list(&c->t[0], &c->t[1], &c->t[2], NULL);
+    apn_ws_init(&c->ws);
+}
+
+static void apn_gcd_ctx_clear(struct apn_gcd_ctx* c) {
+    apn_clear_list(&c->t[0], &c->t[1], &c->t[2], NULL);
+    apn_ws_clear(&c->ws);
+}
+
+void apn_gcd(apn_s* res, const apn_s* op1, const apn_s* op2) {
+    Macro_stats_begin(APN_STATS_GCD, Macro_max(op1->_size, op2->_size));
+    struct apn_gcd_ctx c;
+    apn_gcd_ctx_init(&c);
+    apn_s a, b;
+    apn_init_list(&a, &b, NULL);
+    apn_assign(&a, op1);
+    apn_assign(&b, op2);
+    apn_gcd_impl(res, &a, &b, NULL, &c);
+    apn_clear_list(&a, &b, NULL);
+    apn_gcd_ctx_clear(&c);
+    Macro_stats_end();
+}
+
+// g = gcd(a, b) and the cofactor x of a, g = x a (mod b), negative if *neg.
+// a and b are used up. From (a0, b0) = T (g, 0) or T (0, g) with det T = 1
+// follows g = t11 a0 - t01 b0 or g = t00 b0 - t10 a0, only the second row
+// of T is kept.
+static void apn_gcdext_impl(apn_s* g, apn_s* x, bool* neg, apn_s* a, apn_s* b,
+                            struct apn_gcd_ctx* c) {
+    struct apn_gcd_matrix T;
+    apn_gcd_matrix_init(&T, 1);
+    bool in_a = apn_gcd_impl(g, a, b, &T, c);
+    apn_swap(x, &T.u[1][in_a]);
+    *neg = !in_a && !apn_is_zero(x);
+    apn_gcd_matrix_clear(&T);
+}
+
+void apz_gcdext(apn_s* g, apz_s* s, apz_s* t, const apz_s* op1, const apz_s* op2) {
+    const apn_s *A = &op1->magnitude, *B = &op2->magnitude;
+    Macro_stats_begin(APN_STATS_GCD, Macro_max(A->_size, B->_size));
+    bool sign1 = op1->sign, sign2 = op2->sign;
+    struct apn_gcd_ctx c;
+    apn_gcd_ctx_init(&c);
+    apn_s a, b, d, x, y, bg;
+    apn_init_list(&a, &b, &d, &x, &y, &bg, NULL);
+    apn_assign(&a, A);
+    apn_assign(&b, B);
+    bool neg;
+    apn_gcdext_impl(&d, &x, &neg, &a, &b, &c);
+    // a and b keep the magnitudes, g and the results may alias the operands
+    apn_assign(&a, A);
+    apn_assign(&b, B);
+    bool tneg = false;
+    if(apn_is_zero(&d)) // both zero
+        apn_assign_dig(&x, 0), apn_assign_dig(&y, 0), neg = false;
+    else if(apn_is_zero(&b)) // g = |a|
+        apn_assign_dig(&x, 1), apn_assign_dig(&y, 0), neg = false;
+    else {
+        // the x of smallest magnitude, |x| <= b / 2g
+        apn_div_ws(&bg, NULL, &b, &d, &c.ws);
+        apn_div_ws(NULL, &x, &x, &bg, &c.ws);
+        if(neg && !apn_is_zero(&x))
+            apn_sub(&x, &bg, &x);
+        apn_bit_shl(&y, &x, 1);
+        neg = apn_cmp(&y, &bg) > 0;
+        if(neg)
+            apn_sub(&x, &bg, &x);
+        // y = (g - x a) / b
+        apn_mul_ws(&y, &x, &a, &c.ws);
+        if(neg)
+            apn_add_inplace(&y, &d);
+        else if(apn_cmp(&y, &d) > 0) {
+            apn_sub(&y, &y, &d);
+            tneg = true;
+        } else
+            apn_sub(&y, &d, &y);
+        apn_div_ws(&y, NULL, &y, &b, &c.ws);
+    }
+    apn_swap(g, &d);
+    if(s != NULL) {
+        apn_swap(&s->magnitude, &x);
+        s->sign = !apn_is_zero(&s->magnitude) && (neg ^ sign1);
+    }
+    if(t != NULL) {
+        apn_swap(&t->magnitude, &y);
+        t->sign = !apn_is_zero(&t->magnitude) && (tneg ^ sign2);
+    }
+    apn_clear_list(&a, &b, &d, &x, &y, &bg, NULL);
+    apn_gcd_ctx_clear(&c);
+    Macro_stats_end();
+}
+
+bool apn_invert(apn_s* res, const apn_s* op, const apn_s* mod) {
+    assert(!apn_is_zero(mod));
+    Macro_stats_begin(APN_STATS_GCD, mod->_size);
+    struct apn_gcd_ctx c;
+    apn_gcd_ctx_init(&c);
+    apn_s a, b, g, x;
+    apn_init_list(&a, &b, &g, &x, NULL);
+    apn_div_ws(NULL, &a, op, mod, &c.ws);
+    apn_assign(&b, mod);
+    bool neg;
+    apn_gcdext_impl(&g, &x, &neg, &a, &b, &c);
+    bool ok = apn_cmp_dig(&g, 1) == 0;
+    if(ok) {
+        if(apn_cmp(&x, mod) >= 0)
+            apn_div_ws(NULL, &x, &x, mod, &c.ws);
+        if(neg && !apn_is_zero(&x))
+            apn_sub(&x, mod, &x);
+        apn_swap(res, &x);
+    }
+    apn_clear_list(&a, &b, &g, &x, NULL);
+    apn_gcd_ctx_clear(&c);
+    Macro_stats_end();
+    return ok;
+}
@@ -0,0 +1,191 @@
+#include "apn.h"
+#include "apz.h"
+#include "ap_impl.h"
+#include <assert.h>
+#include <string.h>
+
+// Binary conversions. Words of `size` bytes map to the bytes of the number
+// one by one; words of a digit's size move a digit at a time, which is a
+// memcpy when the order and byte order are those of _data.
+
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+#define AP_HOST_ENDIAN 1
+#else
+#define AP_HOST_ENDIAN -1
+#endif
+
+static inline ap_dig_t ap_dig_bswap(ap_dig_t x) {
+#if defined(AP_HAVE_BUILTIN_BSWAP)
+    return __builtin_bswap64(x);
+#else
+    ap_dig_t r = 0;
+    for(int i = 0; i != AP_DIG_BIT / 8; ++i, x >>= 8)
+        r = r << 8 | (x & 0xFF);
+    return r;
+#endif
+}
+
+void apn_import(apn_s* res, size_t count, int order, size_t size, int endian,
+                const void* data) {
+    const unsigned char* in = data;
+    size_t bytes = count * size, n = (bytes + sizeof(ap_dig_t) - 1) / sizeof(ap_dig_t);
+    if(!n) {
+        apn_assign_dig(res, 0);
+        return;
+    }
+    if(!endian)
+        endian = AP_HOST_ENDIAN;
+    apn_reserve(res, n);
+    ap_dig_t* rp = res->_data;
+    if(size == sizeof(ap_dig_t)) {
+        if(order < 0 && endian == AP_HOST_ENDIAN)
+            memcpy(rp, in, n * sizeof(ap_dig_t));
+        else {
+            for(size_t w = 0; w != n; ++w) {
+                ap_dig_t x;
+                memcpy(&x, in + (order < 0 ? w : n - 1 - w) * size, size);
+                rp[w] = endian == AP_HOST_ENDIAN ? x : ap_dig_bswap(x);
+            }
+        }
+    } else {
+        memset(rp, 0, n * sizeof(ap_dig_t));
+        for(size_t w = 0; w != count; ++w) {
+            const unsigned char* word = in + (order < 0 ? w : count - 1 - w) * size;
+            for(size_t b = 0; b != size; ++b) {
+                size_t j = w * size + b; // byte of the number
+                rp[j / sizeof(ap_dig_t)] |= (ap_dig_t)word[endian < 0 ? b : size - 1 - b]
+                                            << (8 * (j % sizeof(ap_dig_t)));
+            }
+        }
+    }
+    res->_size = apn_data_norm(rp, n);
+}
+
+size_t apn_export_count(const apn_s* op, size_t size) {
+    return ((apn_bitlen(op) + 7) / 8 + size - 1) / size;
+}
+
+size_t apn_export(void* data, int order, size_t size, int endian, const apn_s* op) {
+    unsigned char* out = data;
+    size_t bytes = (apn_bitlen(op) + 7) / 8, count = (bytes + size - 1) / size;
+    if(!endian)
+        endian = AP_HOST_ENDIAN;
+    if(size == sizeof(ap_dig_t)) {
+        if(order < 0 && endian == AP_HOST_ENDIAN)
+            memcpy(out, op->_data, count * sizeof(ap_dig_t));
+        else {
+            for(size_t w = 0; w != count; ++w) {
+                ap_dig_t x = op->_data[w];
+                if(endian != AP_HOST_ENDIAN)
+                    x = ap_dig_bswap(x);
+                memcpy(out + (order < 0 ? w : count - 1 - w) * size, &x, size);
+            }
+        }
+        return count;
+    }
+    for(size_t w = 0; w != count; ++w) {
+        unsigned char* word = out + (order < 0 ? w : count - 1 - w) * size;
+        for(size_t b = 0; b != size; ++b) {
+            size_t j = w * size + b;
+            unsigned char x = 0;
+            if(j < bytes)
+                x = (unsigned char)(op->_data[j / sizeof(ap_dig_t)]
+                                    >> (8 * (j % sizeof(ap_dig_t))));
+            word[endian < 0 ? b : size - 1 - b] = x;
+        }
+    }
+    return count;
+}
+
+// The serialized form is a header of 8 bytes, the digit count times 2 plus
+// the sign as a little-endian number, followed by the digits from the least
+// significant one, each in 8 little-endian bytes. Zero has no digits and is
+// never negative.
+
+enum { apn_io_header = 8 };
+
+static size_t apn_io_serialize(void* buf, const apn_s* op, bool sign) {
+    unsigned char* p = buf;
+    size_t n = apn_is_zero(op) ? 0 : op->_size;
+    uint64_t h = (uint64_t)n << 1 | (sign && n);
+    for(int i = 0; i != apn_io_header; ++i)
+        p[i] = (unsigned char)(h >> (8 * i));
+    apn_export(p + apn_io_header, -1, sizeof(ap_dig_t), -1, op);
+    return apn_io_header + n * sizeof(ap_dig_t);
+}
+
+// the digit count and sign from the header, false if buf is too short
+static bool apn_io_header_read(const void* buf, size_t len, size_t* n, bool* sign) {
+    const unsigned char* p = buf;
+    if(len < apn_io_header)
+        return false;
+    uint64_t h = 0;
+    for(int i = 0; i != apn_io_header; ++i)
+        h |= (uint64_t)p[i] << (8 * i);
+    *n = (size_t)(h >> 1);
+    *sign = h & 1;
+    return *n <= (len - apn_io_header) / sizeof(ap_dig_t);
+}
+
+size_t apn_serialized_size(const apn_s* op) {
+    return apn_io_header + (apn_is_zero(op) ? 0 : op->_size) * sizeof(ap_dig_t);
+}
+
+size_t apn_serialize(void* buf, const apn_s* op) {
+    return apn_io_serialize(buf, op, false);
+}
+
+size_t apn_deserialize(apn_s* res, const void* buf, size_t len) {
+    size_t n;
+    bool sign;
+    if(!apn_io_header_read(buf, len, &n, &sign) || sign)
+        return 0;
+    apn_import(res, n, -1, sizeof(ap_dig_t), -1, (const unsigned char*)buf + apn_io_header);
+    return apn_io_header + n * sizeof(ap_dig_t);
+}
+
+size_t apz_serialized_size(const apz_s* op) {
+    return apn_serialized_size(&op->magnitude);
+}
+
+size_t apz_serialize(void* buf, const apz_s* op) {
+    return apn_io_serialize(buf, &op->magnitude, op->sign);
+}
+
+size_t apz_deserialize(apz_s* res, const void* buf, size_t len) {
+    size_t n;
+    bool sign;
+    if(!apn_io_header_read(buf, len, &n, &sign))
+        return 0;
+    apn_import(&res->magnitude, n, -1, sizeof(ap_dig_t), -1,
+               (const unsigned char*)buf + apn_io_header);
+    res->sign = sign && !apn_is_zero(&res->magnitude);
+    return apn_io_header + n * sizeof(ap_dig_t);
+}
+
+const apn_s* apn_wrap(apn_s* view, const ap_dig_t* p, size_t n) {
+    assert((uintptr_t)p % _Alignof(ap_dig_t) == 0);
+    n = n ? apn_data_norm(p, n) : 0;
+    apn_init(view);
+    if(n <= APN_INLINE_DIGITS) { // a number of its own
+        if(n) {
+            memcpy(view->_inline, p, n * sizeof(ap_dig_t));
+            view->_size = n;
+        }
+    } else {
+        view->_data = (ap_dig_t*)p;
+        view->_capacity = view->_size = n;
+    }
+    return view;
+}
+
+size_t apn_deserialize_wrap(apn_s* view, const void* buf, size_t len) {
+    const unsigned char* p = (const unsigned char*)buf + apn_io_header;
+    size_t n;
+    bool sign;
+    if(AP_HOST_ENDIAN > 0 || (uintptr_t)p % _Alignof(ap_dig_t)
+       || !apn_io_header_read(buf, len, &n, &sign) || sign)
+        return 0;
+    apn_wrap(view, (const ap_dig_t*)p, n);
+    return apn_io_header + n * sizeof(ap_dig_t);
+}
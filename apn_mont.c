@@ -0,0 +1,187 @@
+#include "apn.h"
+#include "ap_impl.h"
+#include <assert.h>
+#include <string.h>
+
+// Montgomery multiplication, see
+// Peter L. Montgomery, "Modular Multiplication Without Trial Division", 1985
+// and for the interleaved product Cetin Kaya Koc, Tolga Acar and Burton S.
+// Kaliski, "Analyzing and Comparing Montgomery Multiplication Algorithms", 1996
+
+// rp[0, n) = ap bp R^-1 (mod m), coarsely integrated operand scanning,
+// ap, bp < m, tp holds 2n + 1 digits, rp may alias the operands
+static void apn_data_mont_mul(ap_dig_t* rp, const ap_dig_t* ap, const ap_dig_t* bp,
+                              const ap_dig_t* mp, size_t n, ap_dig_t minv, ap_dig_t* tp) {
+    // step i adds ap bp[i] and the multiple of m clearing the low digit to the
+    // window tp[i, i + n + 1], the next window starts one digit higher
+    memset(tp, 0, (2 * n + 1) * sizeof(ap_dig_t));
+    for(size_t i = 0; i != n; ++i) {
+        ap_dig_t* t = tp + i;
+        ap_dig_t carry = apn_data_addmul_1(t, ap, n, bp[i]);
+        unsigned char top = ap_dig_addc(0, t[n], carry, &t[n]);
+        carry = apn_data_addmul_1(t, mp, n, t[0] * minv);
+        top += ap_dig_addc(0, t[n], carry, &t[n]);
+        t[n + 1] = top; // the window is below 2m
+    }
+    // tp[n, 2n] < 2m
+    if(tp[2 * n] || apn_data_cmp(tp + n, mp, n) >= 0)
+        apn_data_sub_n(rp, tp + n, mp, n);
+    else
+        memcpy(rp, tp + n, n * sizeof(ap_dig_t));
+}
+
+// rp[0, n) = tp R^-1 (mod m) for tp[0, 2n) < m R, tp is destroyed
+static void apn_data_mont_redc(ap_dig_t* rp, ap_dig_t* tp, const ap_dig_t* mp, size_t n,
+                               ap_dig_t minv) {
+    // the carry of step i belongs to digit i + n, it is kept in the cleared
+    // digit i and added at the end
+    for(size_t i = 0; i != n; ++i)
+        tp[i] = apn_data_addmul_1(tp + i, mp, n, tp[i] * minv);
+    ap_dig_t carry = apn_data_add_n(rp, tp + n, tp, n);
+    if(carry || apn_data_cmp(rp, mp, n) >= 0)
+        apn_data_sub_n(rp, rp, mp, n);
+}
+
+// rp[0, n) = ap^2 R^-1 (mod m), by the squaring kernels and a separate
+// reduction, rp may alias ap
+static void apn_data_mont_sqr(ap_dig_t* rp, const ap_dig_t* ap, const ap_dig_t* mp, size_t n,
+                              ap_dig_t minv, apn_ws_s* ws) {
+    ap_dig_t* t = apn_ws_push(ws, 2 * n);
+    apn_data_sqr(t, ap, n, ws);
+    apn_data_mont_redc(rp, t, mp, n, minv);
+    apn_ws_pop(ws, 2 * n);
+}
+
+// workspace of apn_mont_load and a product or square
+static size_t apn_mont_itch(size_t n) {
+    return Macro_max(4 * n + 1, 2 * n + apn_data_sqr_itch(n));
+}
+
+// rp[0, n) = op (mod m) in Montgomery form
+static void apn_mont_load(ap_dig_t* rp, const apn_s* op, const apn_mont_s* ctx, apn_ws_s* ws) {
+    size_t n = ctx->_mod._size;
+    ap_dig_t* x = apn_ws_push(ws, 4 * n + 1);
+    ap_dig_t* r2 = x + n;
+    ap_dig_t* t = r2 + n;
+    if(apn_cmp(op, &ctx->_mod) < 0) {
+        memset(x, 0, n * sizeof(ap_dig_t));
+        memcpy(x, op->_data, op->_size * sizeof(ap_dig_t));
+    } else {
+        apn_s r;
+        apn_init(&r);
+        apn_div(NULL, &r, op, &ctx->_mod);
+        memset(x, 0, n * sizeof(ap_dig_t));
+        memcpy(x, r._data, r._size * sizeof(ap_dig_t));
+        apn_clear(&r);
+    }
+    memset(r2, 0, n * sizeof(ap_dig_t));
+    memcpy(r2, ctx->_r2._data, ctx->_r2._size * sizeof(ap_dig_t));
+    apn_data_mont_mul(rp, x, r2, ctx->_mod._data, n, ctx->_minv, t);
+    apn_ws_pop(ws, 4 * n + 1);
+}
+
+void apn_mont_init(apn_mont_s* ctx, const apn_s* mod) {
+    assert(apn_is_odd(mod));
+    size_t n = mod->_size;
+    apn_init_list(&ctx->_mod, &ctx->_r2, NULL);
+    apn_assign(&ctx->_mod, mod);
+    ctx->_minv = -ap_dig_binvert(mod->_data[0]);
+    // R^2 = base^2n
+    apn_s t;
+    apn_init(&t);
+    apn_realloc(&t, 2 * n + 1);
+    apn_data_fill_zero(&t);
+    t._data[2 * n] = 1;
+    t._size = 2 * n + 1;
+    apn_div(NULL, &ctx->_r2, &t, mod);
+    apn_clear(&t);
+}
+
+void apn_mont_clear(apn_mont_s* ctx) {
+    apn_clear_list(&ctx->_mod, &ctx->_r2, NULL);
+}
+
+void apn_mont_to(apn_s* res, const apn_s* op, const apn_mont_s* ctx) {
+    size_t n = ctx->_mod._size;
+    apn_ws_s ws;
+    apn_ws_init(&ws);
+    apn_ws_reserve(&ws, n + apn_mont_itch(n));
+    ap_dig_t* r = apn_ws_push(&ws, n);
+    apn_mont_load(r, op, ctx, &ws);
+    apn_assign_data(res, r, n);
+    apn_ws_pop(&ws, n);
+    apn_ws_clear(&ws);
+}
+
+void apn_mont_from(apn_s* res, const apn_s* op, const apn_mont_s* ctx) {
+    size_t n = ctx->_mod._size;
+    assert(op->_size <= n);
+    apn_ws_s ws;
+    apn_ws_init(&ws);
+    apn_ws_reserve(&ws, 3 * n);
+    ap_dig_t* r = apn_ws_push(&ws, n);
+    ap_dig_t* t = apn_ws_push(&ws, 2 * n);
+    memset(t, 0, 2 * n * sizeof(ap_dig_t));
+    memcpy(t, op->_data, op->_size * sizeof(ap_dig_t));
+    apn_data_mont_redc(r, t, ctx->_mod._data, n, ctx->_minv);
+    apn_assign_data(res, r, n);
+    apn_ws_pop(&ws, 3 * n);
+    apn_ws_clear(&ws);
+}
+
+void apn_mont_mul(apn_s* res, const apn_s* op1, const apn_s* op2, const apn_mont_s* ctx) {
+    size_t n = ctx->_mod._size;
+    assert(op1->_size <= n && op2->_size <= n);
+    apn_ws_s ws;
+    apn_ws_init(&ws);
+    apn_ws_reserve(&ws, 5 * n + 1);
+    ap_dig_t* a = apn_ws_push(&ws, 5 * n + 1);
+    ap_dig_t* b = a + n;
+    ap_dig_t* r = b + n;
+    ap_dig_t* t = r + n;
+    memset(a, 0, 2 * n * sizeof(ap_dig_t));
+    memcpy(a, op1->_data, op1->_size * sizeof(ap_dig_t));
+    memcpy(b, op2->_data, op2->_size * sizeof(ap_dig_t));
+    apn_data_mont_mul(r, a, b, ctx->_mod._data, n, ctx->_minv, t);
+    apn_assign_data(res, r, n);
+    apn_ws_pop(&ws, 5 * n + 1);
+    apn_ws_clear(&ws);
+}
+
+// apn_data_modmul_fn of Montgomery products
+static void apn_mont_modmul(ap_dig_t* rp, const ap_dig_t* ap, const ap_dig_t* bp,
+                            const void* ctx, apn_ws_s* ws) {
+    const apn_mont_s* mont = ctx;
+    size_t n = mont->_mod._size;
+    if(ap == bp)
+        apn_data_mont_sqr(rp, ap, mont->_mod._data, n, mont->_minv, ws);
+    else {
+        ap_dig_t* t = apn_ws_push(ws, 2 * n + 1);
+        apn_data_mont_mul(rp, ap, bp, mont->_mod._data, n, mont->_minv, t);
+        apn_ws_pop(ws, 2 * n + 1);
+    }
+}
+
+void apn_mont_modexp(apn_s* res, const apn_s* base, const apn_s* exp, const apn_mont_s* ctx) {
+    size_t n = ctx->_mod._size;
+    if(apn_is_zero(exp)) { // 1 (mod m)
+        apn_assign_dig(res, apn_cmp_dig(&ctx->_mod, 1) != 0);
+        return;
+    }
+    Macro_stats_begin(APN_STATS_MODEXP, n);
+    Macro_stats_tier(APN_STATS_MODEXP_MONT);
+    apn_ws_s ws;
+    apn_ws_init(&ws);
+    apn_ws_reserve(&ws, 3 * n + apn_data_powm_itch(n, exp, apn_mont_itch(n)));
+    ap_dig_t* g = apn_ws_push(&ws, n);
+    ap_dig_t* r = apn_ws_push(&ws, 2 * n);
+    apn_mont_load(g, base, ctx, &ws);
+    apn_data_powm(r, g, n, exp, apn_mont_modmul, ctx, &ws);
+    // out of Montgomery form
+    memset(r + n, 0, n * sizeof(ap_dig_t));
+    apn_data_mont_redc(g, r, ctx->_mod._data, n, ctx->_minv);
+    apn_assign_data(res, g, n);
+    apn_ws_pop(&ws, 3 * n);
+    apn_ws_clear(&ws);
+    Macro_stats_end();
+}
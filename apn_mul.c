@@ -1,75 +1,660 @@
 #include "apn.h"
 #include "ap_impl.h"
+#include <string.h>
 
-void apn_mul(apn_s* res, const apn_s* op1, const apn_s* op2) {
-    size_t n = Macro_min(op1->_size, op2->_size);
-    if(n <= APN_MUL_KARATSUBA_THRESHOLD)
-        apn_mul_basecase(res, op1, op2);
-    else
-        apn_mul_karatsuba(res, op1, op2);
+typedef void (*apn_data_mul_fn)(ap_dig_t* rp, const ap_dig_t* ap, size_t an,
+                                const ap_dig_t* bp, size_t bn, apn_ws_s* ws);
+typedef size_t (*apn_data_itch_fn)(size_t an, size_t bn);
+
+ap_dig_t apn_data_mul_1(ap_dig_t* rp, const ap_dig_t* ap, size_t n, ap_dig_t dig) {
+    ap_dig_t carry = 0;
+    for(size_t i = 0; i != n; ++i) {
+        struct ap_dig_pair x = ap_dig_mul(ap[i], dig);
+        carry = x.hi + ap_dig_addc(0, x.lo, carry, &rp[i]);
+    }
+    return carry;
 }
 
-// long multiplication
-void apn_mul_basecase(apn_s* res, const apn_s* op1, const apn_s* op2) {
-    size_t max_size = op1->_size + op2->_size;
+ap_dig_t apn_data_addmul_1(ap_dig_t* rp, const ap_dig_t* ap, size_t n, ap_dig_t dig) {
+    ap_dig_t carry = 0;
+    for(size_t i = 0; i != n; ++i) {
+        struct ap_dig_pair x = ap_dig_mul(ap[i], dig);
+        ap_dig_t t;
+        x.hi += ap_dig_addc(0, x.lo, carry, &t);
+        carry = x.hi + ap_dig_addc(0, rp[i], t, &rp[i]); // x.hi <= AP_DIG_MAX - 1, never overflows
+    }
+    return carry;
+}
 
-    apn_s r;
-    apn_init(&r);
-    apn_realloc(&r, max_size);
-    apn_data_fill_zero(&r);
+ap_dig_t apn_data_submul_1(ap_dig_t* rp, const ap_dig_t* ap, size_t n, ap_dig_t dig) {
+    ap_dig_t borrow = 0;
+    for(size_t i = 0; i != n; ++i) {
+        struct ap_dig_pair x = ap_dig_mul(ap[i], dig);
+        ap_dig_t t;
+        x.hi += ap_dig_addc(0, x.lo, borrow, &t);
+        borrow = x.hi + ap_dig_subb(0, rp[i], t, &rp[i]);
+    }
+    return borrow;
+}
+
+// a sub-product, spawned on the thread pool or done right away
+struct apn_mul_task {
+    apn_task_s      task;
+    ap_dig_t*       rp;
+    const ap_dig_t* ap;
+    size_t          an;
+    const ap_dig_t* bp;
+    size_t          bn;
+};
+
+static void apn_mul_task_run(void* arg, apn_ws_s* ws) {
+    struct apn_mul_task* t = arg;
+    apn_ws_reserve(ws, apn_data_mul_itch(t->an, t->bn));
+    apn_data_mul(t->rp, t->ap, t->an, t->bp, t->bn, ws);
+}
 
-    for(size_t i = 0; i != op1->_size; ++i) {
-        for(size_t j = 0; j != op2->_size; ++j) {
-            struct ap_dig_pair x = ap_dig_mul(op1->_data[i], op2->_data[j]);
-            ap_dig_t* p = r._data + i + j;
-            apn_data_add(p, p, max_size - i - j, &x.lo, 2);
-        }
+// rp[0, an + bn) = ap * bp, as a task if `par`, apn_data_mul_join waits for it
+static void apn_data_mul_fork(struct apn_mul_task* t, bool par, ap_dig_t* rp,
+                              const ap_dig_t* ap, size_t an,
+                              const ap_dig_t* bp, size_t bn, apn_ws_s* ws) {
+    if(!par) {
+        apn_data_mul(rp, ap, an, bp, bn, ws);
+        return;
     }
-    size_t i = max_size - 1;
-    while(i && !r._data[i]) --i;
-    r._size = i + 1;
+    t->task.fn = apn_mul_task_run;
+    t->task.arg = t;
+    t->rp = rp, t->ap = ap, t->an = an, t->bp = bp, t->bn = bn;
+    apn_task_spawn(&t->task);
+}
 
-    apn_swap(res, &r);
-    apn_clear(&r);
+static void apn_data_mul_join(struct apn_mul_task* t, bool par) {
+    if(par)
+        apn_task_wait(&t->task);
 }
 
-void apn_mul_karatsuba(apn_s* res, const apn_s* op1, const apn_s* op2) {
+// an >= 2 * bn, multiply bp by each bn-digit block of ap
+static void apn_data_mul_blocks(ap_dig_t* rp, const ap_dig_t* ap, size_t an,
+                                const ap_dig_t* bp, size_t bn, apn_ws_s* ws) {
+    ap_dig_t* t = apn_ws_push(ws, 2 * bn);
+    apn_data_mul(rp, ap, bn, bp, bn, ws);
+    for(size_t i = bn; i < an; i += bn) {
+        size_t k = Macro_min(bn, an - i);
+        apn_data_mul(t, bp, bn, ap + i, k, ws);
+        // rp[0, i + bn) is done, add the block product on top of it
+        ap_dig_t carry = apn_data_add_n(rp + i, rp + i, t, bn);
+        memcpy(rp + i + bn, t + bn, k * sizeof(ap_dig_t));
+        apn_data_add_1(rp + i + bn, rp + i + bn, k, carry);
+    }
+    apn_ws_pop(ws, 2 * bn);
+}
+
+// Toom-k needs the smaller operand to have all k parts of ceil(an / k) digits
+static inline bool apn_data_mul_toom_fits(size_t an, size_t bn, size_t k) {
+    return bn > (k - 1) * ((an + k - 1) / k);
+}
+
+// select the algorithm by size of the smaller operand
+void apn_data_mul(ap_dig_t* rp, const ap_dig_t* ap, size_t an,
+                  const ap_dig_t* bp, size_t bn, apn_ws_s* ws) {
+    if(ap == bp && an == bn)
+        apn_data_sqr(rp, ap, an, ws);
+    else if(bn <= Macro_threshold(MUL_KARATSUBA))
+        apn_data_mul_basecase(rp, ap, an, bp, bn);
+    else if(bn > Macro_threshold(MUL_FFT))
+        apn_data_mul_fft(rp, ap, an, bp, bn, ws);
+    else if(an >= 2 * bn)
+        apn_data_mul_blocks(rp, ap, an, bp, bn, ws);
+    else if(bn > Macro_threshold(MUL_TOOM44) && apn_data_mul_toom_fits(an, bn, 4))
+        apn_data_mul_toom44(rp, ap, an, bp, bn, ws);
+    else if(bn > Macro_threshold(MUL_TOOM33) && apn_data_mul_toom_fits(an, bn, 3))
+        apn_data_mul_toom33(rp, ap, an, bp, bn, ws);
+    else
+        apn_data_mul_karatsuba(rp, ap, an, bp, bn, ws);
+}
+
+size_t apn_data_mul_itch(size_t an, size_t bn) {
+    // Every algorithm but FFT takes at most 5an + 32 digits and recurses on
+    // operands of at most an / 2 + 2 digits, this also bounds the unbalanced
+    // case. FFT does not recurse, but may be chosen at any level. The lower
+    // of the product and square thresholds covers squaring as well.
+    (void)bn;
+    size_t r = 0, fft = 0;
+    size_t kt = Macro_min(Macro_threshold(MUL_KARATSUBA), Macro_threshold(SQR_KARATSUBA));
+    size_t ft = Macro_min(Macro_threshold(MUL_FFT), Macro_threshold(SQR_FFT));
+    while(an > kt) {
+        if(an > ft)
+            fft = Macro_max(fft, r + apn_data_mul_fft_itch(an, an));
+        r += 5 * an + 32;
+        an = Macro_min(an / 2 + 2, an - 1);
+    }
+    return Macro_max(r, fft);
+}
+
+// long multiplication
+void apn_data_mul_basecase(ap_dig_t* rp, const ap_dig_t* ap, size_t an,
+                           const ap_dig_t* bp, size_t bn) {
+    Macro_stats_tier(APN_STATS_MUL_BASECASE);
+    rp[an] = apn_data_mul_1(rp, ap, an, bp[0]);
+    for(size_t i = 1; i != bn; ++i)
+        rp[an + i] = apn_data_addmul_1(rp + i, ap, an, bp[i]);
+}
+
+void apn_data_mul_karatsuba(ap_dig_t* rp, const ap_dig_t* ap, size_t an,
+                            const ap_dig_t* bp, size_t bn, apn_ws_s* ws) {
     // Split operands at m: x = x1 B^m + x0, y = y1 B^m + y0.
     // xy = z2 B^2m + z1 B^m + z0, z0 = x0y0, z1 = x0y1 + x1y0, z2 = x1y1
     // This requires 4 multiplications, but z1 can be calculated as
-    // z1 = (x1 + x0)(y1 + y0) - z2 - z0
-    if(Macro_min(op1->_size, op2->_size) <= APN_MUL_KARATSUBA_THRESHOLD) { // base case
-        apn_mul_basecase(res, op1, op2);
+    // z1 = z2 + z0 - (x1 - x0)(y1 - y0), the differences need no carry digit.
+    if(bn <= Macro_threshold(MUL_KARATSUBA)) { // base case
+        apn_data_mul_basecase(rp, ap, an, bp, bn);
+        return;
+    }
+    if(an >= 2 * bn) {
+        apn_data_mul_blocks(rp, ap, an, bp, bn, ws);
+        return;
+    }
+    Macro_stats_tier(APN_STATS_MUL_KARATSUBA);
+    // x0, y0: m digits, x1: h digits, y1: yh digits, 0 < yh <= h
+    size_t m = an / 2, h = an - m, yh = bn - m, dn = Macro_max(m, yh);
+    ap_dig_t* dx = apn_ws_push(ws, 2 * (h + dn) + an + 1);
+    ap_dig_t* dy = dx + h;
+    ap_dig_t* p = dy + dn;
+    ap_dig_t* w = p + h + dn;
+
+    // z0 and z2 go straight to the result, in parallel to p if enabled
+    bool par = apn_task_parallel(m);
+    struct apn_mul_task z0, z2;
+    apn_data_mul_fork(&z0, par, rp, ap, m, bp, m, ws);
+    apn_data_mul_fork(&z2, par, rp + 2 * m, ap + m, h, bp + m, yh, ws);
+    // p = |x1 - x0||y1 - y0|
+    bool neg = apn_data_absdiff(dx, ap + m, h, ap, m);
+    if(yh >= m)
+        neg ^= apn_data_absdiff(dy, bp + m, yh, bp, m);
+    else
+        neg ^= !apn_data_absdiff(dy, bp, m, bp + m, yh);
+    apn_data_mul(p, dx, h, dy, dn, ws);
+    apn_data_mul_join(&z0, par);
+    apn_data_mul_join(&z2, par);
+    // w = z1
+    memset(w, 0, (an + 1) * sizeof(ap_dig_t));
+    memcpy(w, rp, 2 * m * sizeof(ap_dig_t));
+    apn_data_add_nm(w, w, an + 1, rp + 2 * m, h + yh);
+    if(neg)
+        apn_data_add_nm(w, w, an + 1, p, h + dn);
+    else
+        apn_data_sub_nm(w, w, an + 1, p, h + dn);
+    // add to result
+    apn_data_add_nm(rp + m, rp + m, an + bn - m, w, an + 1);
+
+    apn_ws_pop(ws, 2 * (h + dn) + an + 1);
+}
+
+// select the algorithm by size of the operand
+void apn_data_sqr(ap_dig_t* rp, const ap_dig_t* ap, size_t n, apn_ws_s* ws) {
+    if(n <= Macro_threshold(SQR_KARATSUBA))
+        apn_data_sqr_basecase(rp, ap, n);
+    else if(n > Macro_threshold(SQR_FFT))
+        apn_data_mul_fft(rp, ap, n, ap, n, ws);
+    else if(n > Macro_threshold(SQR_TOOM44))
+        apn_data_mul_toom44(rp, ap, n, ap, n, ws);
+    else if(n > Macro_threshold(SQR_TOOM33))
+        apn_data_mul_toom33(rp, ap, n, ap, n, ws);
+    else
+        apn_data_sqr_karatsuba(rp, ap, n, ws);
+}
+
+size_t apn_data_sqr_itch(size_t n) {
+    return apn_data_mul_itch(n, n);
+}
+
+void apn_data_sqr_basecase(ap_dig_t* rp, const ap_dig_t* ap, size_t n) {
+    // Each product a_i a_j, i != j, appears twice. Sum the ones above the
+    // diagonal, double them with a shift and add the squares a_i^2.
+    Macro_stats_tier(APN_STATS_SQR_BASECASE);
+    if(n == 1) {
+        struct ap_dig_pair x = ap_dig_mul(ap[0], ap[0]);
+        rp[0] = x.lo, rp[1] = x.hi;
         return;
     }
-    size_t m = Macro_max(op1->_size, op2->_size) / 2; // dividing point
+    rp[0] = 0;
+    rp[n] = apn_data_mul_1(rp + 1, ap + 1, n - 1, ap[0]);
+    for(size_t i = 1; i < n - 1; ++i)
+        rp[n + i] = apn_data_addmul_1(rp + 2 * i + 1, ap + i + 1, n - i - 1, ap[i]);
+    rp[2 * n - 1] = 0;
+    apn_data_lshift(rp, rp, 2 * n, 1);
 
-    apn_s x0, x1, y0, y1, z0, z1, z2, t; // result and parts, temp
-    apn_init_list(&x0, &x1, &y0, &y1, &z0, &z1, &z2, &t, NULL);
+    unsigned char carry = 0;
+    for(size_t i = 0; i != n; ++i) {
+        struct ap_dig_pair x = ap_dig_mul(ap[i], ap[i]);
+        carry = ap_dig_addc(carry, rp[2 * i], x.lo, &rp[2 * i]);
+        carry = ap_dig_addc(carry, rp[2 * i + 1], x.hi, &rp[2 * i + 1]);
+    }
+}
 
-    apn_assign_part(&x0, op1, 0, Macro_min(op1->_size, m));
-    if(op1->_size > m)
-        apn_assign_part(&x1, op1, m, op1->_size - m);
+void apn_data_sqr_karatsuba(ap_dig_t* rp, const ap_dig_t* ap, size_t n, apn_ws_s* ws) {
+    // As in the multiplication, z1 = 2 x0x1 = z2 + z0 - (x1 - x0)^2, but the
+    // middle term is a square, so it is never negative.
+    if(n <= Macro_threshold(SQR_KARATSUBA)) {
+        apn_data_sqr_basecase(rp, ap, n);
+        return;
+    }
+    Macro_stats_tier(APN_STATS_SQR_KARATSUBA);
+    // x0: m digits, x1: h digits
+    size_t m = n / 2, h = n - m;
+    ap_dig_t* d = apn_ws_push(ws, 3 * h + n + 1);
+    ap_dig_t* p = d + h;
+    ap_dig_t* w = p + 2 * h;
 
-    apn_assign_part(&y0, op2, 0, Macro_min(op2->_size, m));
-    if(op2->_size > m)
-        apn_assign_part(&y1, op2, m, op2->_size - m);
+    bool par = apn_task_parallel(m);
+    struct apn_mul_task z0, z2;
+    apn_data_mul_fork(&z0, par, rp, ap, m, ap, m, ws);
+    apn_data_mul_fork(&z2, par, rp + 2 * m, ap + m, h, ap + m, h, ws);
+    apn_data_absdiff(d, ap + m, h, ap, m);
+    apn_data_sqr(p, d, h, ws);
+    apn_data_mul_join(&z0, par);
+    apn_data_mul_join(&z2, par);
+    // w = z1
+    memset(w, 0, (n + 1) * sizeof(ap_dig_t));
+    memcpy(w, rp, 2 * m * sizeof(ap_dig_t));
+    apn_data_add_nm(w, w, n + 1, rp + 2 * m, 2 * h);
+    apn_data_sub_nm(w, w, n + 1, p, 2 * h);
+    apn_data_add_nm(rp + m, rp + m, n + h, w, n + 1);
 
-    apn_mul_karatsuba(&z0, &x0, &y0);
-    apn_mul_karatsuba(&z2, &x1, &y1);
-    // z1
-    apn_add(&t, &x0, &x1);
-    apn_add(&z1, &y0, &y1);
-    apn_mul_karatsuba(&z1, &z1, &t);
-    apn_add(&t, &z0, &z2);
+    apn_ws_pop(ws, 3 * h + n + 1);
+}
 
-    apn_sub(&z1, &z1, &t);
-    // shift and add to result
-    apn_shl(&z2, &z2, 2 * m);
-    apn_add(res, &z0, &z2);
-    apn_shl(&z1, &z1, m);
-    apn_add(res, res, &z1);
+// Evaluation and interpolation of the Toom algorithms work on values of
+// L = 2k + 2 digits in two's complement, so that the negative points need
+// no separate sign handling. All divisions in the interpolation are exact.
 
-    apn_clear_list(&x0, &x1, &y0, &y1, &z0, &z1, &z2, &t, NULL);
+// rp[0, n) = -rp[0, n) (mod base^n)
+static void apn_data_neg(ap_dig_t* rp, size_t n) {
+    for(size_t i = 0; i != n; ++i)
+        rp[i] = ~rp[i];
+    apn_data_add_1(rp, rp, n, 1);
 }
 
+// squares when both operands are the same digits
+static inline void apn_data_mul_or_sqr(ap_dig_t* rp, const ap_dig_t* ap, size_t an,
+                                       const ap_dig_t* bp, size_t bn, apn_ws_s* ws) {
+    if(ap == bp && an == bn)
+        apn_data_sqr(rp, ap, an, ws);
+    else
+        apn_data_mul(rp, ap, an, bp, bn, ws);
+}
+
+// rp[0, L) = product of the evaluations, negated if only one of them is negative
+static void apn_data_mul_toom_point(ap_dig_t* rp, const ap_dig_t* ap, const ap_dig_t* bp,
+                                    size_t k, bool neg, apn_ws_s* ws) {
+    apn_data_mul_or_sqr(rp, ap, k + 1, bp, k + 1, ws);
+    if(neg)
+        apn_data_neg(rp, 2 * k + 2);
+}
+
+// rp[0, k + 1) = x0 + 2 x1 + 4 x2 + ... + 2^(n-1) x(n-1), by Horner's rule,
+// parts are k digits except the last one with s digits
+static void apn_data_toom_eval_2(ap_dig_t* rp, const ap_dig_t* xp, size_t n,
+                                 size_t k, size_t s) {
+    memset(rp, 0, (k + 1) * sizeof(ap_dig_t));
+    memcpy(rp, xp + (n - 1) * k, s * sizeof(ap_dig_t));
+    for(size_t i = n - 1; i--;) {
+        apn_data_lshift(rp, rp, k + 1, 1);
+        apn_data_add_nm(rp, rp, k + 1, xp + i * k, k);
+    }
+}
+
+// rp[0, k + 1) = 2^(n-1) x0 + ... + 2 x(n-2) + x(n-1)
+static void apn_data_toom_eval_half(ap_dig_t* rp, const ap_dig_t* xp, size_t n,
+                                    size_t k, size_t s) {
+    memset(rp, 0, (k + 1) * sizeof(ap_dig_t));
+    memcpy(rp, xp, k * sizeof(ap_dig_t));
+    for(size_t i = 1; i != n; ++i) {
+        apn_data_lshift(rp, rp, k + 1, 1);
+        apn_data_add_nm(rp, rp, k + 1, xp + i * k, i + 1 == n ? s : k);
+    }
+}
+
+// pp[0, k + 1) = x(X), mp[0, k + 1) = |x(-X)| with X = 2^sh, returns whether
+// x(-X) < 0. The even and odd parts are summed separately by Horner's rule.
+static bool apn_data_toom_eval_pm(ap_dig_t* pp, ap_dig_t* mp, ap_dig_t* tp,
+                                  const ap_dig_t* xp, size_t n, size_t k, size_t s,
+                                  unsigned sh) {
+    memset(mp, 0, (k + 1) * sizeof(ap_dig_t));
+    memset(tp, 0, (k + 1) * sizeof(ap_dig_t));
+    for(size_t i = n; i--;) {
+        ap_dig_t* p = (i & 1) ? tp : mp;
+        apn_data_lshift(p, p, k + 1, 2 * sh);
+        apn_data_add_nm(p, p, k + 1, xp + i * k, i + 1 == n ? s : k);
+    }
+    apn_data_lshift(tp, tp, k + 1, sh);
+    apn_data_add_n(pp, mp, tp, k + 1);
+    return apn_data_absdiff(mp, mp, k + 1, tp, k + 1);
+}
+
+void apn_data_mul_toom33(ap_dig_t* rp, const ap_dig_t* ap, size_t an,
+                         const ap_dig_t* bp, size_t bn, apn_ws_s* ws) {
+    // Split operands into 3 parts of k digits, x = x2 B^2k + x1 B^k + x0, and
+    // evaluate the product polynomial r(X) = a(X)b(X) of degree 4 at points
+    // 0, 1, -1, 2 and infinity, then interpolate its coefficients, see
+    // Marco Bodrato, "Towards Optimal Toom-Cook Multiplication for Univariate
+    // and Multivariate Polynomials in Characteristic 2 and 0", 2007
+    // Squaring, with both operands the same digits, evaluates once.
+    size_t k = (an + 2) / 3;
+    bool sqr = (ap == bp && an == bn);
+    if(bn <= Macro_threshold(MUL_KARATSUBA) || !apn_data_mul_toom_fits(an, bn, 3)) {
+        if(sqr)
+            apn_data_sqr_karatsuba(rp, ap, an, ws);
+        else
+            apn_data_mul_karatsuba(rp, ap, an, bp, bn, ws);
+        return;
+    }
+    Macro_stats_tier(sqr ? APN_STATS_SQR_TOOM33 : APN_STATS_MUL_TOOM33);
+    size_t s = an - 2 * k, t = bn - 2 * k, L = 2 * k + 2;
+    ap_dig_t* pa = apn_ws_push(ws, 5 * (k + 1) + 3 * L);
+    ap_dig_t* pb = pa + k + 1;
+    ap_dig_t* ma = pb + k + 1;
+    ap_dig_t* mb = ma + k + 1;
+    ap_dig_t* et = mb + k + 1;
+    ap_dig_t* v1 = et + k + 1;
+    ap_dig_t* vm1 = v1 + L;
+    ap_dig_t* v2 = vm1 + L;
+    ap_dig_t *r0 = rp, *r4 = rp + 4 * k;
+
+    if(sqr)
+        pb = pa, mb = ma;
+
+    // r0 = a0b0, r4 = a2b2, in parallel to the points if enabled
+    bool par = apn_task_parallel(k);
+    struct apn_mul_task t0, t4;
+    apn_data_mul_fork(&t0, par, r0, ap, k, bp, k, ws);
+    apn_data_mul_fork(&t4, par, r4, ap + 2 * k, s, bp + 2 * k, t, ws);
+    // v1 = a(1)b(1), vm1 = a(-1)b(-1)
+    bool neg = apn_data_toom_eval_pm(pa, ma, et, ap, 3, k, s, 0);
+    if(!sqr)
+        neg ^= apn_data_toom_eval_pm(pb, mb, et, bp, 3, k, t, 0);
+    apn_data_mul_toom_point(vm1, ma, mb, k, neg && !sqr, ws);
+    apn_data_mul_toom_point(v1, pa, pb, k, false, ws);
+    // v2 = a(2)b(2)
+    apn_data_toom_eval_2(pa, ap, 3, k, s);
+    if(!sqr)
+        apn_data_toom_eval_2(pb, bp, 3, k, t);
+    apn_data_mul_toom_point(v2, pa, pb, k, false, ws);
+    apn_data_mul_join(&t0, par);
+    apn_data_mul_join(&t4, par);
+
+    // interpolation
+    apn_data_sub_n(v2, v2, vm1, L);
+    apn_data_divexact_1(v2, v2, L, 3); // (v2 - vm1) / 3 = r1 + r2 + 3r3 + 5r4
+    apn_data_sub_n(vm1, v1, vm1, L);
+    apn_data_rshift(vm1, vm1, L, 1); // (v1 - vm1) / 2 = r1 + r3
+    apn_data_sub_nm(v1, v1, L, r0, 2 * k); // v1 - r0 = r1 + r2 + r3 + r4
+    apn_data_sub_n(v2, v2, v1, L);
+    apn_data_rshift(v2, v2, L, 1);
+    apn_data_sub_nm(v2, v2, L, r4, s + t);
+    apn_data_sub_nm(v2, v2, L, r4, s + t); // r3
+    apn_data_sub_n(v1, v1, vm1, L);
+    apn_data_sub_nm(v1, v1, L, r4, s + t); // r2
+    apn_data_sub_n(vm1, vm1, v2, L); // r1
+
+    // r = r0 + r1 B^k + r2 B^2k + r3 B^3k + r4 B^4k
+    memset(rp + 2 * k, 0, 2 * k * sizeof(ap_dig_t));
+    const ap_dig_t* r[] = { vm1, v1, v2 };
+    for(size_t i = 0; i != 3; ++i)
+        apn_data_add_nm(rp + (i + 1) * k, rp + (i + 1) * k, an + bn - (i + 1) * k,
+                        r[i], apn_data_norm(r[i], L));
+
+    apn_ws_pop(ws, 5 * (k + 1) + 3 * L);
+}
+
+void apn_data_mul_toom44(ap_dig_t* rp, const ap_dig_t* ap, size_t an,
+                         const ap_dig_t* bp, size_t bn, apn_ws_s* ws) {
+    // Split operands into 4 parts of k digits, the product polynomial of
+    // degree 6 is evaluated at 0, 1, -1, 2, -2, 1/2 and infinity, the point
+    // 1/2 is scaled to 2^6 r(1/2) to keep it integral. Interpolation only
+    // needs exact divisions by 2^i, 3 and 5.
+    size_t k = (an + 3) / 4;
+    bool sqr = (ap == bp && an == bn);
+    if(bn <= Macro_threshold(MUL_KARATSUBA) || !apn_data_mul_toom_fits(an, bn, 4)) {
+        apn_data_mul_toom33(rp, ap, an, bp, bn, ws);
+        return;
+    }
+    Macro_stats_tier(sqr ? APN_STATS_SQR_TOOM44 : APN_STATS_MUL_TOOM44);
+    size_t s = an - 3 * k, t = bn - 3 * k, L = 2 * k + 2;
+    ap_dig_t* pa = apn_ws_push(ws, 5 * (k + 1) + 6 * L);
+    ap_dig_t* pb = pa + k + 1;
+    ap_dig_t* ma = pb + k + 1;
+    ap_dig_t* mb = ma + k + 1;
+    ap_dig_t* et = mb + k + 1;
+    ap_dig_t* v1 = et + k + 1;
+    ap_dig_t* vm1 = v1 + L;
+    ap_dig_t* v2 = vm1 + L;
+    ap_dig_t* vm2 = v2 + L;
+    ap_dig_t* vh = vm2 + L;
+    ap_dig_t* w = vh + L;
+    ap_dig_t *r0 = rp, *r6 = rp + 6 * k;
+
+    if(sqr)
+        pb = pa, mb = ma;
+
+    // r0 = a0b0, r6 = a3b3, in parallel to the points if enabled
+    bool par = apn_task_parallel(k);
+    struct apn_mul_task t0, t6;
+    apn_data_mul_fork(&t0, par, r0, ap, k, bp, k, ws);
+    apn_data_mul_fork(&t6, par, r6, ap + 3 * k, s, bp + 3 * k, t, ws);
+    // v1, vm1, v2, vm2
+    for(unsigned sh = 0; sh != 2; ++sh) {
+        bool neg = apn_data_toom_eval_pm(pa, ma, et, ap, 4, k, s, sh);
+        if(!sqr)
+            neg ^= apn_data_toom_eval_pm(pb, mb, et, bp, 4, k, t, sh);
+        apn_data_mul_toom_point(sh ? vm2 : vm1, ma, mb, k, neg && !sqr, ws);
+        apn_data_mul_toom_point(sh ? v2 : v1, pa, pb, k, false, ws);
+    }
+    // vh = 2^6 r(1/2)
+    apn_data_toom_eval_half(pa, ap, 4, k, s);
+    if(!sqr)
+        apn_data_toom_eval_half(pb, bp, 4, k, t);
+    apn_data_mul_toom_point(vh, pa, pb, k, false, ws);
+    apn_data_mul_join(&t0, par);
+    apn_data_mul_join(&t6, par);
+
+    // interpolation
+    apn_data_sub_n(vm1, v1, vm1, L);
+    apn_data_rshift(vm1, vm1, L, 1); // r1 + r3 + r5
+    apn_data_sub_n(v1, v1, vm1, L);
+    apn_data_sub_nm(v1, v1, L, r0, 2 * k);
+    apn_data_sub_nm(v1, v1, L, r6, s + t); // r2 + r4
+    apn_data_sub_n(vm2, v2, vm2, L);
+    apn_data_rshift(vm2, vm2, L, 2); // r1 + 4r3 + 16r5
+    apn_data_sub_n(v2, v2, vm2, L);
+    apn_data_sub_n(v2, v2, vm2, L);
+    apn_data_sub_nm(v2, v2, L, r0, 2 * k);
+    memset(w, 0, L * sizeof(ap_dig_t));
+    w[s + t] = apn_data_lshift(w, r6, s + t, 6);
+    apn_data_sub_n(v2, v2, w, L);
+    apn_data_rshift(v2, v2, L, 2); // r2 + 4r4
+    apn_data_sub_n(v2, v2, v1, L);
+    apn_data_divexact_1(v2, v2, L, 3); // r4
+    apn_data_sub_n(v1, v1, v2, L); // r2
+    // vh - 2^6 r0 - r6 - 2^4 r2 - 2^2 r4 = 2(16r1 + 4r3 + r5)
+    memset(w, 0, L * sizeof(ap_dig_t));
+    w[2 * k] = apn_data_lshift(w, r0, 2 * k, 6);
+    apn_data_sub_n(vh, vh, w, L);
+    apn_data_sub_nm(vh, vh, L, r6, s + t);
+    apn_data_lshift(w, v1, L, 2);
+    apn_data_add_n(w, w, v2, L);
+    apn_data_lshift(w, w, L, 2);
+    apn_data_sub_n(vh, vh, w, L);
+    apn_data_rshift(vh, vh, L, 1); // 16r1 + 4r3 + r5
+    apn_data_sub_n(vm2, vm2, vm1, L);
+    apn_data_divexact_1(vm2, vm2, L, 3); // r3 + 5r5
+    apn_data_sub_n(vh, vh, vm1, L);
+    apn_data_divexact_1(vh, vh, L, 3); // 5r1 + r3
+    apn_data_mul_1(vm1, vm1, L, 5);
+    apn_data_sub_n(vm1, vm1, vm2, L);
+    apn_data_sub_n(vm1, vm1, vh, L);
+    apn_data_divexact_1(vm1, vm1, L, 3); // r3
+    apn_data_sub_n(vm2, vm2, vm1, L);
+    apn_data_divexact_1(vm2, vm2, L, 5); // r5
+    apn_data_sub_n(vh, vh, vm1, L);
+    apn_data_divexact_1(vh, vh, L, 5); // r1
+
+    // r = r0 + r1 B^k + ... + r6 B^6k
+    memset(rp + 2 * k, 0, 4 * k * sizeof(ap_dig_t));
+    const ap_dig_t* r[] = { vh, v1, vm1, v2, vm2 };
+    for(size_t i = 0; i != 5; ++i)
+        apn_data_add_nm(rp + (i + 1) * k, rp + (i + 1) * k, an + bn - (i + 1) * k,
+                        r[i], apn_data_norm(r[i], L));
+
+    apn_ws_pop(ws, 5 * (k + 1) + 6 * L);
+}
+
+static void apn_data_mul_basecase_ws(ap_dig_t* rp, const ap_dig_t* ap, size_t an,
+                                     const ap_dig_t* bp, size_t bn, apn_ws_s* ws) {
+    (void)ws;
+    apn_data_mul_basecase(rp, ap, an, bp, bn);
+}
+
+static size_t apn_data_mul_basecase_itch(size_t an, size_t bn) {
+    (void)an, (void)bn;
+    return 0;
+}
+
+// squaring kernels with the multiplication signature, bp is ap
+static void apn_data_sqr_basecase_ws(ap_dig_t* rp, const ap_dig_t* ap, size_t an,
+                                     const ap_dig_t* bp, size_t bn, apn_ws_s* ws) {
+    (void)bp, (void)bn, (void)ws;
+    apn_data_sqr_basecase(rp, ap, an);
+}
+
+static void apn_data_sqr_karatsuba_ws(ap_dig_t* rp, const ap_dig_t* ap, size_t an,
+                                      const ap_dig_t* bp, size_t bn, apn_ws_s* ws) {
+    (void)bp, (void)bn;
+    apn_data_sqr_karatsuba(rp, ap, an, ws);
+}
+
+// runs `mul` on the digits of the operands, the result is built in the
+// workspace if it aliases an operand.
+static void apn_mul_impl(apn_s* res, const apn_s* op1, const apn_s* op2, apn_ws_s* ws,
+                         apn_data_mul_fn mul, apn_data_itch_fn itch) {
+    if(op1->_size < op2->_size)
+        Macro_swap_val(const apn_s*, op1, op2);
+    size_t an = op1->_size, bn = op2->_size, rn = an + bn;
+    bool alias = (res == op1 || res == op2);
+
+    apn_ws_reserve(ws, itch(an, bn) + (alias ? rn : 0));
+    if(alias) {
+        ap_dig_t* rp = apn_ws_push(ws, rn);
+        mul(rp, op1->_data, an, op2->_data, bn, ws);
+        apn_assign_data(res, rp, rn);
+        apn_ws_pop(ws, rn);
+    } else {
+        apn_reserve(res, rn);
+        mul(res->_data, op1->_data, an, op2->_data, bn, ws);
+        res->_size = apn_data_norm(res->_data, rn);
+    }
+}
+
+size_t apn_mul_ws_size(size_t n1, size_t n2) {
+    if(n1 < n2)
+        Macro_swap_val(size_t, n1, n2);
+    return apn_data_mul_itch(n1, n2) + n1 + n2;
+}
+
+void apn_mul_ws(apn_s* res, const apn_s* op1, const apn_s* op2, apn_ws_s* ws) {
+    Macro_stats_begin(APN_STATS_MUL, Macro_max(op1->_size, op2->_size));
+    apn_mul_impl(res, op1, op2, ws, apn_data_mul, apn_data_mul_itch);
+    Macro_stats_end();
+}
+
+void apn_mul(apn_s* res, const apn_s* op1, const apn_s* op2) {
+    apn_ws_s ws;
+    apn_ws_init(&ws);
+    apn_mul_ws(res, op1, op2, &ws);
+    apn_ws_clear(&ws);
+}
+
+void apn_mul_dig(apn_s* res, const apn_s* op, ap_dig_t dig) {
+    size_t n = op->_size;
+    apn_reserve(res, n + 1);
+    ap_dig_t carry = apn_data_mul_1(res->_data, op->_data, n, dig);
+    res->_data[n] = carry;
+    res->_size = apn_data_norm(res->_data, n + 1);
+}
+
+void apn_mul_basecase(apn_s* res, const apn_s* op1, const apn_s* op2) {
+    apn_ws_s ws;
+    apn_ws_init(&ws);
+    apn_mul_impl(res, op1, op2, &ws, apn_data_mul_basecase_ws, apn_data_mul_basecase_itch);
+    apn_ws_clear(&ws);
+}
+
+void apn_mul_karatsuba(apn_s* res, const apn_s* op1, const apn_s* op2) {
+    apn_ws_s ws;
+    apn_ws_init(&ws);
+    apn_mul_impl(res, op1, op2, &ws, apn_data_mul_karatsuba, apn_data_mul_itch);
+    apn_ws_clear(&ws);
+}
+
+void apn_mul_toom33(apn_s* res, const apn_s* op1, const apn_s* op2) {
+    apn_ws_s ws;
+    apn_ws_init(&ws);
+    apn_mul_impl(res, op1, op2, &ws, apn_data_mul_toom33, apn_data_mul_itch);
+    apn_ws_clear(&ws);
+}
+
+void apn_mul_toom44(apn_s* res, const apn_s* op1, const apn_s* op2) {
+    apn_ws_s ws;
+    apn_ws_init(&ws);
+    apn_mul_impl(res, op1, op2, &ws, apn_data_mul_toom44, apn_data_mul_itch);
+    apn_ws_clear(&ws);
+}
+
+void apn_mul_fft(apn_s* res, const apn_s* op1, const apn_s* op2) {
+    apn_ws_s ws;
+    apn_ws_init(&ws);
+    apn_mul_impl(res, op1, op2, &ws, apn_data_mul_fft, apn_data_mul_fft_itch);
+    apn_ws_clear(&ws);
+}
+
+size_t apn_sqr_ws_size(size_t n) {
+    return apn_data_sqr_itch(n) + 2 * n;
+}
+
+void apn_sqr_ws(apn_s* res, const apn_s* op, apn_ws_s* ws) {
+    Macro_stats_begin(APN_STATS_SQR, op->_size);
+    apn_mul_impl(res, op, op, ws, apn_data_mul, apn_data_mul_itch);
+    Macro_stats_end();
+}
+
+void apn_sqr(apn_s* res, const apn_s* op) {
+    apn_ws_s ws;
+    apn_ws_init(&ws);
+    apn_sqr_ws(res, op, &ws);
+    apn_ws_clear(&ws);
+}
+
+void apn_sqr_basecase(apn_s* res, const apn_s* op) {
+    apn_ws_s ws;
+    apn_ws_init(&ws);
+    apn_mul_impl(res, op, op, &ws, apn_data_sqr_basecase_ws, apn_data_mul_basecase_itch);
+    apn_ws_clear(&ws);
+}
+
+void apn_sqr_karatsuba(apn_s* res, const apn_s* op) {
+    apn_ws_s ws;
+    apn_ws_init(&ws);
+    apn_mul_impl(res, op, op, &ws, apn_data_sqr_karatsuba_ws, apn_data_mul_itch);
+    apn_ws_clear(&ws);
+}
+
+void apn_sqr_toom33(apn_s* res, const apn_s* op) {
+    apn_mul_toom33(res, op, op);
+}
+
+void apn_sqr_toom44(apn_s* res, const apn_s* op) {
+    apn_mul_toom44(res, op, op);
+}
+
+void apn_sqr_fft(apn_s* res, const apn_s* op) {
+    apn_mul_fft(res, op, op);
+}
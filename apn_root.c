@@ -0,0 +1,282 @@
+#include "apn.h"
+#include "ap_impl.h"
+
+// Square roots by Paul Zimmermann, "Karatsuba Square Root", 1999: the root
+// of the upper half gives the upper half of the root, a division by twice
+// that the lower half. k-th roots by Newton's iteration started from the
+// root of the leading digits, so that each level runs at twice the
+// precision of the one below. The perfect power tests rule out most numbers
+// by residues before taking a root.
+
+// digits [start, start + n) of o
+static void apn_root_part(apn_s* res, const apn_s* o, size_t start, size_t n) {
+    apn_assign_part_zero(res, o, start, n);
+    res->_size = apn_data_norm(res->_data, res->_size);
+}
+
+// [sqrt(a)] of a two digit a, Newton's iteration from above. The root is at
+// least a.hi, so the divisions fit as long as it is below the estimate.
+static ap_dig_t ap_dig2_sqrt(struct ap_dig_pair a) {
+    ap_dig_t x = AP_DIG_MAX;
+    while(a.hi < x) {
+        ap_dig_t q = ap_dig_div_2d1t1(a, x);
+        if(q >= x)
+            break;
+        x = (x >> 1) + (q >> 1) + (x & q & 1); // [(x + q) / 2]
+    }
+    return x;
+}
+
+// s = [sqrt(a)], r = a - s^2 for a of 2n digits with the top one at least
+// base / 4. With a = ah base^2l + a1 base^l + a0 and (s', r') the root of
+// ah: q = [(r' base^l + a1) / 2s'], u the remainder, s = s' base^l + q and
+// r = u base^l + a0 - q^2, which is at most once negative and then fixed by
+// s - 1.
+static void apn_sqrtrem_norm(apn_s* s, apn_s* r, const apn_s* a, size_t n, apn_ws_s* ws) {
+    if(n == 1) {
+        struct ap_dig_pair x = { .lo = a->_data[0], .hi = a->_data[1] };
+        ap_dig_t y = ap_dig2_sqrt(x);
+        struct ap_dig_pair y2 = ap_dig_mul(y, y);
+        ap_dig_t d[2];
+        ap_dig_subb(ap_dig_subb(0, x.lo, y2.lo, &d[0]), x.hi, y2.hi, &d[1]);
+        apn_assign_dig(s, y);
+        apn_assign_data(r, d, 2);
+        return;
+    }
+    size_t l = n / 2, h = n - l;
+    apn_s t, u, q, d;
+    apn_init_list(&t, &u, &q, &d, NULL);
+    apn_shr(&t, a, 2 * l);
+    apn_sqrtrem_norm(s, r, &t, h, ws);
+    apn_shl(&t, r, l);
+    apn_root_part(&u, a, l, l);
+    apn_add_inplace(&t, &u);
+    apn_add(&d, s, s);
+    apn_div_ws(&q, &u, &t, &d, ws);
+    apn_shl(s, s, l);
+    apn_add_inplace(s, &q);
+    apn_shl(r, &u, l);
+    apn_root_part(&u, a, 0, l);
+    apn_add_inplace(r, &u);
+    apn_sqr_ws(&t, &q, ws);
+    if(apn_cmp(r, &t) < 0) {
+        apn_add_inplace(r, s);
+        apn_add_inplace(r, s);
+        apn_sub_dig(r, r, 1);
+        apn_sub_dig(s, s, 1);
+    }
+    apn_sub(r, r, &t);
+    apn_clear_list(&t, &u, &q, &d, NULL);
+}
+
+void apn_sqrtrem(apn_s* res, apn_s* rem, const apn_s* op) {
+    if(apn_is_zero(op)) {
+        apn_assign_dig(res, 0);
+        if(rem)
+            apn_assign_dig(rem, 0);
+        return;
+    }
+    Macro_stats_begin(APN_STATS_ROOT, op->_size);
+    // an even shift to 2n digits with one of the top two bits set, the root
+    // is shifted by half of it
+    size_t n = (op->_size + 1) / 2, sh = (2 * n * AP_DIG_BIT - apn_bitlen(op)) & ~(size_t)1;
+    apn_ws_s ws;
+    apn_ws_init(&ws);
+    apn_s a, s, r;
+    apn_init_list(&a, &s, &r, NULL);
+    apn_bit_shl(&a, op, sh);
+    apn_sqrtrem_norm(&s, &r, &a, n, &ws);
+    if(sh) {
+        apn_bit_shr(&s, &s, sh / 2);
+        if(rem) {
+            apn_sqr_ws(&a, &s, &ws);
+            apn_sub(&r, op, &a);
+        }
+    }
+    if(rem)
+        apn_swap(rem, &r);
+    apn_swap(res, &s);
+    apn_clear_list(&a, &s, &r, NULL);
+    apn_ws_clear(&ws);
+    Macro_stats_end();
+}
+
+// x = [op^(1/k)] and p = x^(k-1) for op >= 2 of b bits, k >= 3. Newton's
+// iteration x' = [((k - 1) x + [op / x^(k-1)]) / k] decreases from any x
+// above the root down to it and stays there. It starts from r + 1 shifted
+// by j bits for the root r of op shifted by kj bits, which has half the
+// bits of x, so one or two steps are left.
+static void apn_root_newton(apn_s* x, apn_s* p, const apn_s* op, size_t b, ap_dig_t k,
+                            apn_ws_s* ws) {
+    size_t rb = (b - 1) / k + 1; // the root is below 2^rb
+    if(rb <= AP_DIG_BIT)
+        apn_assign_dig(x, rb == AP_DIG_BIT ? AP_DIG_MAX : ((ap_dig_t)1 << rb) - 1);
+    else {
+        size_t j = rb / 2;
+        apn_s t;
+        apn_init(&t);
+        apn_bit_shr(&t, op, k * j);
+        apn_root_newton(x, p, &t, b - k * j, k, ws);
+        apn_add_dig(x, x, 1);
+        apn_bit_shl(x, x, j);
+        apn_clear(&t);
+    }
+    apn_s q, d;
+    apn_init_list(&q, &d, NULL);
+    apn_assign_dig(&d, k);
+    for(;;) {
+        apn_exp_dig(p, x, k - 1);
+        apn_div_ws(&q, NULL, op, p, ws);
+        if(apn_cmp(&q, x) >= 0)
+            break;
+        apn_addmul_dig(&q, x, k - 1);
+        apn_div_ws(x, NULL, &q, &d, ws);
+    }
+    apn_clear_list(&q, &d, NULL);
+}
+
+void apn_rootrem(apn_s* res, apn_s* rem, const apn_s* op, ap_dig_t k) {
+    assert(k >= 1);
+    if(k == 2) {
+        apn_sqrtrem(res, rem, op);
+        return;
+    }
+    size_t b = apn_bitlen(op);
+    if(k == 1 || b <= 1) { // op, 0 and 1 are their own roots
+        apn_assign(res, op);
+        if(rem)
+            apn_assign_dig(rem, 0);
+        return;
+    }
+    Macro_stats_begin(APN_STATS_ROOT, op->_size);
+    apn_ws_s ws;
+    apn_ws_init(&ws);
+    apn_s x, p;
+    apn_init_list(&x, &p, NULL);
+    if(b <= k) { // op < 2^k
+        apn_assign_dig(&x, 1);
+        apn_assign_dig(&p, 1);
+    } else
+        apn_root_newton(&x, &p, op, b, k, &ws);
+    if(rem) {
+        apn_mul_ws(&p, &p, &x, &ws);
+        apn_sub(rem, op, &p);
+    }
+    apn_swap(res, &x);
+    apn_clear_list(&x, &p, NULL);
+    apn_ws_clear(&ws);
+    Macro_stats_end();
+}
+
+// whether x is a square modulo m, m is small
+static bool ap_dig_is_square_mod(ap_dig_t x, ap_dig_t m) {
+    for(ap_dig_t y = 0; y <= m / 2; ++y)
+        if(y * y % m == x)
+            return true;
+    return false;
+}
+
+// x^e mod m, m < 2^(AP_DIG_BIT / 2)
+static ap_dig_t ap_dig_powmod(ap_dig_t x, ap_dig_t e, ap_dig_t m) {
+    ap_dig_t r = 1;
+    for(; e; e >>= 1, x = x * x % m)
+        if(e & 1)
+            r = r * x % m;
+    return r;
+}
+
+static bool ap_dig_is_prime(ap_dig_t n) {
+    if(n < 4)
+        return n >= 2;
+    if(!(n & 1))
+        return false;
+    for(ap_dig_t d = 3; d * d <= n; d += 2)
+        if(n % d == 0)
+            return false;
+    return true;
+}
+
+bool apn_perfect_square(const apn_s* op) {
+    // squares modulo 64, and modulo 63, 65, 11, 17, 19 and 23 from one
+    // remainder by their product, about 1 in 800 other numbers pass all
+    static const ap_dig_t mods[] = { 63, 65, 11, 17, 19, 23 };
+    if(!ap_dig_is_square_mod(op->_data[0] & 63, 64))
+        return false;
+    ap_dig_t r = apn_mod_dig(op, 63 * 65 * 11 * 17 * 19 * 23);
+    for(size_t i = 0; i != sizeof(mods) / sizeof(mods[0]); ++i)
+        if(!ap_dig_is_square_mod(r % mods[i], mods[i]))
+            return false;
+    apn_s s, rem;
+    apn_init_list(&s, &rem, NULL);
+    apn_sqrtrem(&s, &rem, op);
+    bool square = apn_is_zero(&rem);
+    apn_clear_list(&s, &rem, NULL);
+    return square;
+}
+
+// whether op, not divisible by primes q = 1 (mod p), can be a p-th power:
+// op^((q-1)/p) = 1 (mod q) for up to two such q, a random number passes
+// each by 1 in p
+static bool apn_root_power_residue(const apn_s* op, ap_dig_t p) {
+    int tried = 0;
+    for(ap_dig_t q = 2 * p + 1; tried != 2 && q < ((ap_dig_t)1 << AP_DIG_BIT / 2); q += 2 * p) {
+        if(!ap_dig_is_prime(q))
+            continue;
+        ++tried;
+        ap_dig_t r = apn_mod_dig(op, q);
+        if(r && ap_dig_powmod(r, (q - 1) / p, q) != 1)
+            return false;
+    }
+    return true;
+}
+
+// the p-th root of an odd a modulo 2^AP_DIG_BIT for an odd p, unique.
+// Newton's iteration y' = y - (y^p - a) / (p y^(p-1)) doubles the bits
+// that are right from y = 1, which is right modulo 2.
+static ap_dig_t ap_dig_root_2adic(ap_dig_t a, ap_dig_t p) {
+    ap_dig_t y = 1;
+    for(int i = 0; i != 6; ++i) {
+        ap_dig_t t = 1; // y^(p-1)
+        for(ap_dig_t e = p - 1, x = y; e; e >>= 1, x *= x)
+            if(e & 1)
+                t *= x;
+        y -= (t * y - a) * ap_dig_binvert(p * t);
+    }
+    return y;
+}
+
+bool apn_perfect_power(const apn_s* op) {
+    if(apn_cmp_dig(op, 1) <= 0 || apn_perfect_square(op))
+        return true;
+    // x^k for k = ab is (x^a)^b, the odd primes p are left. op = 2^v m for
+    // an odd m is a p-th power if p divides v and m is one.
+    size_t v = 0;
+    while(!op->_data[v / AP_DIG_BIT])
+        v += AP_DIG_BIT;
+    v += ap_dig_ctz(op->_data[v / AP_DIG_BIT]);
+    size_t b = apn_bitlen(op), top = v ? Macro_min(v, b - 1) : b - 1;
+    bool power = false;
+    apn_s m, x, r;
+    apn_init_list(&m, &x, &r, NULL);
+    apn_bit_shr(&m, op, v);
+    size_t mb = b - v;
+    for(ap_dig_t p = 3; p <= top && !power; p += 2) {
+        if(v % p || !ap_dig_is_prime(p))
+            continue;
+        size_t rb = (mb - 1) / p + 1; // the bits of a root of m
+        if(rb <= AP_DIG_BIT) {
+            // a root of one digit is the one modulo 2^AP_DIG_BIT
+            ap_dig_t y = ap_dig_root_2adic(m._data[0], p);
+            if(ap_dig_msb(y) + 1 != rb)
+                continue;
+            apn_assign_dig(&x, y);
+            apn_exp_dig(&r, &x, p);
+            power = apn_cmp(&r, &m) == 0;
+        } else if(apn_root_power_residue(&m, p)) {
+            apn_rootrem(&x, &r, &m, p);
+            power = apn_is_zero(&r);
+        }
+    }
+    apn_clear_list(&m, &x, &r, NULL);
+    return power;
+}
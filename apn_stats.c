@@ -0,0 +1,228 @@
+#include "apn.h"
+#include "apn_stats.h"
+#include "ap_impl.h"
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+// Every thread counts in a block of its own, registered on its first count
+// and kept after it exits, so the hooks never wait for a lock. The counters
+// are atomics written only by their thread, without read-modify-write. The
+// trace events go to chunks that never move, each event published by the
+// count of its chunk, so that a dump can read them while the thread runs.
+
+static const char* const apn_stats_op_names[APN_STATS_OP_COUNT] = {
+    "add", "sub", "mul", "sqr", "div", "exp", "modexp", "gcd", "root", "to_str", "assign_str", "realloc",
+};
+
+static const char* const apn_stats_tier_names[APN_STATS_TIER_COUNT] = {
+    "mul_basecase", "mul_karatsuba", "mul_toom33", "mul_toom44", "mul_fft",
+    "sqr_basecase", "sqr_karatsuba", "sqr_toom33", "sqr_toom44", "sqr_fft",
+    "div_basecase", "div_bz", "div_newton", "divexact_basecase", "divexact_newton",
+    "modexp_mont", "modexp_barrett", "gcd_lehmer", "gcd_hgcd",
+    "to_str_basecase", "to_str_dc", "assign_str_basecase", "assign_str_dc",
+};
+
+struct apn_trace_event {
+    enum apn_stats_op op;
+    size_t            size;
+    uint64_t          start, dur; // ns
+};
+
+#define APN_TRACE_CHUNK 1024
+
+struct apn_trace_chunk {
+    struct apn_trace_event          events[APN_TRACE_CHUNK];
+    atomic_size_t                   count;
+    struct apn_trace_chunk* _Atomic next;
+};
+
+struct apn_stats_thread {
+    struct {
+        atomic_uint_least64_t calls;
+        atomic_uint_least64_t ns;
+        atomic_uint_least64_t sizes[APN_STATS_BUCKETS];
+    } op[APN_STATS_OP_COUNT];
+    atomic_uint_least64_t    tier[APN_STATS_TIER_COUNT];
+    atomic_uint_least64_t    allocs, alloc_bytes, reallocs, realloc_bytes;
+    struct apn_trace_chunk* _Atomic events; // the first chunk
+    struct apn_trace_chunk*  last; // the one written, by the thread only
+    unsigned                 tid;
+    struct apn_stats_thread* next;
+};
+
+static pthread_mutex_t apn_stats_lock = PTHREAD_MUTEX_INITIALIZER; // guards the list
+static struct apn_stats_thread* apn_stats_threads;
+static atomic_bool apn_stats_tracing;
+static inline void apn_stats_add(atomic_uint_least64_t* c, uint64_t v) {
+    atomic_store_explicit(c, atomic_load_explicit(c, memory_order_relaxed) + v,
+                          memory_order_relaxed);
+}
+
+static inline uint64_t apn_stats_get(atomic_uint_least64_t* c) {
+    return atomic_load_explicit(c, memory_order_relaxed);
+}
+
+#if defined(APN_STATS)
+static unsigned apn_stats_thread_count; // ids of the trace tracks
+static _Thread_local struct apn_stats_thread* apn_stats_self;
+
+static struct apn_stats_thread* apn_stats_thread(void) {
+    struct apn_stats_thread* t = apn_stats_self;
+    if(t)
+        return t;
+    t = calloc(1, sizeof(struct apn_stats_thread));
+    pthread_mutex_lock(&apn_stats_lock);
+    t->tid = ++apn_stats_thread_count;
+    t->next = apn_stats_threads;
+    apn_stats_threads = t;
+    pthread_mutex_unlock(&apn_stats_lock);
+    return apn_stats_self = t;
+}
+
+static uint64_t apn_stats_now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000 + (uint64_t)ts.tv_nsec;
+}
+
+struct apn_stats_scope apn_stats_enter(enum apn_stats_op op, size_t size) {
+    struct apn_stats_scope scope = { .op = op, .size = size, .start = apn_stats_now() };
+    return scope;
+}
+
+void apn_stats_leave(const struct apn_stats_scope* scope) {
+    uint64_t dur = apn_stats_now() - scope->start;
+    struct apn_stats_thread* t = apn_stats_thread();
+    size_t bucket = Macro_min(ap_dig_msb(scope->size), (size_t)APN_STATS_BUCKETS - 1);
+    apn_stats_add(&t->op[scope->op].calls, 1);
+    apn_stats_add(&t->op[scope->op].ns, dur);
+    apn_stats_add(&t->op[scope->op].sizes[bucket], 1);
+    if(!atomic_load_explicit(&apn_stats_tracing, memory_order_relaxed))
+        return;
+    struct apn_trace_chunk* c = t->last;
+    size_t n = c ? atomic_load_explicit(&c->count, memory_order_relaxed) : 0;
+    if(!c || n == APN_TRACE_CHUNK) {
+        // the next chunk is kept from before a reset or a new one
+        struct apn_trace_chunk* next = c ? atomic_load_explicit(&c->next, memory_order_relaxed)
+                                         : NULL;
+        if(!next) {
+            next = calloc(1, sizeof(struct apn_trace_chunk));
+            if(c)
+                atomic_store_explicit(&c->next, next, memory_order_release);
+            else
+                atomic_store_explicit(&t->events, next, memory_order_release);
+        }
+        t->last = c = next;
+        n = 0;
+    }
+    struct apn_trace_event e = { .op = scope->op, .size = scope->size,
+                                 .start = scope->start, .dur = dur };
+    c->events[n] = e;
+    atomic_store_explicit(&c->count, n + 1, memory_order_release);
+}
+
+void apn_stats_count_tier(enum apn_stats_tier tier) {
+    apn_stats_add(&apn_stats_thread()->tier[tier], 1);
+}
+
+void apn_stats_count_alloc(size_t bytes, bool resized) {
+    struct apn_stats_thread* t = apn_stats_thread();
+    apn_stats_add(resized ? &t->reallocs : &t->allocs, 1);
+    apn_stats_add(resized ? &t->realloc_bytes : &t->alloc_bytes, bytes);
+}
+#endif
+
+bool apn_stats_enabled(void) {
+#if defined(APN_STATS)
+    return true;
+#else
+    return false;
+#endif
+}
+
+void apn_stats_snapshot(apn_stats_s* stats) {
+    memset(stats, 0, sizeof(apn_stats_s));
+    pthread_mutex_lock(&apn_stats_lock);
+    for(struct apn_stats_thread* t = apn_stats_threads; t; t = t->next) {
+        for(int i = 0; i != APN_STATS_OP_COUNT; ++i) {
+            stats->op[i].calls += apn_stats_get(&t->op[i].calls);
+            stats->op[i].ns += apn_stats_get(&t->op[i].ns);
+            for(int j = 0; j != APN_STATS_BUCKETS; ++j)
+                stats->op[i].sizes[j] += apn_stats_get(&t->op[i].sizes[j]);
+        }
+        for(int i = 0; i != APN_STATS_TIER_COUNT; ++i)
+            stats->tier[i] += apn_stats_get(&t->tier[i]);
+        stats->allocs += apn_stats_get(&t->allocs);
+        stats->alloc_bytes += apn_stats_get(&t->alloc_bytes);
+        stats->reallocs += apn_stats_get(&t->reallocs);
+        stats->realloc_bytes += apn_stats_get(&t->realloc_bytes);
+    }
+    pthread_mutex_unlock(&apn_stats_lock);
+}
+
+void apn_stats_reset(void) {
+    pthread_mutex_lock(&apn_stats_lock);
+    for(struct apn_stats_thread* t = apn_stats_threads; t; t = t->next) {
+        for(int i = 0; i != APN_STATS_OP_COUNT; ++i) {
+            atomic_store(&t->op[i].calls, 0);
+            atomic_store(&t->op[i].ns, 0);
+            for(int j = 0; j != APN_STATS_BUCKETS; ++j)
+                atomic_store(&t->op[i].sizes[j], 0);
+        }
+        for(int i = 0; i != APN_STATS_TIER_COUNT; ++i)
+            atomic_store(&t->tier[i], 0);
+        atomic_store(&t->allocs, 0);
+        atomic_store(&t->alloc_bytes, 0);
+        atomic_store(&t->reallocs, 0);
+        atomic_store(&t->realloc_bytes, 0);
+        // the chunks stay, the thread writes into them from the start
+        for(struct apn_trace_chunk* c = t->events; c; c = c->next)
+            atomic_store(&c->count, 0);
+        t->last = t->events;
+    }
+    pthread_mutex_unlock(&apn_stats_lock);
+}
+
+const char* apn_stats_op_name(enum apn_stats_op op) {
+    assert(op < APN_STATS_OP_COUNT);
+    return apn_stats_op_names[op];
+}
+
+const char* apn_stats_tier_name(enum apn_stats_tier tier) {
+    assert(tier < APN_STATS_TIER_COUNT);
+    return apn_stats_tier_names[tier];
+}
+
+void apn_stats_trace(bool on) {
+    atomic_store(&apn_stats_tracing, on);
+}
+
+bool apn_stats_trace_dump(const char* path) {
+    FILE* f = fopen(path, "w");
+    if(!f)
+        return false;
+    // complete events, times in microseconds
+    fprintf(f, "{\"traceEvents\":[");
+    const char* sep = "\n";
+    pthread_mutex_lock(&apn_stats_lock);
+    for(struct apn_stats_thread* t = apn_stats_threads; t; t = t->next) {
+        struct apn_trace_chunk* c = atomic_load_explicit(&t->events, memory_order_acquire);
+        for(; c; c = atomic_load_explicit(&c->next, memory_order_acquire)) {
+            size_t n = atomic_load_explicit(&c->count, memory_order_acquire);
+            for(size_t i = 0; i != n; ++i) {
+                const struct apn_trace_event* e = &c->events[i];
+                fprintf(f, "%s{\"name\":\"%s\",\"ph\":\"X\",\"pid\":1,\"tid\":%u,"
+                           "\"ts\":%.3f,\"dur\":%.3f,\"args\":{\"size\":%zu}}",
+                        sep, apn_stats_op_names[e->op], t->tid, e->start / 1e3,
+                        e->dur / 1e3, e->size);
+                sep = ",\n";
+            }
+        }
+    }
+    pthread_mutex_unlock(&apn_stats_lock);
+    fprintf(f, "\n]}\n");
+    return fclose(f) == 0;
+}
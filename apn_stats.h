@@ -0,0 +1,93 @@
+#ifndef HOPE_BIGNUM_APN_STATS_H
+#define HOPE_BIGNUM_APN_STATS_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+// Counters of the library built with APN_STATS defined, per thread and
+// summed up by apn_stats_snapshot. Without APN_STATS nothing is counted,
+// the hooks compile to nothing and the snapshots are all zero.
+
+// entry points, timed including everything they call
+enum apn_stats_op {
+    APN_STATS_ADD, // apn_add
+    APN_STATS_SUB, // apn_sub
+    APN_STATS_MUL, // apn_mul, apn_mul_ws
+    APN_STATS_SQR, // apn_sqr, apn_sqr_ws
+    APN_STATS_DIV, // apn_div, apn_div_ws, apn_divexact
+    APN_STATS_EXP, // apn_exp, apn_exp_dig, apn_exp_bysqr
+    APN_STATS_MODEXP, // each modexp by a Montgomery or Barrett context
+    APN_STATS_GCD, // apn_gcd, apz_gcdext, apn_invert
+    APN_STATS_ROOT, // apn_sqrtrem, apn_rootrem
+    APN_STATS_TO_STR, // apn_to_str
+    APN_STATS_ASSIGN_STR, // apn_assign_str, the size is in characters
+    APN_STATS_REALLOC, // apn_realloc, the size is the new capacity
+    APN_STATS_OP_COUNT
+};
+
+// algorithms, counted each time one runs, levels of a recursion included
+enum apn_stats_tier {
+    APN_STATS_MUL_BASECASE,
+    APN_STATS_MUL_KARATSUBA,
+    APN_STATS_MUL_TOOM33,
+    APN_STATS_MUL_TOOM44,
+    APN_STATS_MUL_FFT,
+    APN_STATS_SQR_BASECASE,
+    APN_STATS_SQR_KARATSUBA,
+    APN_STATS_SQR_TOOM33,
+    APN_STATS_SQR_TOOM44,
+    APN_STATS_SQR_FFT,
+    APN_STATS_DIV_BASECASE,
+    APN_STATS_DIV_BZ,
+    APN_STATS_DIV_NEWTON,
+    APN_STATS_DIVEXACT_BASECASE,
+    APN_STATS_DIVEXACT_NEWTON,
+    APN_STATS_MODEXP_MONT,
+    APN_STATS_MODEXP_BARRETT,
+    APN_STATS_GCD_LEHMER,
+    APN_STATS_GCD_HGCD,
+    APN_STATS_TO_STR_BASECASE,
+    APN_STATS_TO_STR_DC,
+    APN_STATS_ASSIGN_STR_BASECASE,
+    APN_STATS_ASSIGN_STR_DC,
+    APN_STATS_TIER_COUNT
+};
+
+// operand sizes in digits by powers of two, bucket i counts [2^i, 2^(i+1))
+#define APN_STATS_BUCKETS 40
+
+struct arbitrary_precision_stats {
+    struct {
+        uint64_t calls;
+        uint64_t ns; // wall time
+        uint64_t sizes[APN_STATS_BUCKETS];
+    } op[APN_STATS_OP_COUNT];
+    uint64_t tier[APN_STATS_TIER_COUNT];
+    uint64_t allocs; // new heap blocks of numbers and workspaces
+    uint64_t alloc_bytes;
+    uint64_t reallocs; // blocks grown or shrunk
+    uint64_t realloc_bytes; // their new sizes
+};
+typedef struct arbitrary_precision_stats apn_stats_s;
+
+// whether the library counts at all
+bool apn_stats_enabled(void);
+// the sums over all threads that used the library, finished ones included,
+// exact while the other threads are idle
+void apn_stats_snapshot(apn_stats_s* stats);
+// zero all counters and drop the trace, not while other threads use the
+// library
+void apn_stats_reset(void);
+const char* apn_stats_op_name(enum apn_stats_op op);
+const char* apn_stats_tier_name(enum apn_stats_tier tier);
+
+// Record each entry point call as a trace event while on, off by default.
+// apn_stats_trace_dump writes them in the Chrome trace event format, which
+// chrome://tracing and Perfetto load as a timeline with a track per thread.
+// The dump can run while other threads count, it has the events recorded
+// up to then. Returns false if the file cannot be written.
+void apn_stats_trace(bool on);
+bool apn_stats_trace_dump(const char* path);
+
+#endif // HOPE_BIGNUM_APN_STATS_H
@@ -1,12 +1,17 @@
 #include "apn.h"
 #include "ap_impl.h"
 #include <ctype.h>
+#include <pthread.h>
+#include <stdlib.h>
 #include <string.h>
 
 static const char alphabet[] = "0123456789ABCDEFGHIJKLMNOPQRSTUVWXYZ";
 static ap_dig_t max_power[35][2]; // max i^x <= 2^AP_DIG_BIT, {i^x - 1, x} is stored
+static apn_dig_inv_s max_power_inv[35]; // of i^x, unless it is 2^AP_DIG_BIT
 
-void precompute_table_max_power(void) {
+static pthread_once_t max_power_once = PTHREAD_ONCE_INIT;
+
+static void precompute_table_max_power(void) {
     for(int i = 2; i <= 36; ++i) {
         struct ap_dig_pair t = { .lo = i, .hi = 0 };
         ap_dig_t x = 1;
@@ -21,23 +26,130 @@ void precompute_table_max_power(void) {
             --x;
         }
         max_power[i - 2][1] = x;
+        if(max_power[i - 2][0] != AP_DIG_MAX)
+            apn_dig_inv_init(&max_power_inv[i - 2], max_power[i - 2][0] + 1);
+    }
+}
+
+// powers base^(x 2^k) of the chunk size x in max_power, cached per base
+// and squared up on demand, shared by all conversions. Each one is allocated
+// on its own, so that the numbers never move. New powers are made under the
+// lock and published by count once complete, so that readers of the powers
+// below count need no lock.
+static struct {
+    apn_s*        pow[AP_DIG_BIT];
+    atomic_size_t count;
+} power_cache[35];
+static pthread_mutex_t power_cache_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static const apn_s* apn_str_power(int base, size_t k) {
+    apn_s** pow = power_cache[base - 2].pow;
+    atomic_size_t* count = &power_cache[base - 2].count;
+    if(atomic_load_explicit(count, memory_order_acquire) > k)
+        return pow[k];
+    pthread_mutex_lock(&power_cache_lock);
+    for(size_t i = atomic_load_explicit(count, memory_order_relaxed); i <= k; ++i) {
+        apn_s* p = malloc(sizeof(apn_s));
+        apn_init(p);
+        if(i)
+            apn_sqr(p, pow[i - 1]);
+        else {
+            apn_assign_dig(p, max_power[base - 2][0]);
+            apn_add_dig(p, p, 1);
+        }
+        pow[i] = p;
+        atomic_store_explicit(count, i + 1, memory_order_release);
+    }
+    pthread_mutex_unlock(&power_cache_lock);
+    return pow[k];
+}
+
+void apn_str_cache_clear(void) {
+    pthread_mutex_lock(&power_cache_lock);
+    for(int i = 0; i != 35; ++i) {
+        size_t count = atomic_load_explicit(&power_cache[i].count, memory_order_relaxed);
+        for(size_t k = 0; k != count; ++k) {
+            apn_clear(power_cache[i].pow[k]);
+            free(power_cache[i].pow[k]);
+        }
+        atomic_store_explicit(&power_cache[i].count, 0, memory_order_relaxed);
+    }
+    pthread_mutex_unlock(&power_cache_lock);
+}
+
+static ap_dig_t digit_value(char c) {
+    return isdigit((unsigned char)c) ? c - '0' : toupper((unsigned char)c) - 'A' + 10;
+}
+
+// parse n characters, x of them into one digit at a time
+static void apn_assign_str_basecase(apn_s* o, const char* str, size_t n, int base) {
+    Macro_stats_tier(APN_STATS_ASSIGN_STR_BASECASE);
+    size_t x = max_power[base - 2][1];
+    ap_dig_t b = max_power[base - 2][0] + 1; // 0 if base^x = 2^AP_DIG_BIT
+    apn_reserve(o, n / x + 1);
+
+    ap_dig_t* p = o->_data;
+    size_t size = 1;
+    p[0] = 0;
+    // the first chunk takes the remainder, the following ones x characters
+    for(size_t len = (n - 1) % x + 1; n; n -= len, len = x) {
+        ap_dig_t m = 0;
+        for(size_t i = 0; i != len; ++i)
+            m = m * base + digit_value(*str++);
+        ap_dig_t carry;
+        if(b) {
+            carry = apn_data_mul_1(p, p, size, b);
+            carry += apn_data_add_1(p, p, size, m);
+        } else { // one digit shift
+            carry = p[size - 1];
+            memmove(p + 1, p, (size - 1) * sizeof(ap_dig_t));
+            p[0] = m;
+        }
+        if(carry)
+            p[size++] = carry;
+    }
+    o->_size = apn_data_norm(p, size);
+}
+
+// divide and conquer, the low x 2^k characters are combined with
+// the high part by the cached power base^(x 2^k)
+static void apn_assign_str_dc(apn_s* o, const char* str, size_t n, int base) {
+    size_t x = max_power[base - 2][1];
+    if(n < Macro_threshold(ASSIGN_STR_DC) * x) {
+        apn_assign_str_basecase(o, str, n, base);
+        return;
     }
+    Macro_stats_tier(APN_STATS_ASSIGN_STR_DC);
+
+    size_t k = 0;
+    while(x << (k + 1) < n)
+        ++k;
+    size_t low = x << k;
+
+    apn_s h, l;
+    apn_init_list(&h, &l, NULL);
+    apn_assign_str_dc(&h, str, n - low, base);
+    apn_assign_str_dc(&l, str + n - low, low, base);
+    apn_mul(o, &h, apn_str_power(base, k));
+    apn_add_inplace(o, &l);
+    apn_clear_list(&h, &l, NULL);
 }
 
 void apn_assign_str(apn_s* o, const char* str, int base) {
     if(base < 2 || base > 36)
         return;
 
-    apn_s b;
-    apn_init(&b);
-    apn_assign_dig(&b, base);
+    pthread_once(&max_power_once, precompute_table_max_power);
 
-    apn_assign_dig(o, 0);
-    for(; *str; ++str) {
-        apn_mul(o, o, &b);
-        apn_add_dig(o, o, strchr(alphabet, toupper(*str)) - alphabet);
+    size_t n = strlen(str);
+    if(!n) {
+        apn_assign_dig(o, 0);
+        return;
     }
-    apn_clear(&b);
+    Macro_stats_begin(APN_STATS_ASSIGN_STR, n);
+    apn_reserve(o, n / max_power[base - 2][1] + 2);
+    apn_assign_str_dc(o, str, n, base);
+    Macro_stats_end();
 }
 
 void apn_to_str_bexp2(const apn_s* o, char* str, int blog2) {
@@ -66,42 +178,79 @@ void apn_to_str_bexp2(const apn_s* o, char* str, int blog2) {
     }
 }
 
-void apn_to_str(const apn_s* o, char* str, int base) {
-    if(base < 2 || base > 36)
-        return;
-
-    if(!max_power[0][1])
-        precompute_table_max_power();
-
-    apn_s b, v, t;
-    apn_init_list(&b, &v, &t, NULL);
+// writes o to str, exactly len digits with leading zeros or as few as
+// possible if len is 0, returns the end
+static char* apn_to_str_basecase(const apn_s* o, char* str, int base, size_t len) {
+    Macro_stats_tier(APN_STATS_TO_STR_BASECASE);
+    apn_s v;
+    apn_init(&v);
     apn_assign(&v, o);
-    // divide max_power(base) instead of one base digit at a time
-    apn_assign_dig(&b, max_power[base - 2][0]);
-    apn_add_dig(&b, &b, 1);
-    
+    // divide max_power(base) instead of one base digit at a time, by its
+    // reciprocal
+    bool shift = max_power[base - 2][0] == AP_DIG_MAX; // base^x = 2^AP_DIG_BIT
+
     char* p = str;
     ap_dig_t x = max_power[base - 2][1];
     do {
-        apn_div(&v, &t, &v, &b);
-        // t < max_power[base - 2] + 1 <= 2^AP_DIG_BIT
-        ap_dig_t m = t._data[0];
-        
-        bool last_iter = apn_is_zero(&v); // throw preceding zeros
+        ap_dig_t m;
+        if(shift) {
+            m = v._data[0];
+            apn_shr(&v, &v, 1);
+        } else
+            m = apn_divrem_dig_inv(&v, &v, &max_power_inv[base - 2]);
+
+        bool last_iter = !len && apn_is_zero(&v); // throw preceding zeros
         ap_dig_t i = 0;
         do {
             *p++ = alphabet[m % base];
             m /= base;
         } while(last_iter ? m : ++i != x);
     } while(!apn_is_zero(&v));
+    apn_clear(&v);
 
-    apn_clear_list(&b, &v, &t, NULL);
-
-    *p-- = '\0';
+    while(p < str + len)
+        *p++ = '0';
     // the result was in reverse order
-    while(p != str && p != str - 1) {
-        Macro_swap_val(char, *p, *str);
-        --p, ++str;
-    }
+    for(char *l = str, *r = p - 1; l < r; ++l, --r)
+        Macro_swap_val(char, *l, *r);
+    return p;
+}
+
+// divide and conquer by the cached powers, o = q base^(x 2^k) + r with
+// r written as exactly x 2^k digits
+static char* apn_to_str_dc(const apn_s* o, char* str, int base, size_t len, apn_ws_s* ws) {
+    if(o->_size < Macro_threshold(TO_STR_DC))
+        return apn_to_str_basecase(o, str, base, len);
+    Macro_stats_tier(APN_STATS_TO_STR_DC);
+
+    // the largest power with about half the digits of o
+    size_t k = 0;
+    while(2 * apn_str_power(base, k + 1)->_size <= o->_size + 1)
+        ++k;
+    const apn_s* pow = apn_str_power(base, k);
+    size_t digits = (size_t)max_power[base - 2][1] << k;
+
+    apn_s q, r;
+    apn_init_list(&q, &r, NULL);
+    apn_div_ws(&q, &r, o, pow, ws);
+    // pow has fewer digits than o, q is not zero
+    str = apn_to_str_dc(&q, str, base, len ? len - digits : 0, ws);
+    apn_clear(&q);
+    str = apn_to_str_dc(&r, str, base, digits, ws);
+    apn_clear(&r);
+    return str;
 }
 
+void apn_to_str(const apn_s* o, char* str, int base) {
+    if(base < 2 || base > 36)
+        return;
+
+    pthread_once(&max_power_once, precompute_table_max_power);
+
+    Macro_stats_begin(APN_STATS_TO_STR, o->_size);
+    apn_ws_s ws;
+    apn_ws_init(&ws);
+    *apn_to_str_dc(o, str, base, 0, &ws) = '\0';
+    apn_ws_clear(&ws);
+    Macro_stats_end();
+}
@@ -0,0 +1,230 @@
+#include "apn.h"
+#include "ap_impl.h"
+#include <pthread.h>
+#include <sched.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Work-stealing pool for the fork-join tasks of the multiplications. Every
+// worker owns a deque, it pushes and pops at the bottom, idle threads steal
+// from the top, so the oldest and usually largest tasks move between
+// threads. Threads outside the pool share one more deque. Waiting threads
+// run other tasks meanwhile instead of blocking.
+
+struct apn_deque {
+    pthread_mutex_t lock;
+    apn_task_s**    tasks;
+    size_t          head, tail; // tasks[head, tail) are queued
+    size_t          capacity;
+};
+
+static struct {
+    pthread_mutex_t   lock; // guards the sleeping workers
+    pthread_cond_t    wake;
+    unsigned          threads; // callers included
+    size_t            grain;
+    pthread_t*        workers;
+    struct apn_deque* deques; // threads deques, the last one of outside threads
+    atomic_size_t     pending; // queued tasks
+    atomic_bool       stop;
+} pool = {
+    .lock = PTHREAD_MUTEX_INITIALIZER,
+    .wake = PTHREAD_COND_INITIALIZER,
+    .threads = 1,
+    .grain = APN_THREAD_GRAIN,
+};
+
+static _Thread_local unsigned pool_index; // deque of this thread, 0 outside
+static _Thread_local bool pool_worker;
+
+// scratch of the tasks run by this thread, one per nesting level, kept
+// for the next tasks. A thread outside the pool runs tasks while it waits,
+// so its list is freed by a key destructor when it exits.
+struct apn_ws_node {
+    apn_ws_s            ws;
+    struct apn_ws_node* next;
+};
+static _Thread_local struct apn_ws_node* ws_free;
+static pthread_key_t ws_key;
+static pthread_once_t ws_key_once = PTHREAD_ONCE_INIT;
+
+static void apn_ws_free_list(void* head) {
+    struct apn_ws_node** list = head;
+    while(*list) {
+        struct apn_ws_node* node = *list;
+        *list = node->next;
+        apn_ws_clear(&node->ws);
+        free(node);
+    }
+}
+
+static void apn_ws_key_create(void) {
+    pthread_key_create(&ws_key, apn_ws_free_list);
+}
+
+static struct apn_ws_node* apn_ws_take(void) {
+    struct apn_ws_node* node = ws_free;
+    if(node)
+        ws_free = node->next;
+    else {
+        pthread_once(&ws_key_once, apn_ws_key_create);
+        pthread_setspecific(ws_key, &ws_free);
+        node = malloc(sizeof(struct apn_ws_node));
+        apn_ws_init(&node->ws);
+    }
+    return node;
+}
+
+static void apn_ws_give(struct apn_ws_node* node) {
+    node->next = ws_free;
+    ws_free = node;
+}
+
+static void apn_ws_free_all(void) {
+    apn_ws_free_list(&ws_free);
+}
+
+static struct apn_deque* apn_own_deque(void) {
+    return &pool.deques[pool_worker ? pool_index : pool.threads - 1];
+}
+
+static void apn_deque_push(struct apn_deque* d, apn_task_s* t) {
+    pthread_mutex_lock(&d->lock);
+    if(d->tail == d->capacity) {
+        // grow when more than half is in use, then move to the front
+        size_t n = d->tail - d->head;
+        if(2 * n >= d->capacity) {
+            d->capacity = Macro_max(2 * d->capacity, 16);
+            d->tasks = realloc(d->tasks, d->capacity * sizeof(apn_task_s*));
+        }
+        memmove(d->tasks, d->tasks + d->head, n * sizeof(apn_task_s*));
+        d->head = 0;
+        d->tail = n;
+    }
+    d->tasks[d->tail++] = t;
+    pthread_mutex_unlock(&d->lock);
+}
+
+// bottom for the owner, top for thieves
+static apn_task_s* apn_deque_take(struct apn_deque* d, bool steal) {
+    apn_task_s* t = NULL;
+    pthread_mutex_lock(&d->lock);
+    if(d->head != d->tail)
+        t = steal ? d->tasks[d->head++] : d->tasks[--d->tail];
+    pthread_mutex_unlock(&d->lock);
+    return t;
+}
+
+// a queued task, own ones first
+static apn_task_s* apn_pool_find(void) {
+    struct apn_deque* own = apn_own_deque();
+    apn_task_s* t = apn_deque_take(own, false);
+    for(unsigned i = 0; !t && i != pool.threads; ++i) {
+        struct apn_deque* d = &pool.deques[(pool_index + i) % pool.threads];
+        if(d != own)
+            t = apn_deque_take(d, true);
+    }
+    if(t)
+        atomic_fetch_sub(&pool.pending, 1);
+    return t;
+}
+
+static void apn_task_run(apn_task_s* t) {
+    struct apn_ws_node* node = apn_ws_take();
+    t->fn(t->arg, &node->ws);
+    apn_ws_give(node);
+    atomic_store_explicit(&t->done, true, memory_order_release);
+}
+
+static void* apn_worker(void* arg) {
+    pool_index = (unsigned)(size_t)arg;
+    pool_worker = true;
+    while(!atomic_load(&pool.stop)) {
+        apn_task_s* t = apn_pool_find();
+        if(t) {
+            apn_task_run(t);
+            continue;
+        }
+        pthread_mutex_lock(&pool.lock);
+        while(!atomic_load(&pool.pending) && !atomic_load(&pool.stop))
+            pthread_cond_wait(&pool.wake, &pool.lock);
+        pthread_mutex_unlock(&pool.lock);
+    }
+    apn_ws_free_all();
+    return NULL;
+}
+
+bool apn_task_parallel(size_t n) {
+    return pool.threads > 1 && n >= pool.grain;
+}
+
+void apn_task_spawn(apn_task_s* t) {
+    atomic_init(&t->done, false);
+    if(pool.threads == 1) {
+        apn_task_run(t);
+        return;
+    }
+    apn_deque_push(apn_own_deque(), t);
+    atomic_fetch_add(&pool.pending, 1);
+    pthread_mutex_lock(&pool.lock);
+    pthread_cond_signal(&pool.wake);
+    pthread_mutex_unlock(&pool.lock);
+}
+
+void apn_task_wait(apn_task_s* t) {
+    while(!atomic_load_explicit(&t->done, memory_order_acquire)) {
+        apn_task_s* u = apn_pool_find();
+        if(u)
+            apn_task_run(u);
+        else
+            sched_yield();
+    }
+}
+
+static void apn_pool_stop(void) {
+    if(pool.threads == 1)
+        return;
+    pthread_mutex_lock(&pool.lock);
+    atomic_store(&pool.stop, true);
+    pthread_cond_broadcast(&pool.wake);
+    pthread_mutex_unlock(&pool.lock);
+    for(unsigned i = 0; i != pool.threads - 1; ++i)
+        pthread_join(pool.workers[i], NULL);
+    for(unsigned i = 0; i != pool.threads; ++i) {
+        pthread_mutex_destroy(&pool.deques[i].lock);
+        free(pool.deques[i].tasks);
+    }
+    free(pool.workers);
+    free(pool.deques);
+    pool.workers = NULL;
+    pool.deques = NULL;
+    pool.threads = 1;
+    atomic_store(&pool.stop, false);
+}
+
+void apn_threads_set(unsigned n) {
+    apn_pool_stop();
+    apn_ws_free_all();
+    if(n <= 1)
+        return;
+    pool.deques = calloc(n, sizeof(struct apn_deque));
+    for(unsigned i = 0; i != n; ++i)
+        pthread_mutex_init(&pool.deques[i].lock, NULL);
+    pool.workers = malloc((n - 1) * sizeof(pthread_t));
+    pool.threads = n;
+    atomic_store(&pool.pending, 0);
+    for(unsigned i = 0; i != n - 1; ++i)
+        pthread_create(&pool.workers[i], NULL, apn_worker, (void*)(size_t)i);
+}
+
+unsigned apn_threads_get(void) {
+    return pool.threads;
+}
+
+void apn_threads_set_grain(size_t grain) {
+    pool.grain = grain;
+}
+
+size_t apn_threads_get_grain(void) {
+    return pool.grain;
+}
@@ -0,0 +1,72 @@
+#include "apn.h"
+#include "ap_impl.h"
+
+// the macro name of the default is its string
+#define Macro_threshold_info(Marg_t, Marg_default, Marg_min) \
+    [APN_THRESHOLD_##Marg_t] = { #Marg_default, Marg_default, Marg_min }
+
+static const struct {
+    const char* name;
+    size_t      value; // compiled default
+    size_t      min; // smallest value the algorithm works with
+} apn_threshold_info[APN_THRESHOLD_COUNT] = {
+    Macro_threshold_info(MUL_KARATSUBA, APN_MUL_KARATSUBA_THRESHOLD, 1),
+    Macro_threshold_info(MUL_TOOM33, APN_MUL_TOOM33_THRESHOLD, 1),
+    Macro_threshold_info(MUL_TOOM44, APN_MUL_TOOM44_THRESHOLD, 1),
+    Macro_threshold_info(MUL_FFT, APN_MUL_FFT_THRESHOLD, 1),
+    Macro_threshold_info(SQR_KARATSUBA, APN_SQR_KARATSUBA_THRESHOLD, 1),
+    Macro_threshold_info(SQR_TOOM33, APN_SQR_TOOM33_THRESHOLD, 1),
+    Macro_threshold_info(SQR_TOOM44, APN_SQR_TOOM44_THRESHOLD, 1),
+    Macro_threshold_info(SQR_FFT, APN_SQR_FFT_THRESHOLD, 1),
+    Macro_threshold_info(DIV_BZ, APN_DIV_BZ_THRESHOLD, 1),
+    Macro_threshold_info(DIV_BZ_BLOCKSIZE, APN_DIV_BZ_BLOCKSIZE, 1),
+    // a quotient by the power of at least one digit is not zero from 3 digits
+    Macro_threshold_info(TO_STR_DC, APN_TO_STR_DC_THRESHOLD, 3),
+    // the high part needs at least one chunk
+    Macro_threshold_info(ASSIGN_STR_DC, APN_ASSIGN_STR_DC_THRESHOLD, 2),
+    Macro_threshold_info(HGCD, APN_HGCD_THRESHOLD, 1),
+    Macro_threshold_info(GCD_DC, APN_GCD_DC_THRESHOLD, 1),
+    // the reciprocal recurses on half the divisor plus two digits
+    Macro_threshold_info(DIV_NEWTON, APN_DIV_NEWTON_THRESHOLD, 5),
+    // and the inverse modulo base^k on ceil(k / 2) digits
+    Macro_threshold_info(DIVEXACT_NEWTON, APN_DIVEXACT_NEWTON_THRESHOLD, 2),
+};
+
+size_t apn_thresholds[APN_THRESHOLD_COUNT] = {
+    APN_MUL_KARATSUBA_THRESHOLD,
+    APN_MUL_TOOM33_THRESHOLD,
+    APN_MUL_TOOM44_THRESHOLD,
+    APN_MUL_FFT_THRESHOLD,
+    APN_SQR_KARATSUBA_THRESHOLD,
+    APN_SQR_TOOM33_THRESHOLD,
+    APN_SQR_TOOM44_THRESHOLD,
+    APN_SQR_FFT_THRESHOLD,
+    APN_DIV_BZ_THRESHOLD,
+    APN_DIV_BZ_BLOCKSIZE,
+    APN_TO_STR_DC_THRESHOLD,
+    APN_ASSIGN_STR_DC_THRESHOLD,
+    APN_HGCD_THRESHOLD,
+    APN_GCD_DC_THRESHOLD,
+    APN_DIV_NEWTON_THRESHOLD,
+    APN_DIVEXACT_NEWTON_THRESHOLD,
+};
+
+size_t apn_threshold_get(enum apn_threshold t) {
+    assert(t < APN_THRESHOLD_COUNT);
+    return apn_thresholds[t];
+}
+
+size_t apn_threshold_set(enum apn_threshold t, size_t value) {
+    assert(t < APN_THRESHOLD_COUNT);
+    return apn_thresholds[t] = Macro_max(value, apn_threshold_info[t].min);
+}
+
+void apn_threshold_reset(void) {
+    for(int t = 0; t != APN_THRESHOLD_COUNT; ++t)
+        apn_thresholds[t] = apn_threshold_info[t].value;
+}
+
+const char* apn_threshold_name(enum apn_threshold t) {
+    assert(t < APN_THRESHOLD_COUNT);
+    return apn_threshold_info[t].name;
+}
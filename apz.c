@@ -78,20 +78,43 @@ void apz_mul(apz_s* res, const apz_s* op1, const apz_s* op2) {
     res->sign = op1->sign ^ op2->sign;
 }
 
+// the signs are taken first, results may alias the operands
 void apz_div(apz_s* quot, apz_s* rem, const apz_s* op1, const apz_s* op2) {
-    apn_div(&quot->magnitude, &rem->magnitude, &op1->magnitude, &op2->magnitude);
-    quot->sign = op1->sign ^ op2->sign;
-    rem->sign = op1->sign; // same sign with dividend
+    bool qsign = op1->sign ^ op2->sign, rsign = op1->sign;
+    apn_div(quot ? &quot->magnitude : NULL, rem ? &rem->magnitude : NULL,
+            &op1->magnitude, &op2->magnitude);
+    if(quot != NULL)
+        quot->sign = qsign;
+    if(rem != NULL)
+        rem->sign = rsign; // same sign with dividend
 }
 
 void apz_mod(apz_s* mod, const apz_s* op1, const apz_s* op2) {
+    if(mod == op2) { // op2 is needed after the division
+        apz_s t;
+        apz_init(&t);
+        apz_mod(&t, op1, op2);
+        apz_swap(mod, &t);
+        apz_clear(&t);
+        return;
+    }
     apz_div(NULL, mod, op1, op2);
-    if(mod->sign)
+    if(apn_is_zero(&mod->magnitude))
+        mod->sign = false;
+    else if(mod->sign)
         apz_add(mod, mod, op2);
 }
 
 void apz_mod_n(apn_s* mod, const apz_s* op1, const apn_s* op2) {
+    if(mod == op2) {
+        apn_s t;
+        apn_init(&t);
+        apz_mod_n(&t, op1, op2);
+        apn_swap(mod, &t);
+        apn_clear(&t);
+        return;
+    }
     apn_div(NULL, mod, &op1->magnitude, op2);
-    if(op1->sign)
+    if(op1->sign && !apn_is_zero(mod))
         apn_sub(mod, op2, mod);
 }
@@ -21,6 +21,10 @@ void apz_assign(apz_s* res, const apz_s* op);
 void apz_assign_n(apz_s* res, const apn_s* op);
 
 void apz_to_str(const apz_s* o, char* str, int base);
+// see apn_serialize, the sign included
+size_t apz_serialized_size(const apz_s* op);
+size_t apz_serialize(void* buf, const apz_s* op);
+size_t apz_deserialize(apz_s* res, const void* buf, size_t len);
 
 void apz_add(apz_s* res, const apz_s* op1, const apz_s* op2);
 void apz_sub(apz_s* res, const apz_s* op1, const apz_s* op2);
@@ -30,5 +34,12 @@ void apz_div(apz_s* quot, apz_s* rem, const apz_s* op1, const apz_s* op2);
 // modulo, guaranteed 0 <= `mod` < `op2`
 void apz_mod(apz_s* mod, const apz_s* op1, const apz_s* op2);
 void apz_mod_n(apn_s* mod, const apz_s* op1, const apn_s* op2);
+// apz_mod_n by the modulus of a Barrett context
+void apz_mod_barrett(apn_s* mod, const apz_s* op, const apn_barrett_s* ctx);
+
+// g = gcd(op1, op2) = s op1 + t op2 with |s| <= |op2| / 2g, s and t can be
+// NULL, see apn_gcd. If op2 = 0 then s = ±1 with the sign of op1 and t = 0,
+// all of g, s and t are 0 if both are
+void apz_gcdext(apn_s* g, apz_s* s, apz_s* t, const apz_s* op1, const apz_s* op2);
 
 #endif // HOPE_BIGNUM_APZ_H
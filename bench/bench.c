@@ -0,0 +1,272 @@
+#include "apn.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+// Times each operation and algorithm tier over operand sizes growing
+// geometrically from 1 to 10^6 digits, as a table or as CSV for comparing
+// builds and finding the crossover points.
+//
+//   bench [-c] [-a] [-n min] [-m max] [-r ratio] [-t seconds] [-j threads] [op...]
+//
+// -c    CSV output
+// -a    ignore the per-tier size limits, the base cases at 10^6 digits run
+//       for hours
+// op    names or prefixes of the benchmarks to run, e.g. mul or div/bz
+
+static struct {
+    apn_s         a, b, c, q, r;
+    apn_mont_s    mont;
+    apn_barrett_s barrett;
+    bool          has_ctx;
+    char*         str;
+} ctx;
+
+static uint64_t rng_state = 0x9E3779B97F4A7C15ULL;
+
+static ap_dig_t rand_dig(void) {
+    rng_state ^= rng_state << 13;
+    rng_state ^= rng_state >> 7;
+    rng_state ^= rng_state << 17;
+    return rng_state;
+}
+
+static void rand_apn(apn_s* o, size_t n) {
+    apn_reserve(o, n);
+    for(size_t i = 0; i != n; ++i)
+        o->_data[i] = rand_dig();
+    if(!o->_data[n - 1])
+        o->_data[n - 1] = 1;
+    o->_size = n;
+}
+
+// operands of n digits
+static void setup_binary(size_t n) {
+    rand_apn(&ctx.a, n);
+    rand_apn(&ctx.b, n);
+}
+
+// 2n by n digits
+static void setup_div(size_t n) {
+    rand_apn(&ctx.a, 2 * n);
+    rand_apn(&ctx.b, n);
+}
+
+// a 2n digit product c of n digit a and b
+static void setup_divexact(size_t n) {
+    setup_binary(n);
+    apn_mul(&ctx.c, &ctx.a, &ctx.b);
+}
+
+// n digits in the binary form
+static void setup_serialize(size_t n) {
+    rand_apn(&ctx.a, n);
+    ctx.str = malloc(apn_serialized_size(&ctx.a));
+    apn_serialize(ctx.str, &ctx.a);
+}
+
+// base, exponent and odd modulus of n digits, the contexts set up once
+static void setup_modexp(size_t n) {
+    setup_binary(n);
+    rand_apn(&ctx.c, n);
+    ctx.c._data[0] |= 1;
+    apn_mont_init(&ctx.mont, &ctx.c);
+    apn_barrett_init(&ctx.barrett, &ctx.c);
+    ctx.has_ctx = true;
+}
+
+static void setup_str(size_t n) {
+    rand_apn(&ctx.a, n);
+    ctx.str = malloc(n * 20 + 21); // 20 decimal digits per digit at most
+    apn_to_str(&ctx.a, ctx.str, 10);
+}
+
+static void run_add(void) { apn_add(&ctx.r, &ctx.a, &ctx.b); }
+static void run_sub(void) { apn_sub(&ctx.r, &ctx.a, &ctx.b); }
+static void run_addmul_dig(void) { apn_addmul_dig(&ctx.r, &ctx.a, ctx.b._data[0]); }
+static void run_divrem_dig(void) { apn_divrem_dig(&ctx.q, &ctx.a, ctx.b._data[0]); }
+static void run_shl(void) { apn_bit_shl(&ctx.r, &ctx.a, 13); }
+static void run_xor(void) { apn_xor(&ctx.r, &ctx.a, &ctx.b); }
+static void run_popcount(void) { apn_popcount(&ctx.a); }
+static void run_cmp(void) { apn_cmp(&ctx.a, &ctx.a); }
+static void run_mul(void) { apn_mul(&ctx.r, &ctx.a, &ctx.b); }
+static void run_mul_basecase(void) { apn_mul_basecase(&ctx.r, &ctx.a, &ctx.b); }
+static void run_mul_karatsuba(void) { apn_mul_karatsuba(&ctx.r, &ctx.a, &ctx.b); }
+static void run_mul_toom33(void) { apn_mul_toom33(&ctx.r, &ctx.a, &ctx.b); }
+static void run_mul_toom44(void) { apn_mul_toom44(&ctx.r, &ctx.a, &ctx.b); }
+static void run_mul_fft(void) { apn_mul_fft(&ctx.r, &ctx.a, &ctx.b); }
+static void run_sqr(void) { apn_sqr(&ctx.r, &ctx.a); }
+static void run_sqr_basecase(void) { apn_sqr_basecase(&ctx.r, &ctx.a); }
+static void run_sqr_karatsuba(void) { apn_sqr_karatsuba(&ctx.r, &ctx.a); }
+static void run_sqr_toom33(void) { apn_sqr_toom33(&ctx.r, &ctx.a); }
+static void run_sqr_toom44(void) { apn_sqr_toom44(&ctx.r, &ctx.a); }
+static void run_sqr_fft(void) { apn_sqr_fft(&ctx.r, &ctx.a); }
+static void run_div(void) { apn_div(&ctx.q, &ctx.r, &ctx.a, &ctx.b); }
+static void run_div_basecase(void) { apn_div_basecase(&ctx.q, &ctx.r, &ctx.a, &ctx.b); }
+static void run_div_bz(void) { apn_div_bz(&ctx.q, &ctx.r, &ctx.a, &ctx.b); }
+static void run_div_newton(void) { apn_div_newton(&ctx.q, &ctx.r, &ctx.a, &ctx.b); }
+static void run_divexact(void) { apn_divexact(&ctx.q, &ctx.c, &ctx.b); }
+static void run_modexp(void) { apn_modexp(&ctx.r, &ctx.a, &ctx.b, &ctx.c); }
+static void run_modexp_mont(void) { apn_mont_modexp(&ctx.r, &ctx.a, &ctx.b, &ctx.mont); }
+static void run_modexp_barrett(void) { apn_barrett_modexp(&ctx.r, &ctx.a, &ctx.b, &ctx.barrett); }
+static void run_gcd(void) { apn_gcd(&ctx.r, &ctx.a, &ctx.b); }
+static void run_invert(void) { apn_invert(&ctx.r, &ctx.a, &ctx.b); }
+static void run_sqrtrem(void) { apn_sqrtrem(&ctx.r, &ctx.q, &ctx.a); }
+static void run_rootrem(void) { apn_rootrem(&ctx.r, &ctx.q, &ctx.a, 3); }
+static void run_to_str(void) { apn_to_str(&ctx.a, ctx.str, 10); }
+static void run_assign_str(void) { apn_assign_str(&ctx.r, ctx.str, 10); }
+static void run_serialize(void) { apn_serialize(ctx.str, &ctx.a); }
+static void run_deserialize(void) { apn_deserialize(&ctx.r, ctx.str, apn_serialized_size(&ctx.a)); }
+
+struct bench {
+    const char* name;
+    size_t      limit; // largest size run without -a
+    void        (*setup)(size_t n);
+    void        (*run)(void);
+};
+
+static const struct bench benches[] = {
+    { "add",              1000000, setup_binary, run_add },
+    { "sub",              1000000, setup_binary, run_sub },
+    { "addmul_dig",       1000000, setup_binary, run_addmul_dig },
+    { "divrem_dig",       1000000, setup_binary, run_divrem_dig },
+    { "bit_shl",          1000000, setup_binary, run_shl },
+    { "xor",              1000000, setup_binary, run_xor },
+    { "popcount",         1000000, setup_binary, run_popcount },
+    { "cmp",              1000000, setup_binary, run_cmp },
+    { "mul/auto",         1000000, setup_binary, run_mul },
+    { "mul/basecase",       10000, setup_binary, run_mul_basecase },
+    { "mul/karatsuba",     100000, setup_binary, run_mul_karatsuba },
+    { "mul/toom33",        100000, setup_binary, run_mul_toom33 },
+    { "mul/toom44",        100000, setup_binary, run_mul_toom44 },
+    { "mul/fft",          1000000, setup_binary, run_mul_fft },
+    { "sqr/auto",         1000000, setup_binary, run_sqr },
+    { "sqr/basecase",       10000, setup_binary, run_sqr_basecase },
+    { "sqr/karatsuba",     100000, setup_binary, run_sqr_karatsuba },
+    { "sqr/toom33",        100000, setup_binary, run_sqr_toom33 },
+    { "sqr/toom44",        100000, setup_binary, run_sqr_toom44 },
+    { "sqr/fft",          1000000, setup_binary, run_sqr_fft },
+    { "div/auto",         1000000, setup_div, run_div },
+    { "div/basecase",       10000, setup_div, run_div_basecase },
+    { "div/bz",           1000000, setup_div, run_div_bz },
+    { "div/newton",       1000000, setup_div, run_div_newton },
+    { "divexact",         1000000, setup_divexact, run_divexact },
+    { "modexp/auto",          200, setup_modexp, run_modexp },
+    { "modexp/mont",          200, setup_modexp, run_modexp_mont },
+    { "modexp/barrett",       200, setup_modexp, run_modexp_barrett },
+    { "gcd",               100000, setup_binary, run_gcd },
+    { "invert",            100000, setup_binary, run_invert },
+    { "sqrtrem",          1000000, setup_binary, run_sqrtrem },
+    { "rootrem/3",         100000, setup_binary, run_rootrem },
+    { "to_str/10",         100000, setup_str, run_to_str },
+    { "assign_str/10",     100000, setup_str, run_assign_str },
+    { "serialize",        1000000, setup_serialize, run_serialize },
+    { "deserialize",      1000000, setup_serialize, run_deserialize },
+};
+
+static double now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+// nanoseconds per call, repeated until `seconds` have passed, the short
+// rounds before warm up the caches and the allocations
+static double measure(void (*run)(void), double seconds, size_t* reps) {
+    size_t n = 1;
+    for(;;) {
+        double t = now();
+        for(size_t i = 0; i != n; ++i)
+            run();
+        t = now() - t;
+        if(t >= seconds || n >= ((size_t)1 << 40)) {
+            *reps = n;
+            return t * 1e9 / n;
+        }
+        // aim a bit past the target to avoid another round
+        double f = t > 0 ? 1.2 * seconds / t : 100;
+        n = (size_t)(n * (f < 2 ? 2 : f > 100 ? 100 : f));
+    }
+}
+
+static bool selected(const char* name, int argc, char** argv, int first) {
+    if(first == argc)
+        return true;
+    for(int i = first; i != argc; ++i)
+        if(!strncmp(name, argv[i], strlen(argv[i])))
+            return true;
+    return false;
+}
+
+static void usage(const char* prog) {
+    fprintf(stderr, "usage: %s [-c] [-a] [-n min] [-m max] [-r ratio] [-t seconds] "
+                    "[-j threads] [op...]\n", prog);
+    exit(2);
+}
+
+int main(int argc, char** argv) {
+    bool csv = false, all = false;
+    size_t min = 1, max = 1000000;
+    double ratio = 2, seconds = 0.05;
+    int i = 1;
+    for(; i < argc && argv[i][0] == '-'; ++i) {
+        char opt = argv[i][1];
+        if(opt == 'c')
+            csv = true;
+        else if(opt == 'a')
+            all = true;
+        else if(i + 1 == argc)
+            usage(argv[0]);
+        else if(opt == 'n')
+            min = strtoull(argv[++i], NULL, 10);
+        else if(opt == 'm')
+            max = strtoull(argv[++i], NULL, 10);
+        else if(opt == 'r')
+            ratio = strtod(argv[++i], NULL);
+        else if(opt == 't')
+            seconds = strtod(argv[++i], NULL);
+        else if(opt == 'j')
+            apn_threads_set((unsigned)strtoul(argv[++i], NULL, 10));
+        else
+            usage(argv[0]);
+    }
+    if(!min || ratio <= 1)
+        usage(argv[0]);
+
+    apn_init_list(&ctx.a, &ctx.b, &ctx.c, &ctx.q, &ctx.r, NULL);
+    if(csv)
+        printf("op,digits,reps,ns_per_op,digits_per_s\n");
+    else
+        printf("%-16s %10s %16s %16s\n", "op", "digits", "ns/op", "digits/s");
+    for(size_t k = 0; k != sizeof(benches) / sizeof(benches[0]); ++k) {
+        const struct bench* b = &benches[k];
+        if(!selected(b->name, argc, argv, i))
+            continue;
+        size_t top = all ? max : (b->limit < max ? b->limit : max);
+        for(size_t n = min; n <= top;) {
+            b->setup(n);
+            size_t reps;
+            double ns = measure(b->run, seconds, &reps);
+            if(csv)
+                printf("%s,%zu,%zu,%.1f,%.0f\n", b->name, n, reps, ns, n * 1e9 / ns);
+            else
+                printf("%-16s %10zu %16.1f %16.0f\n", b->name, n, ns, n * 1e9 / ns);
+            fflush(stdout);
+            if(ctx.has_ctx) {
+                apn_mont_clear(&ctx.mont);
+                apn_barrett_clear(&ctx.barrett);
+                ctx.has_ctx = false;
+            }
+            free(ctx.str);
+            ctx.str = NULL;
+            // the last step ends on the limit
+            size_t next = (size_t)(n * ratio);
+            n = n == top ? top + 1 : next > n ? (next < top ? next : top) : n + 1;
+        }
+    }
+    apn_clear_list(&ctx.a, &ctx.b, &ctx.c, &ctx.q, &ctx.r, NULL);
+    apn_str_cache_clear();
+    apn_threads_set(1);
+    return 0;
+}
@@ -0,0 +1,827 @@
+#include "apn.h"
+#include "apz.h"
+#include "apn_stats.h"
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Known values and cross checks of every tier against the base cases, the
+// sizes straddle the thresholds in apn.h.
+
+static int failures;
+
+#define CHECK(Marg_cond) \
+    do { \
+        if(!(Marg_cond)) { \
+            fprintf(stderr, "%s:%d: %s\n", __FILE__, __LINE__, #Marg_cond); \
+            ++failures; \
+        } \
+    } while(0)
+
+static uint64_t rng_state = 0x9E3779B97F4A7C15ULL;
+
+static ap_dig_t rand_dig(void) {
+    rng_state ^= rng_state << 13;
+    rng_state ^= rng_state >> 7;
+    rng_state ^= rng_state << 17;
+    return rng_state;
+}
+
+// n random digits, the top one not zero
+static void rand_apn(apn_s* o, size_t n) {
+    apn_reserve(o, n);
+    for(size_t i = 0; i != n; ++i)
+        o->_data[i] = rand_dig();
+    if(!o->_data[n - 1])
+        o->_data[n - 1] = 1;
+    o->_size = n;
+}
+
+static bool str_is(const apn_s* o, int base, const char* expected) {
+    char* s = malloc(o->_size * AP_DIG_BIT + 2);
+    apn_to_str(o, s, base);
+    bool r = !strcmp(s, expected);
+    free(s);
+    return r;
+}
+
+static void test_str(void) {
+    apn_s a, b;
+    apn_init_list(&a, &b, NULL);
+
+    apn_assign_str(&a, "0", 10);
+    CHECK(apn_is_zero(&a) && a._size == 1);
+    CHECK(str_is(&a, 10, "0"));
+    apn_assign_str(&a, "18446744073709551616", 10); // 2^64
+    CHECK(a._size == 2 && a._data[0] == 0 && a._data[1] == 1);
+    CHECK(str_is(&a, 16, "10000000000000000"));
+    apn_assign_str(&a, "100000000000000000000000000000000000000000000003039", 16);
+    CHECK(a._size == 4 && a._data[0] == 0x3039 && a._data[3] == 0x100);
+    apn_assign_str(&a, "zzZZ", 36);
+    CHECK(apn_cmp_dig(&a, 36 * 36 * 36 * 36 - 1) == 0);
+
+    // round trips around the divide and conquer thresholds in all bases
+    for(int base = 2; base <= 36; base += 7) {
+        for(size_t n = 1; n <= 400; n = n * 3 / 2 + 1) {
+            rand_apn(&a, n);
+            char* s = malloc(n * AP_DIG_BIT + 2);
+            apn_to_str(&a, s, base);
+            apn_assign_str(&b, s, base);
+            CHECK(apn_cmp(&a, &b) == 0);
+            free(s);
+        }
+    }
+    for(int blog2 = 1; blog2 <= 5; ++blog2) {
+        rand_apn(&a, 50);
+        char* s = malloc(50 * AP_DIG_BIT + 2);
+        char* t = malloc(50 * AP_DIG_BIT + 2);
+        apn_to_str_bexp2(&a, s, blog2);
+        apn_to_str(&a, t, 1 << blog2);
+        CHECK(!strcmp(s, t));
+        free(s);
+        free(t);
+    }
+    apn_str_cache_clear();
+    apn_clear_list(&a, &b, NULL);
+}
+
+static void test_io(void) {
+    apn_s a, b;
+    apz_s x, y;
+    apn_init_list(&a, &b, NULL);
+    apz_init_list(&x, &y, NULL);
+    ap_dig_t buf[40]; // aligned for the views
+    unsigned char* bytes = (unsigned char*)buf;
+
+    apn_assign_dig(&a, 0x010203);
+    CHECK(apn_export(bytes, 1, 1, 0, &a) == 3 && bytes[0] == 1 && bytes[2] == 3);
+    CHECK(apn_export(bytes, -1, 2, 1, &a) == 2 && bytes[0] == 2 && bytes[1] == 3 && bytes[3] == 1);
+    apn_import(&b, 3, 1, 1, 0, "\x01\x02\x03");
+    CHECK(apn_cmp(&a, &b) == 0);
+    apn_assign_dig(&a, 0);
+    CHECK(apn_export_count(&a, 1) == 0 && apn_export(bytes, 1, 8, 1, &a) == 0);
+
+    // round trips in all layouts
+    static const size_t sizes[] = { 1, 2, 3, 8, 16 };
+    for(size_t n = 1; n <= 20; n += 6) {
+        rand_apn(&a, n);
+        a._data[n - 1] >>= 8 * (n % 7); // not a whole number of words
+        a._data[n - 1] += !a._data[n - 1];
+        for(size_t i = 0; i != sizeof(sizes) / sizeof(sizes[0]); ++i)
+            for(int order = -1; order <= 1; order += 2)
+                for(int endian = -1; endian <= 1; ++endian) {
+                    size_t count = apn_export(bytes, order, sizes[i], endian, &a);
+                    CHECK(count == apn_export_count(&a, sizes[i]));
+                    apn_import(&b, count, order, sizes[i], endian, bytes);
+                    CHECK(apn_cmp(&a, &b) == 0);
+                }
+    }
+
+    // the binary form, with the sign and broken input
+    rand_apn(&a, 30);
+    size_t len = apn_serialized_size(&a);
+    CHECK(len == 8 + 30 * 8 && apn_serialize(buf, &a) == len);
+    CHECK(apn_deserialize(&b, buf, len) == len && apn_cmp(&a, &b) == 0);
+    CHECK(!apn_deserialize(&b, buf, len - 1) && !apn_deserialize(&b, buf, 7));
+    apn_s v; // views are not initialized or cleared
+    CHECK(apn_deserialize_wrap(&v, buf, len) == len && v._data == buf + 1);
+    CHECK(apn_cmp(&a, &v) == 0);
+    apz_assign_n(&x, &a);
+    x.sign = true;
+    CHECK(apz_serialize(buf, &x) == apz_serialized_size(&x));
+    CHECK(apz_deserialize(&y, buf, len) == len && y.sign && apn_cmp(&y.magnitude, &a) == 0);
+    CHECK(!apn_deserialize(&b, buf, len));
+    apn_assign_dig(&x.magnitude, 0); // no negative zero
+    CHECK(apz_serialize(buf, &x) == 8 && apz_deserialize(&y, buf, 8) == 8);
+    CHECK(!y.sign && apn_is_zero(&y.magnitude));
+
+    // views of long and short digit arrays
+    for(size_t i = 0; i != 12; ++i)
+        buf[i] = rand_dig();
+    CHECK(apn_cmp(apn_wrap(&v, buf, 12), &a) != 0 && v._data == buf);
+    apn_import(&b, 12, -1, sizeof(ap_dig_t), 0, buf);
+    CHECK(apn_cmp(&v, &b) == 0);
+    apn_wrap(&v, buf, 2);
+    CHECK(v._data == v._inline && v._size == 2 && v._data[1] == buf[1]);
+    apn_add(&v, &v, &b); // short views are numbers of their own
+    apn_clear(&v);
+    apn_wrap(&v, buf, 0);
+    CHECK(apn_is_zero(&v) && v._size == 1);
+
+    apn_clear_list(&a, &b, NULL);
+    apz_clear_list(&x, &y, NULL);
+}
+
+static void test_storage(void) {
+    apn_s a, b;
+    apn_init_list(&a, &b, NULL);
+    CHECK(a._data == a._inline);
+    rand_apn(&a, APN_INLINE_DIGITS);
+    CHECK(a._data == a._inline);
+    apn_reserve(&a, 100);
+    CHECK(a._capacity >= 100 && a._data != a._inline);
+    apn_assign(&b, &a);
+    apn_shrink_to_fit(&a);
+    CHECK(a._data == a._inline && apn_cmp(&a, &b) == 0);
+    rand_apn(&b, 30);
+    apn_swap(&a, &b);
+    CHECK(a._size == 30 && b._size == APN_INLINE_DIGITS && b._data == b._inline);
+    apn_clear_list(&a, &b, NULL);
+}
+
+static void test_add_sub(void) {
+    apn_s a, b, c, d;
+    apn_init_list(&a, &b, &c, &d, NULL);
+    for(size_t n = 1; n <= 40; n += 3) {
+        rand_apn(&a, n);
+        rand_apn(&b, n / 2 + 1);
+        apn_add(&c, &a, &b);
+        apn_sub(&d, &c, &b);
+        CHECK(apn_cmp(&d, &a) == 0);
+        apn_assign(&d, &a);
+        apn_add_inplace(&d, &b);
+        CHECK(apn_cmp(&d, &c) == 0);
+        apn_add(&a, &a, &a); // aliased
+        apn_sub(&a, &a, &d); // a - b
+        apn_add(&c, &a, &b);
+        apn_add(&c, &c, &b);
+        CHECK(apn_cmp(&c, &d) == 0);
+
+        ap_dig_t x = rand_dig();
+        apn_assign_dig(&d, x);
+        apn_mul(&c, &b, &d);
+        apn_add(&c, &c, &a);
+        apn_assign(&d, &a);
+        apn_addmul_dig(&d, &b, x);
+        CHECK(apn_cmp(&c, &d) == 0);
+        apn_submul_dig(&d, &b, x);
+        CHECK(apn_cmp(&d, &a) == 0);
+    }
+    apn_assign_dig(&a, AP_DIG_MAX);
+    apn_add_dig(&a, &a, 1);
+    CHECK(a._size == 2 && a._data[1] == 1);
+    apn_sub_dig(&a, &a, 1);
+    CHECK(a._size == 1 && a._data[0] == AP_DIG_MAX);
+    apn_clear_list(&a, &b, &c, &d, NULL);
+}
+
+static void test_bits(void) {
+    apn_s a, b, c, d, p;
+    apn_init_list(&a, &b, &c, &d, &p, NULL);
+    static const size_t shifts[] = { 0, 1, 63, 64, 65, 130, 1000 };
+    for(size_t n = 1; n <= 30; n += 7) {
+        rand_apn(&a, n);
+        rand_apn(&b, n / 2 + 1);
+        size_t len = apn_bitlen(&a);
+        CHECK(len > (n - 1) * AP_DIG_BIT && len <= n * AP_DIG_BIT && apn_tstbit(&a, len - 1));
+        CHECK(!apn_tstbit(&a, len) && !apn_tstbit(&a, len + 1000));
+
+        // shifts against multiplication by powers of two
+        for(size_t i = 0; i != sizeof(shifts) / sizeof(shifts[0]); ++i) {
+            apn_assign_dig(&p, 0);
+            apn_setbit(&p, shifts[i]);
+            CHECK(apn_bitlen(&p) == shifts[i] + 1 && apn_popcount(&p) == 1);
+            CHECK(apn_scan1(&p, 0) == shifts[i] && apn_scan1(&p, shifts[i] + 1) == SIZE_MAX);
+            apn_mul(&c, &a, &p);
+            apn_bit_shl(&d, &a, shifts[i]);
+            CHECK(apn_cmp(&c, &d) == 0 && apn_bitlen(&d) == len + shifts[i]);
+            apn_bit_shr(&d, &d, shifts[i]);
+            CHECK(apn_cmp(&d, &a) == 0);
+            apn_div(&c, NULL, &a, &p);
+            apn_assign(&d, &a);
+            apn_bit_shr(&d, &d, shifts[i]); // aliased
+            CHECK(apn_cmp(&c, &d) == 0);
+            apn_clrbit(&p, shifts[i]);
+            CHECK(apn_is_zero(&p) && p._size == 1);
+        }
+
+        // a & b + a | b = a + b, a ^ b = a | b - a & b, a & ~b = a - a & b
+        apn_and(&c, &a, &b);
+        apn_or(&d, &a, &b);
+        CHECK(apn_popcount(&c) + apn_popcount(&d) == apn_popcount(&a) + apn_popcount(&b));
+        apn_add(&p, &c, &d);
+        apn_sub(&p, &p, &a);
+        CHECK(apn_cmp(&p, &b) == 0);
+        apn_sub(&d, &d, &c);
+        apn_xor(&p, &b, &a);
+        CHECK(apn_cmp(&p, &d) == 0);
+        apn_xor(&p, &p, &p); // aliased
+        CHECK(apn_is_zero(&p) && p._size == 1);
+        apn_sub(&d, &a, &c);
+        apn_andnot(&p, &a, &b);
+        CHECK(apn_cmp(&p, &d) == 0);
+        apn_andnot(&b, &a, &b); // aliased, b the shorter one
+        CHECK(apn_cmp(&b, &d) == 0);
+
+        size_t z = apn_scan1(&a, 0);
+        CHECK(z != SIZE_MAX && apn_tstbit(&a, z));
+        apn_clrbit(&a, z);
+        CHECK(apn_scan1(&a, 0) > z && apn_scan1(&a, z) == apn_scan1(&a, 0));
+        apn_setbit(&a, z);
+    }
+    apn_assign_dig(&a, 0);
+    CHECK(apn_bitlen(&a) == 0 && apn_popcount(&a) == 0 && apn_scan1(&a, 0) == SIZE_MAX);
+    apn_clear_list(&a, &b, &c, &d, &p, NULL);
+}
+
+static void test_mul(void) {
+    static void (*const muls[])(apn_s*, const apn_s*, const apn_s*) = {
+        apn_mul, apn_mul_karatsuba, apn_mul_toom33, apn_mul_toom44, apn_mul_fft,
+    };
+    static void (*const sqrs[])(apn_s*, const apn_s*) = {
+        apn_sqr, apn_sqr_basecase, apn_sqr_karatsuba, apn_sqr_toom33, apn_sqr_toom44,
+        apn_sqr_fft,
+    };
+    static const size_t sizes[][2] = {
+        { 1, 1 }, { 5, 3 }, { 17, 17 }, { 40, 33 }, { 100, 17 }, { 101, 101 },
+        { 260, 200 }, { 251, 251 }, { 400, 399 }, { 1000, 30 }, { 4100, 4001 },
+    };
+    apn_s a, b, r, s;
+    apn_init_list(&a, &b, &r, &s, NULL);
+    for(size_t i = 0; i != sizeof(sizes) / sizeof(sizes[0]); ++i) {
+        rand_apn(&a, sizes[i][0]);
+        rand_apn(&b, sizes[i][1]);
+        apn_mul_basecase(&r, &a, &b);
+        for(size_t j = 0; j != sizeof(muls) / sizeof(muls[0]); ++j) {
+            muls[j](&s, &a, &b);
+            CHECK(apn_cmp(&r, &s) == 0);
+        }
+        apn_mul_basecase(&r, &a, &a);
+        for(size_t j = 0; j != sizeof(sqrs) / sizeof(sqrs[0]); ++j) {
+            sqrs[j](&s, &a);
+            CHECK(apn_cmp(&r, &s) == 0);
+        }
+        apn_assign(&s, &a);
+        apn_mul(&s, &s, &b); // aliased
+        apn_mul_basecase(&r, &a, &b);
+        CHECK(apn_cmp(&r, &s) == 0);
+    }
+    apn_clear_list(&a, &b, &r, &s, NULL);
+}
+
+// a decimal round trip, on an application thread of its own
+static void* str_round_trip(void* arg) {
+    const apn_s* a = arg;
+    apn_s b;
+    apn_init(&b);
+    char* str = malloc(a->_size * 20 + 1);
+    apn_to_str(a, str, 10);
+    apn_assign_str(&b, str, 10);
+    bool ok = apn_cmp(a, &b) == 0;
+    free(str);
+    apn_clear(&b);
+    return ok ? arg : NULL;
+}
+
+// a product on an application thread, which helps the pool while it waits
+static void* mul_on_thread(void* arg) {
+    apn_s* a = arg;
+    apn_mul(&a[1], &a[0], &a[0]);
+    return NULL;
+}
+
+static void test_threads(void) {
+    apn_s a, b, r, s;
+    apn_init_list(&a, &b, &r, &s, NULL);
+    rand_apn(&a, 3000);
+    rand_apn(&b, 2500);
+    apn_mul(&r, &a, &b);
+    apn_threads_set(4);
+    apn_threads_set_grain(20);
+    CHECK(apn_threads_get() == 4);
+    for(int i = 0; i != 3; ++i) {
+        apn_mul(&s, &a, &b);
+        CHECK(apn_cmp(&r, &s) == 0);
+    }
+    apn_mul(&s, &a, &a);
+    apn_sqr_basecase(&r, &a);
+    CHECK(apn_cmp(&r, &s) == 0);
+    // its workspaces go when the thread exits
+    apn_s ops[2];
+    apn_init(&ops[0]);
+    apn_init(&ops[1]);
+    apn_assign(&ops[0], &a);
+    pthread_t thread;
+    pthread_create(&thread, NULL, mul_on_thread, ops);
+    pthread_join(thread, NULL);
+    CHECK(apn_cmp(&ops[1], &s) == 0);
+    apn_clear_list(&ops[0], &ops[1], NULL);
+    apn_threads_set(1);
+    apn_threads_set_grain(APN_THREAD_GRAIN);
+    apn_clear_list(&a, &b, &r, &s, NULL);
+
+    // conversions on several threads share the cached powers and tables
+    apn_str_cache_clear();
+    apn_s nums[4];
+    pthread_t threads[4];
+    for(int i = 0; i != 4; ++i) {
+        apn_init(&nums[i]);
+        rand_apn(&nums[i], 1000 + 300 * i);
+    }
+    for(int i = 0; i != 4; ++i)
+        pthread_create(&threads[i], NULL, str_round_trip, &nums[i]);
+    for(int i = 0; i != 4; ++i) {
+        void* ok;
+        pthread_join(threads[i], &ok);
+        CHECK(ok == &nums[i]);
+        apn_clear(&nums[i]);
+    }
+}
+
+static void test_div(void) {
+    static const size_t sizes[][2] = {
+        { 1, 1 }, { 2, 1 }, { 10, 3 }, { 50, 49 }, { 200, 100 }, { 300, 150 },
+        { 1000, 333 }, { 2000, 1000 }, { 2500, 101 },
+    };
+    apn_s a, b, q, r, q2, r2, t;
+    apn_init_list(&a, &b, &q, &r, &q2, &r2, &t, NULL);
+    for(size_t i = 0; i != sizeof(sizes) / sizeof(sizes[0]); ++i) {
+        rand_apn(&a, sizes[i][0]);
+        rand_apn(&b, sizes[i][1]);
+        b._data[b._size - 1] >>= i; // various normalization shifts
+        if(!b._data[b._size - 1])
+            b._data[b._size - 1] = 1;
+        apn_div(&q, &r, &a, &b);
+        CHECK(apn_cmp(&r, &b) < 0);
+        apn_mul(&t, &q, &b);
+        apn_add(&t, &t, &r);
+        CHECK(apn_cmp(&t, &a) == 0);
+        apn_div_basecase(&q2, &r2, &a, &b);
+        CHECK(apn_cmp(&q, &q2) == 0 && apn_cmp(&r, &r2) == 0);
+        if(b._size >= apn_threshold_get(APN_THRESHOLD_DIV_BZ)) {
+            apn_div_bz(&q2, &r2, &a, &b);
+            CHECK(apn_cmp(&q, &q2) == 0 && apn_cmp(&r, &r2) == 0);
+        }
+        apn_div_newton(&q2, &r2, &a, &b);
+        CHECK(apn_cmp(&q, &q2) == 0 && apn_cmp(&r, &r2) == 0);
+        apn_assign(&t, &a);
+        apn_div(&t, NULL, &t, &b); // aliased
+        CHECK(apn_cmp(&t, &q) == 0);
+        apn_idiv(&t, &a, &b);
+        CHECK(apn_cmp(&t, &q) == 0);
+
+        // exact quotients, even divisors included
+        apn_bit_shl(&b, &b, i);
+        apn_mul(&t, &q, &b);
+        apn_divexact(&q2, &t, &b);
+        CHECK(apn_cmp(&q2, &q) == 0);
+        if(!apn_is_zero(&q)) {
+            apn_divexact(&t, &t, &q); // aliased
+            CHECK(apn_cmp(&t, &b) == 0);
+        }
+    }
+
+    // one digit divisors, normalized or not, against the general division
+    for(size_t i = 0; i != 8; ++i) {
+        rand_apn(&a, 1 + 7 * i);
+        ap_dig_t d = rand_dig() >> (9 * i);
+        d += !d;
+        apn_assign_dig(&b, d);
+        apn_div(&q, &r, &a, &b);
+        ap_dig_t m = apn_divrem_dig(&q2, &a, d);
+        CHECK(apn_cmp(&q, &q2) == 0 && apn_cmp_dig(&r, m) == 0);
+        CHECK(apn_mod_dig(&a, d) == m);
+        apn_mul_dig(&t, &q, d);
+        apn_add_dig(&t, &t, m);
+        CHECK(apn_cmp(&t, &a) == 0);
+        apn_mul(&t, &q, &b);
+        apn_mul_dig(&q, &q, d); // aliased
+        CHECK(apn_cmp(&t, &q) == 0);
+        apn_dig_inv_s inv;
+        apn_dig_inv_init(&inv, d);
+        CHECK(apn_divrem_dig_inv(&a, &a, &inv) == m && apn_cmp(&a, &q2) == 0);
+    }
+
+    // Newton's reciprocal recursing down to Burnikel-Ziegler, within the
+    // workspace of apn_div_ws_size
+    apn_threshold_set(APN_THRESHOLD_DIV_NEWTON, 40);
+    for(size_t n = 40; n <= 1500; n = n * 3 - 7) {
+        rand_apn(&a, 2 * n + 3);
+        rand_apn(&b, n);
+        b._data[n - 1] >>= n % AP_DIG_BIT;
+        b._data[n - 1] += !b._data[n - 1];
+        apn_div_bz(&q2, &r2, &a, &b);
+        apn_ws_s ws;
+        apn_ws_init(&ws);
+        apn_ws_reserve(&ws, apn_div_ws_size(a._size, b._size));
+        ap_dig_t* p = ws._data;
+        apn_div_ws(&q, &r, &a, &b, &ws);
+        CHECK(ws._data == p && apn_cmp(&q, &q2) == 0 && apn_cmp(&r, &r2) == 0);
+        apn_ws_clear(&ws);
+    }
+    apn_threshold_reset();
+    apn_clear_list(&a, &b, &q, &r, &q2, &r2, &t, NULL);
+}
+
+static void test_exp(void) {
+    apn_s a, e, r, m;
+    apn_init_list(&a, &e, &r, &m, NULL);
+    apn_assign_dig(&a, 3);
+    apn_exp_dig(&r, &a, 200);
+    CHECK(str_is(&r, 10, "265613988875874769338781322035779626829233452653394495974574961"
+                         "739092490901302182994384699044001"));
+    apn_assign_dig(&e, 200);
+    apn_exp(&m, &a, &e);
+    CHECK(apn_cmp(&m, &r) == 0);
+    apn_exp_bysqr(&m, &a, &e);
+    CHECK(apn_cmp(&m, &r) == 0);
+
+    apn_assign_dig(&r, 1);
+    for(ap_dig_t i = 2; i <= 100; ++i) {
+        apn_assign_dig(&a, i);
+        apn_mul(&r, &r, &a);
+    }
+    CHECK(str_is(&r, 10, "933262154439441526816992388562667004907159682643816214685929638"
+                         "952175999932299156089414639761565182862536979208272237582511852"
+                         "10916864000000000000000000000000"));
+
+    // Fermat on the Mersenne prime 2^521 - 1, by Montgomery, by Barrett and
+    // in a batch with an even modulus
+    apn_assign_dig(&m, 1);
+    apn_shl(&m, &m, 8);
+    apn_bit_shl(&m, &m, 9);
+    apn_sub_dig(&m, &m, 1);
+    CHECK(m._size == 9);
+    apn_sub_dig(&e, &m, 1);
+    rand_apn(&a, 5);
+    apn_modexp(&r, &a, &e, &m);
+    CHECK(apn_cmp_dig(&r, 1) == 0);
+    apn_barrett_s ctx;
+    apn_barrett_init(&ctx, &m);
+    apn_barrett_modexp(&r, &a, &e, &ctx);
+    CHECK(apn_cmp_dig(&r, 1) == 0);
+    apn_barrett_clear(&ctx);
+
+    enum { jobs = 6 };
+    apn_s base[jobs], exp[jobs], mod[jobs], res[jobs], one[jobs];
+    a._data[0] &= ~(ap_dig_t)1;
+    for(int i = 0; i != jobs; ++i) {
+        apn_init_list(&base[i], &exp[i], &mod[i], &res[i], &one[i], NULL);
+        rand_apn(&base[i], 3 + i);
+        rand_apn(&exp[i], 2);
+        apn_assign(&mod[i], i % 3 ? &m : &a);
+        apn_modexp(&one[i], &base[i], &exp[i], &mod[i]);
+    }
+    // on four threads, then all of them on the caller
+    for(int t = 4; t; t /= 4) {
+        apn_threads_set(t);
+        apn_modexp_batch(res, base, exp, mod, jobs);
+        for(int i = 0; i != jobs; ++i)
+            CHECK(apn_cmp(&one[i], &res[i]) == 0);
+    }
+    for(int i = 0; i != jobs; ++i)
+        apn_clear_list(&base[i], &exp[i], &mod[i], &res[i], &one[i], NULL);
+    apn_clear_list(&a, &e, &r, &m, NULL);
+}
+
+// Euclid's algorithm by divisions
+static void gcd_euclid(apn_s* res, const apn_s* op1, const apn_s* op2) {
+    apn_s a, b, q;
+    apn_init_list(&a, &b, &q, NULL);
+    apn_assign(&a, op1);
+    apn_assign(&b, op2);
+    while(!apn_is_zero(&b)) {
+        apn_div(&q, &a, &a, &b);
+        apn_swap(&a, &b);
+    }
+    apn_swap(res, &a);
+    apn_clear_list(&a, &b, &q, NULL);
+}
+
+// g divides both and is s a + t b, so it is the gcd
+static void check_gcdext(const apz_s* a, const apz_s* b) {
+    apn_s g, t2, r;
+    apz_s s, t, x, y;
+    apn_init_list(&g, &t2, &r, NULL);
+    apz_init_list(&s, &t, &x, &y, NULL);
+    apz_gcdext(&g, &s, &t, a, b);
+    apn_gcd(&r, &a->magnitude, &b->magnitude);
+    CHECK(apn_cmp(&g, &r) == 0);
+    if(!apn_is_zero(&g)) {
+        apn_div(&t2, &r, &a->magnitude, &g);
+        CHECK(apn_is_zero(&r));
+        apn_div(&t2, &r, &b->magnitude, &g);
+        CHECK(apn_is_zero(&r));
+        apn_mul(&r, &s.magnitude, &g);
+        apn_add(&r, &r, &r);
+        CHECK(apn_cmp(&r, &b->magnitude) <= 0 || apn_cmp_dig(&s.magnitude, 1) == 0);
+        if(apn_is_zero(&b->magnitude))
+            CHECK(apn_cmp_dig(&s.magnitude, 1) == 0 && s.sign == a->sign
+                  && apn_is_zero(&t.magnitude));
+    }
+    apz_mul(&x, &s, a);
+    apz_mul(&y, &t, b);
+    apz_add(&x, &x, &y);
+    CHECK(apn_cmp(&x.magnitude, &g) == 0 && (!x.sign || apn_is_zero(&g)));
+    apn_clear_list(&g, &t2, &r, NULL);
+    apz_clear_list(&s, &t, &x, &y, NULL);
+}
+
+static void test_gcd(void) {
+    static const size_t sizes[][3] = { // a, b and a common factor
+        { 1, 1, 0 }, { 2, 1, 1 }, { 3, 3, 0 }, { 10, 7, 2 }, { 60, 60, 5 },
+        { 300, 290, 0 }, { 500, 499, 40 }, { 2100, 2050, 100 },
+    };
+    apn_s a, b, c, g, r;
+    apz_s x, y;
+    apn_init_list(&a, &b, &c, &g, &r, NULL);
+    apz_init_list(&x, &y, NULL);
+    for(size_t i = 0; i != sizeof(sizes) / sizeof(sizes[0]); ++i) {
+        rand_apn(&a, sizes[i][0]);
+        rand_apn(&b, sizes[i][1]);
+        if(sizes[i][2]) {
+            rand_apn(&c, sizes[i][2]);
+            apn_mul(&a, &a, &c);
+            apn_mul(&b, &b, &c);
+        }
+        apn_gcd(&g, &a, &b);
+        if(a._size <= 300) {
+            gcd_euclid(&r, &a, &b);
+            CHECK(apn_cmp(&g, &r) == 0);
+        }
+        apz_assign_n(&x, &a);
+        apz_assign_n(&y, &b);
+        x.sign = i & 1;
+        y.sign = i & 2;
+        check_gcdext(&x, &y);
+        check_gcdext(&y, &x);
+    }
+
+    // zeros and equal operands
+    apn_assign_dig(&y.magnitude, 0);
+    check_gcdext(&x, &y);
+    check_gcdext(&y, &x);
+    check_gcdext(&y, &y);
+    check_gcdext(&x, &x);
+
+    // inverses modulo the Mersenne prime 2^521 - 1 and an even modulus
+    apn_assign_dig(&c, 1);
+    apn_shl(&c, &c, 8);
+    apn_bit_shl(&c, &c, 9);
+    apn_sub_dig(&c, &c, 1);
+    for(int i = 0; i != 2; ++i) {
+        rand_apn(&a, 12);
+        a._data[0] |= 1;
+        CHECK(apn_invert(&g, &a, &c));
+        apn_mul(&r, &g, &a);
+        apn_div(NULL, &r, &r, &c);
+        CHECK(apn_cmp_dig(&r, 1) == 0 && apn_cmp(&g, &c) < 0);
+        apn_add_dig(&c, &c, 1);
+    }
+    apn_assign_dig(&a, 6); // not invertible modulo 2^521
+    apn_assign_dig(&g, 5);
+    CHECK(!apn_invert(&g, &a, &c) && apn_cmp_dig(&g, 5) == 0);
+    apn_clear_list(&a, &b, &c, &g, &r, NULL);
+    apz_clear_list(&x, &y, NULL);
+}
+
+// res^k <= op < (res + 1)^k and rem = op - res^k
+static bool is_root(const apn_s* res, const apn_s* rem, const apn_s* op, ap_dig_t k) {
+    apn_s t, u;
+    apn_init_list(&t, &u, NULL);
+    apn_exp_dig(&t, res, k);
+    bool ok = apn_cmp(&t, op) <= 0;
+    if(ok) {
+        apn_sub(&u, op, &t);
+        ok = apn_cmp(&u, rem) == 0;
+        apn_add_dig(&u, res, 1);
+        apn_exp_dig(&t, &u, k);
+        ok = ok && apn_cmp(&t, op) > 0;
+    }
+    apn_clear_list(&t, &u, NULL);
+    return ok;
+}
+
+static void test_root(void) {
+    static const size_t sizes[] = { 1, 2, 3, 4, 7, 20, 101, 400, 1500 };
+    static const ap_dig_t ks[] = { 2, 3, 5, 17, 200 };
+    apn_s a, s, r;
+    apn_init_list(&a, &s, &r, NULL);
+    for(size_t i = 0; i != sizeof(sizes) / sizeof(sizes[0]); ++i) {
+        rand_apn(&a, sizes[i]);
+        a._data[a._size - 1] >>= i * 7; // various top bits
+        if(!a._data[a._size - 1])
+            a._data[a._size - 1] = 1;
+        for(size_t j = 0; j != sizeof(ks) / sizeof(ks[0]); ++j) {
+            apn_rootrem(&s, &r, &a, ks[j]);
+            CHECK(is_root(&s, &r, &a, ks[j]));
+        }
+        // squares and powers
+        apn_sqrtrem(&s, &r, &a);
+        CHECK(!apn_perfect_square(&a) == !apn_is_zero(&r));
+        apn_sqr(&r, &s);
+        CHECK(apn_perfect_square(&r));
+        apn_sqrtrem(&r, NULL, &r); // aliased
+        CHECK(apn_cmp(&r, &s) == 0);
+        if(sizes[i] <= 101) {
+            apn_exp_dig(&r, &s, 7);
+            CHECK(apn_perfect_power(&r));
+            apn_add_dig(&r, &r, 2);
+            CHECK(!apn_perfect_power(&r));
+        }
+    }
+    apn_assign_dig(&a, 0);
+    apn_rootrem(&s, &r, &a, 3);
+    CHECK(apn_is_zero(&s) && apn_is_zero(&r));
+    CHECK(apn_perfect_square(&a) && apn_perfect_power(&a));
+    apn_assign_dig(&a, 3);
+    apn_exp_dig(&a, &a, 55); // 3^55 = (3^5)^11, not a square
+    CHECK(!apn_perfect_square(&a) && apn_perfect_power(&a));
+    apn_assign_dig(&a, 6);
+    apn_shl(&a, &a, 3); // 6 2^192, the trailing zeros are a multiple of 3
+    CHECK(!apn_perfect_power(&a));
+    apn_shr(&a, &a, 2);
+    apn_exp_dig(&a, &a, 3); // 27 2^195
+    CHECK(apn_perfect_power(&a));
+    apn_assign_dig(&a, 3);
+    apn_exp_dig(&a, &a, 1009);
+    CHECK(apn_perfect_power(&a));
+    apn_add_dig(&a, &a, 2);
+    CHECK(!apn_perfect_power(&a));
+    apn_clear_list(&a, &s, &r, NULL);
+}
+
+// every algorithm down to the smallest sizes it takes
+static void test_thresholds(void) {
+    CHECK(apn_threshold_get(APN_THRESHOLD_MUL_KARATSUBA) == APN_MUL_KARATSUBA_THRESHOLD);
+    CHECK(!strcmp(apn_threshold_name(APN_THRESHOLD_DIV_BZ_BLOCKSIZE), "APN_DIV_BZ_BLOCKSIZE"));
+    for(int t = 0; t != APN_THRESHOLD_COUNT; ++t)
+        CHECK(apn_threshold_set(t, 0) >= 1);
+
+    apn_s a, b, r, s, q;
+    apn_init_list(&a, &b, &r, &s, &q, NULL);
+    for(size_t n = 1; n <= 80; n = n * 5 / 4 + 1) {
+        for(size_t m = 1; m <= n; m = m * 2 + 1) {
+            rand_apn(&a, n);
+            rand_apn(&b, m);
+            apn_mul(&r, &a, &b);
+            apn_mul_basecase(&s, &a, &b);
+            CHECK(apn_cmp(&r, &s) == 0);
+            apn_div(&q, &r, &a, &b);
+            apn_mul(&s, &q, &b);
+            apn_add(&s, &s, &r);
+            CHECK(apn_cmp(&s, &a) == 0 && apn_cmp(&r, &b) < 0);
+            apn_mul(&r, &a, &b);
+            apn_divexact(&s, &r, &b);
+            CHECK(apn_cmp(&s, &a) == 0);
+        }
+        apn_sqr(&r, &a);
+        apn_sqr_basecase(&s, &a);
+        CHECK(apn_cmp(&r, &s) == 0);
+        apn_mul(&r, &a, &b); // a common factor
+        apn_mul(&s, &b, &b);
+        apn_gcd(&q, &r, &s);
+        gcd_euclid(&r, &r, &s);
+        CHECK(apn_cmp(&q, &r) == 0);
+        char* str = malloc(n * AP_DIG_BIT + 2);
+        apn_to_str(&a, str, 10);
+        apn_assign_str(&b, str, 10);
+        CHECK(apn_cmp(&a, &b) == 0);
+        free(str);
+    }
+    apn_threshold_reset();
+    CHECK(apn_threshold_get(APN_THRESHOLD_TO_STR_DC) == APN_TO_STR_DC_THRESHOLD);
+    apn_str_cache_clear();
+    apn_clear_list(&a, &b, &r, &s, &q, NULL);
+}
+
+static void* trace_adds(void* arg) {
+    apn_s* a = arg;
+    for(int i = 0; i != 3000; ++i)
+        apn_add(&a[1], &a[0], &a[0]);
+    return NULL;
+}
+
+// the events of op in the trace dump at path
+static size_t trace_count(const char* path, const char* op) {
+    char pattern[64], line[256];
+    snprintf(pattern, sizeof(pattern), "\"name\":\"%s\"", op);
+    size_t n = 0;
+    FILE* f = fopen(path, "r");
+    while(f && fgets(line, sizeof(line), f))
+        n += strstr(line, pattern) != NULL;
+    if(f)
+        fclose(f);
+    return n;
+}
+
+static void test_stats(void) {
+    apn_stats_s st;
+    apn_stats_reset();
+    apn_s a, b, r;
+    apn_init_list(&a, &b, &r, NULL);
+    rand_apn(&a, 300);
+    rand_apn(&b, 300);
+    apn_mul(&r, &a, &b);
+    apn_add(&r, &r, &a);
+    apn_stats_snapshot(&st);
+    if(!apn_stats_enabled()) {
+        CHECK(st.op[APN_STATS_MUL].calls == 0);
+    } else {
+        CHECK(st.op[APN_STATS_MUL].calls == 1 && st.op[APN_STATS_ADD].calls == 1);
+        CHECK(st.op[APN_STATS_MUL].sizes[8] == 1); // 256 <= 300 < 512
+        CHECK(st.tier[APN_STATS_MUL_KARATSUBA] + st.tier[APN_STATS_MUL_TOOM33] > 0);
+        CHECK(st.allocs > 0);
+
+        // dumps while another thread records, over several chunks
+        const char* path = "apn_test_trace.json";
+        apn_s ops[2];
+        apn_init_list(&ops[0], &ops[1], NULL);
+        apn_stats_trace(true);
+        pthread_t thread;
+        pthread_create(&thread, NULL, trace_adds, ops);
+        CHECK(apn_stats_trace_dump(path));
+        pthread_join(thread, NULL);
+        CHECK(apn_stats_trace_dump(path) && trace_count(path, "add") == 3000);
+        apn_stats_reset();
+        for(int i = 0; i != 10; ++i)
+            apn_add(&r, &a, &b);
+        CHECK(apn_stats_trace_dump(path) && trace_count(path, "add") == 10);
+        apn_stats_trace(false);
+        apn_stats_reset();
+        remove(path);
+        apn_clear_list(&ops[0], &ops[1], NULL);
+    }
+    CHECK(!strcmp(apn_stats_op_name(APN_STATS_ASSIGN_STR), "assign_str"));
+    CHECK(!strcmp(apn_stats_tier_name(APN_STATS_DIV_BZ), "div_bz"));
+    apn_clear_list(&a, &b, &r, NULL);
+}
+
+static void test_apz(void) {
+    apz_s a, b, q, r;
+    apz_init_list(&a, &b, &q, &r, NULL);
+    apn_assign_dig(&a.magnitude, 7);
+    apn_assign_dig(&b.magnitude, 2);
+    a.sign = true; // -7
+    apz_div(&q, &r, &a, &b);
+    CHECK(apn_cmp_dig(&q.magnitude, 3) == 0 && q.sign);
+    CHECK(apn_cmp_dig(&r.magnitude, 1) == 0 && r.sign);
+    apz_mod(&r, &a, &b);
+    CHECK(apn_cmp_dig(&r.magnitude, 1) == 0 && !r.sign);
+    apz_add(&r, &a, &b);
+    CHECK(apn_cmp_dig(&r.magnitude, 5) == 0 && r.sign);
+    apz_mul(&r, &a, &a);
+    CHECK(apn_cmp_dig(&r.magnitude, 49) == 0 && !r.sign);
+    apz_clear_list(&a, &b, &q, &r, NULL);
+}
+
+int main(void) {
+    test_str();
+    test_io();
+    test_storage();
+    test_add_sub();
+    test_bits();
+    test_mul();
+    test_threads();
+    test_div();
+    test_exp();
+    test_gcd();
+    test_root();
+    test_thresholds();
+    test_stats();
+    test_apz();
+    if(failures)
+        fprintf(stderr, "%d checks failed\n", failures);
+    return failures != 0;
+}
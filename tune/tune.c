@@ -0,0 +1,231 @@
+#include "apn.h"
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+// Finds the thresholds of apn.h on this machine and writes them as
+// apn_tuned.h, build with -DAPN_TUNED_HEADER=<path> to use them.
+//
+//   tune [-t seconds] [output]
+//
+// Each threshold is found from the lower algorithm and the next one up
+// timed at the same size n, with the threshold set so that only the top
+// level changes, the sub-products below stay the same. The threshold is
+// where the upper algorithm starts to win at consecutive sizes. The lower
+// thresholds are tuned first and used for the upper ones.
+
+static apn_s a, b, q, r;
+static char* str;
+static double seconds = 0.002; // shortest timed round
+
+static uint64_t rng_state = 0x9E3779B97F4A7C15ULL;
+
+static ap_dig_t rand_dig(void) {
+    rng_state ^= rng_state << 13;
+    rng_state ^= rng_state >> 7;
+    rng_state ^= rng_state << 17;
+    return rng_state;
+}
+
+static void rand_apn(apn_s* o, size_t n) {
+    apn_reserve(o, n);
+    for(size_t i = 0; i != n; ++i)
+        o->_data[i] = rand_dig();
+    if(!o->_data[n - 1])
+        o->_data[n - 1] = 1;
+    o->_size = n;
+}
+
+static void setup_binary(size_t n) {
+    rand_apn(&a, n);
+    rand_apn(&b, n);
+}
+
+static void setup_div(size_t n) {
+    rand_apn(&a, 2 * n);
+    rand_apn(&b, n);
+}
+
+// the product of two n digit numbers and one of them
+static void setup_divexact(size_t n) {
+    setup_binary(n);
+    apn_mul(&q, &a, &b);
+}
+
+// n digits, as a decimal string for the parsing
+static void setup_str(size_t n) {
+    rand_apn(&a, n);
+    free(str);
+    str = malloc(n * 20 + 21);
+    apn_to_str(&a, str, 10);
+}
+
+// parsing counts in chunks of 19 decimal digits
+static void setup_str_chunks(size_t n) {
+    setup_str(n + 1);
+    str[n * 19] = '\0';
+}
+
+// the half-gcd of n digits on top of a single step of the subquadratic gcd
+static void setup_hgcd(size_t n) {
+    setup_binary(3 * n);
+    apn_threshold_set(APN_THRESHOLD_GCD_DC, 3 * n);
+}
+
+static void run_mul(void) { apn_mul(&r, &a, &b); }
+static void run_sqr(void) { apn_sqr(&r, &a); }
+static void run_div(void) { apn_div(&q, &r, &a, &b); }
+static void run_divexact(void) { apn_divexact(&r, &q, &b); }
+static void run_to_str(void) { apn_to_str(&a, str, 10); }
+static void run_assign_str(void) { apn_assign_str(&r, str, 10); }
+static void run_gcd(void) { apn_gcd(&r, &a, &b); }
+
+static double now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+// seconds per call, the best of a few rounds of at least `seconds`
+static double measure(void (*run)(void)) {
+    size_t n = 1;
+    double best = 0;
+    for(int round = 0; round != 5;) {
+        double t = now();
+        for(size_t i = 0; i != n; ++i)
+            run();
+        t = now() - t;
+        if(t < seconds) {
+            n *= 2;
+            continue;
+        }
+        if(!round++ || t / n < best)
+            best = t / n;
+    }
+    return best;
+}
+
+// sizes grow by about 10%
+static size_t next_size(size_t n) {
+    return n < 10 ? n + 1 : n + n / 10;
+}
+
+struct tune {
+    enum apn_threshold t;
+    size_t             lo, hi; // range searched
+    bool               inclusive; // the lower algorithm runs up to the threshold
+    bool               half; // the threshold is also where the recursion stops
+    void               (*setup)(size_t n);
+    void               (*run)(void);
+};
+
+// the size where the upper algorithm wins three times in a row
+static size_t tune_threshold(const struct tune* tu) {
+    int wins = 0;
+    size_t first = 0;
+    for(size_t n = tu->lo; n <= tu->hi; n = next_size(n)) {
+        tu->setup(n);
+        // the threshold with n on either side of it
+        apn_threshold_set(tu->t, tu->inclusive ? n : n + 1);
+        double lower = measure(tu->run);
+        apn_threshold_set(tu->t, tu->inclusive ? n - 1 : tu->half ? n / 2 + 1 : n);
+        double upper = measure(tu->run);
+        if(upper < lower) {
+            if(!wins++)
+                first = n;
+            if(wins == 3)
+                return tu->inclusive ? first - 1 : first;
+        } else
+            wins = 0;
+    }
+    return tu->hi;
+}
+
+// the block size with the least time over some divisions above the threshold
+static size_t tune_blocksize(void) {
+    static const size_t sizes[] = { 8, 12, 16, 24, 32, 48, 64, 96, 128 };
+    size_t bz = apn_threshold_get(APN_THRESHOLD_DIV_BZ), best = 0;
+    double best_time = 0;
+    for(size_t i = 0; i != sizeof(sizes) / sizeof(sizes[0]); ++i) {
+        apn_threshold_set(APN_THRESHOLD_DIV_BZ_BLOCKSIZE, sizes[i]);
+        double t = 0;
+        for(size_t n = 2 * bz; n <= 16 * bz; n = n * 3 / 2) {
+            setup_div(n);
+            t += measure(run_div) / n;
+        }
+        if(!best || t < best_time)
+            best = sizes[i], best_time = t;
+    }
+    return best;
+}
+
+static const struct tune tunes[] = {
+    { APN_THRESHOLD_MUL_KARATSUBA,    2,   300, true,  false, setup_binary, run_mul },
+    { APN_THRESHOLD_SQR_KARATSUBA,    2,   300, true,  false, setup_binary, run_sqr },
+    { APN_THRESHOLD_MUL_TOOM33,       0,  2000, true,  false, setup_binary, run_mul },
+    { APN_THRESHOLD_SQR_TOOM33,       0,  2000, true,  false, setup_binary, run_sqr },
+    { APN_THRESHOLD_MUL_TOOM44,       0,  4000, true,  false, setup_binary, run_mul },
+    { APN_THRESHOLD_SQR_TOOM44,       0,  4000, true,  false, setup_binary, run_sqr },
+    { APN_THRESHOLD_MUL_FFT,          0, 50000, true,  false, setup_binary, run_mul },
+    { APN_THRESHOLD_SQR_FFT,          0, 50000, true,  false, setup_binary, run_sqr },
+    { APN_THRESHOLD_DIV_BZ,           4,  2000, false, true,  setup_div, run_div },
+    { APN_THRESHOLD_DIV_BZ_BLOCKSIZE, 0,     0, false, false, NULL, NULL },
+    { APN_THRESHOLD_TO_STR_DC,        3,  1000, false, false, setup_str, run_to_str },
+    { APN_THRESHOLD_ASSIGN_STR_DC,    2,   500, false, false, setup_str_chunks, run_assign_str },
+    { APN_THRESHOLD_HGCD,            30,  2000, false, true,  setup_hgcd, run_gcd },
+    { APN_THRESHOLD_GCD_DC,         100, 10000, false, false, setup_binary, run_gcd },
+    { APN_THRESHOLD_DIV_NEWTON,     1000, 200000, false, false, setup_div, run_div },
+    { APN_THRESHOLD_DIVEXACT_NEWTON, 100,  20000, false, false, setup_divexact, run_divexact },
+};
+
+int main(int argc, char** argv) {
+    const char* path = "apn_tuned.h";
+    for(int i = 1; i < argc; ++i) {
+        if(!strcmp(argv[i], "-t") && i + 1 < argc)
+            seconds = strtod(argv[++i], NULL);
+        else if(argv[i][0] == '-') {
+            fprintf(stderr, "usage: %s [-t seconds] [output]\n", argv[0]);
+            return 2;
+        } else
+            path = argv[i];
+    }
+
+    apn_init_list(&a, &b, &q, &r, NULL);
+    // the upper tiers stay off until their turn, apn_threshold_set keeps
+    // the results as the next ones are tuned
+    for(int t = APN_THRESHOLD_MUL_TOOM33; t <= APN_THRESHOLD_SQR_FFT; ++t)
+        if(t != APN_THRESHOLD_SQR_KARATSUBA)
+            apn_threshold_set(t, SIZE_MAX);
+    size_t value[APN_THRESHOLD_COUNT];
+    for(size_t i = 0; i != sizeof(tunes) / sizeof(tunes[0]); ++i) {
+        struct tune tu = tunes[i];
+        if(tu.t == APN_THRESHOLD_DIV_BZ_BLOCKSIZE)
+            value[tu.t] = tune_blocksize();
+        else {
+            if(!tu.lo) // above the tier below
+                tu.lo = value[tu.t - 1] + 1;
+            value[tu.t] = tune_threshold(&tu);
+        }
+        apn_threshold_set(tu.t, value[tu.t]);
+        fprintf(stderr, "%-28s %zu\n", apn_threshold_name(tu.t), value[tu.t]);
+    }
+
+    FILE* f = fopen(path, "w");
+    if(!f) {
+        perror(path);
+        return 1;
+    }
+    fprintf(f, "#ifndef HOPE_BIGNUM_APN_TUNED_H\n#define HOPE_BIGNUM_APN_TUNED_H\n\n");
+    fprintf(f, "// written by tune\n");
+    for(int t = 0; t != APN_THRESHOLD_COUNT; ++t)
+        fprintf(f, "#define %-28s %zu\n", apn_threshold_name(t), value[t]);
+    fprintf(f, "\n#endif // HOPE_BIGNUM_APN_TUNED_H\n");
+    fclose(f);
+
+    free(str);
+    apn_clear_list(&a, &b, &q, &r, NULL);
+    apn_str_cache_clear();
+    return 0;
+}